@@ -0,0 +1,35 @@
+#include "rocket/common/codel.h"
+
+namespace rocket_rpc {
+
+Codel::Codel(int64_t target_us, int64_t interval_us) : m_target(target_us), m_interval(interval_us) {
+}
+
+bool Codel::overloaded(int64_t delay, int64_t now) {
+  int64_t interval_end = m_interval_end.load(std::memory_order_relaxed);
+  if (now > interval_end && m_interval_end.compare_exchange_strong(interval_end, now + m_interval, std::memory_order_relaxed)) {
+    // 一个周期结束(只有一个线程能进来), 根据这个周期的最小排队时间判断是否过载, 当前请求作为下一个周期的第一个样本
+    int64_t min_delay = m_min_delay.exchange(delay, std::memory_order_relaxed);
+    m_overloaded.store(min_delay > m_target, std::memory_order_relaxed);
+  } else {
+    int64_t min_delay = m_min_delay.load(std::memory_order_relaxed);
+    while (delay < min_delay && !m_min_delay.compare_exchange_weak(min_delay, delay, std::memory_order_relaxed)) {
+    }
+  }
+
+  if (m_overloaded.load(std::memory_order_relaxed) && delay > 2 * m_target) {
+    m_rejected.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+  return false;
+}
+
+bool Codel::isOverloaded() {
+  return m_overloaded.load(std::memory_order_relaxed);
+}
+
+int64_t Codel::getRejectedCount() {
+  return m_rejected.load(std::memory_order_relaxed);
+}
+
+}
\ No newline at end of file
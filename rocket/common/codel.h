@@ -0,0 +1,37 @@
+#ifndef ROCKET_RPC_COMMON_CODEL_H
+#define ROCKET_RPC_COMMON_CODEL_H
+
+#include <stdint.h>
+#include <atomic>
+
+namespace rocket_rpc {
+
+// CoDel 风格的过载判断, 可以在多个线程中同时调用
+// 以 interval 为周期统计请求排队时间(从解包到开始执行)的最小值, 一个周期内最小值都超过 target, 说明队列一直没有排空, 处于过载状态
+// 过载时排队时间超过 2 * target 的请求直接拒绝, 这些请求的调用方多半已经等不及了, 执行它们只会让后面的请求也超时
+// 只看最小值, 短暂的突发不会触发拒绝
+class Codel {
+  public:
+    Codel(int64_t target_us, int64_t interval_us);
+
+    // 请求开始执行之前调用, delay 为排队时间(us), 返回 true 表示应该拒绝
+    bool overloaded(int64_t delay, int64_t now);
+
+    bool isOverloaded();
+
+    int64_t getRejectedCount();
+
+  private:
+    int64_t m_target {0};
+    int64_t m_interval {0};
+
+    std::atomic<int64_t> m_interval_end {0};   // 当前统计周期结束的时间
+    std::atomic<int64_t> m_min_delay {0};      // 当前周期内的最小排队时间
+    std::atomic<bool> m_overloaded {false};    // 上一个周期的判断结果
+
+    std::atomic<int64_t> m_rejected {0};
+};
+
+}
+
+#endif
\ No newline at end of file
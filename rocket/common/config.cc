@@ -16,6 +16,22 @@ if (!name##_node) { \
   } \
   std::string name##_str = std::string(name##_node->GetText()); \
 
+#define READ_STR_FROM_XML_NODE_OR_DEFAULT(name, parent, value) \
+  { \
+    TiXmlElement* name##_node = parent->FirstChildElement(#name); \
+    if (name##_node && name##_node->GetText()) { \
+      value = std::string(name##_node->GetText()); \
+    } \
+  } \
+
+#define READ_INT_FROM_XML_NODE_OR_DEFAULT(name, parent, value) \
+  { \
+    TiXmlElement* name##_node = parent->FirstChildElement(#name); \
+    if (name##_node && name##_node->GetText()) { \
+      value = std::atoi(name##_node->GetText()); \
+    } \
+  } \
+
 namespace rocket_rpc {
 
 static Config* g_config = NULL;
@@ -79,6 +95,39 @@ Config::Config(const char* xmlfile) {
 
   m_port = std::atoi(port_str.c_str());
   m_io_threads = std::atoi(io_threads_str.c_str());
+  READ_INT_FROM_XML_NODE_OR_DEFAULT(reply_batch_bytes, server_node, m_reply_batch_bytes);
+  READ_INT_FROM_XML_NODE_OR_DEFAULT(busy_poll_us, server_node, m_busy_poll_us);
+
+  // 客户端配置, 可选
+  TiXmlElement* client_node = root_node->FirstChildElement("client");
+  if (client_node) {
+    READ_INT_FROM_XML_NODE_OR_DEFAULT(io_threads, client_node, m_client_io_threads);
+    READ_INT_FROM_XML_NODE_OR_DEFAULT(tinypb_version, client_node, m_client_tinypb_version);
+  }
+
+  // 定时器配置, 可选
+  TiXmlElement* timer_node = root_node->FirstChildElement("timer");
+  if (timer_node) {
+    READ_STR_FROM_XML_NODE_OR_DEFAULT(type, timer_node, m_timer_type);
+  }
+
+  // IO 多路复用配置, 可选
+  TiXmlElement* poller_node = root_node->FirstChildElement("poller");
+  if (poller_node) {
+    READ_STR_FROM_XML_NODE_OR_DEFAULT(type, poller_node, m_poller_type);
+    std::string edge_triggered = m_poller_edge_triggered ? "true" : "false";
+    READ_STR_FROM_XML_NODE_OR_DEFAULT(edge_triggered, poller_node, edge_triggered);
+    m_poller_edge_triggered = (edge_triggered == "true");
+  }
+
+  // 缓冲区配置, 可选
+  TiXmlElement* buffer_node = root_node->FirstChildElement("buffer");
+  if (buffer_node) {
+    READ_INT_FROM_XML_NODE_OR_DEFAULT(max_free_blocks, buffer_node, m_buffer_max_free_blocks);
+    std::string hugepage = m_buffer_hugepage ? "true" : "false";
+    READ_STR_FROM_XML_NODE_OR_DEFAULT(hugepage, buffer_node, hugepage);
+    m_buffer_hugepage = (hugepage == "true");
+  }
 
   TiXmlElement* stubs_node = root_node->FirstChildElement("stubs");
 
@@ -92,11 +141,59 @@ Config::Config(const char* xmlfile) {
       uint16_t port = std::atoi(node->FirstChildElement("port")->GetText());
       stub.addr = std::make_shared<IPNetAddr>(ip, port);
 
+      // 连接池配置, 可选
+      READ_INT_FROM_XML_NODE_OR_DEFAULT(min_conns, node, stub.min_conns);
+      READ_INT_FROM_XML_NODE_OR_DEFAULT(max_conns, node, stub.max_conns);
+      READ_INT_FROM_XML_NODE_OR_DEFAULT(idle_timeout, node, stub.idle_timeout);
+      READ_INT_FROM_XML_NODE_OR_DEFAULT(max_inflight, node, stub.max_inflight);
+
       m_rpc_stubs.insert(std::make_pair(stub.name, stub));
     }
   }
 
-  printf("Server -- PORT[%d], IO THREADS[%d]\n", m_port, m_io_threads);
+  // 服务端 service 配置, 可选
+  TiXmlElement* services_node = root_node->FirstChildElement("services");
+  if (services_node) {
+    for (TiXmlElement* node = services_node->FirstChildElement("service"); node; node = node->NextSiblingElement("service")) {
+      RpcServiceConfig service;
+      READ_STR_FROM_XML_NODE_OR_DEFAULT(name, node, service.name);
+      if (service.name.empty()) {
+        printf("Start rocket rpc server error, service name is empty\n");
+        exit(0);
+      }
+      READ_INT_FROM_XML_NODE_OR_DEFAULT(worker_threads, node, service.worker_threads);
+      READ_INT_FROM_XML_NODE_OR_DEFAULT(queue_size, node, service.queue_size);
+      READ_INT_FROM_XML_NODE_OR_DEFAULT(codel_target, node, service.codel_target);
+      READ_INT_FROM_XML_NODE_OR_DEFAULT(codel_interval, node, service.codel_interval);
+
+      TiXmlElement* methods_node = node->FirstChildElement("methods");
+      if (methods_node) {
+        for (TiXmlElement* method_node = methods_node->FirstChildElement("method"); method_node; method_node = method_node->NextSiblingElement("method")) {
+          std::string name;
+          int max_concurrency = 0;
+          READ_STR_FROM_XML_NODE_OR_DEFAULT(name, method_node, name);
+          READ_INT_FROM_XML_NODE_OR_DEFAULT(max_concurrency, method_node, max_concurrency);
+          if (!name.empty() && max_concurrency > 0) {
+            service.method_max_concurrency[name] = max_concurrency;
+          }
+        }
+      }
+      m_rpc_services[service.name] = service;
+    }
+  }
+
+  printf("Server -- PORT[%d], IO THREADS[%d], REPLY BATCH BYTES[%d], BUSY POLL[%d us]\n", m_port, m_io_threads, m_reply_batch_bytes, m_busy_poll_us);
+  printf("Client -- IO THREADS[%d], TINYPB VERSION[%d]\n", m_client_io_threads, m_client_tinypb_version);
+  printf("Timer -- TYPE[%s]\n", m_timer_type.c_str());
+  printf("Poller -- TYPE[%s], EDGE_TRIGGERED[%d]\n", m_poller_type.c_str(), m_poller_edge_triggered);
+  printf("Buffer -- MAX_FREE_BLOCKS[%d], HUGEPAGE[%d]\n", m_buffer_max_free_blocks, m_buffer_hugepage);
+  for (auto it = m_rpc_services.begin(); it != m_rpc_services.end(); ++it) {
+    printf("Service -- NAME[%s], WORKER THREADS[%d], QUEUE SIZE[%d], CODEL TARGET[%d ms], CODEL INTERVAL[%d ms]\n", it->first.c_str(),
+      it->second.worker_threads, it->second.queue_size, it->second.codel_target, it->second.codel_interval);
+    for (auto i = it->second.method_max_concurrency.begin(); i != it->second.method_max_concurrency.end(); ++i) {
+      printf("Service -- NAME[%s], METHOD[%s], MAX CONCURRENCY[%d]\n", it->first.c_str(), i->first.c_str(), i->second);
+    }
+  }
 
 } 
 
@@ -12,6 +12,20 @@ struct RpcStub {
   std::string name;
   NetAddr::s_ptr addr;
   int timeout {2000};
+  int min_conns {0};          // 每个线程的连接池预先建立并保持的最少连接数
+  int max_conns {8};          // 连接池中到该服务的最大连接数
+  int idle_timeout {60000};   // 空闲连接的最大存活时间, ms
+  int max_inflight {128};     // 单个连接上同时在途的请求数, 超过后新建连接(不超过 max_conns)
+};
+
+// 服务端每个 service 的配置
+struct RpcServiceConfig {
+  std::string name;           // service 的全名, 与 proto 中的一致
+  int worker_threads {0};     // 执行该 service 方法的业务线程数, 0 表示直接在 IO 线程中执行
+  int queue_size {1024};      // 每个业务线程队列的长度上限, 队列都满时拒绝请求
+  int codel_target {0};       // 请求排队时间的目标值(ms), 持续超过时开始拒绝排队过久的请求, 0 表示不开启
+  int codel_interval {100};   // 统计最小排队时间的周期(ms)
+  std::map<std::string, int> method_max_concurrency;  // method 名 -> 最大并发数(排队中和执行中的请求), 没有配置的不限制
 };
 
 class Config {
@@ -36,10 +50,25 @@ class Config {
 
     int m_port {0};
     int m_io_threads {0};
+    int m_reply_batch_bytes {64 * 1024};  // 一轮 loop 内同一连接合并发送的回包字节数上限, 0 表示不合并
+    int m_busy_poll_us {0};               // IO 线程阻塞等待之前先 0 超时轮询的时间, 微秒, 0 表示不轮询
+
+    int m_client_io_threads {1};  // 客户端 IO 线程数
+    int m_client_tinypb_version {2};  // 客户端连接使用的 TinyPB 最高版本, 2 时连接建立后先握手, 对端不支持时继续使用 1
+
+    std::string m_timer_type {"wheel"};  // 定时器实现: wheel(分层时间轮) 或者 multimap
+
+    std::string m_poller_type {"epoll"};  // IO 多路复用实现: epoll 或者 io_uring
+    bool m_poller_edge_triggered {false}; // 连接是否使用边缘触发, 只对 epoll 生效
+
+    int m_buffer_max_free_blocks {256};  // 每个线程 buffer block 池最多缓存的空闲 block 数
+    bool m_buffer_hugepage {false};      // buffer block 是否从 2MB 大页区域中分配
 
     TiXmlDocument* m_xml_document {NULL};
 
     std::map<std::string, RpcStub> m_rpc_stubs;
+
+    std::map<std::string, RpcServiceConfig> m_rpc_services;
     
 };
 
@@ -21,6 +21,10 @@ const int ERROR_METHOD_NOT_FOUND = SYS_ERROR_PREFIX(0009);  // method 不存在
 const int ERROR_PARSE_SERVICE_NAME = SYS_ERROR_PREFIX(0010);  // service name 解析失败
 const int ERROR_RPC_CHANNEL_INIT = SYS_ERROR_PREFIX(0011);  // rpc channel 初始化失败
 const int ERROR_RPC_PEER_ADDR = SYS_ERROR_PREFIX(0012);    // rpc 调用时候对端地址异常
+const int ERROR_RPC_SYNC_IN_IO_THREAD = SYS_ERROR_PREFIX(0013);  // 在客户端 IO 线程中发起同步 rpc 调用
+const int ERROR_SERVICE_BUSY = SYS_ERROR_PREFIX(0014);  // service 的业务线程队列已满或者 method 并发数达到上限, 请求被拒绝
+const int ERROR_SERVER_OVERLOADED = SYS_ERROR_PREFIX(0015);  // 服务端过载, 请求排队时间过长, 执行之前被拒绝
+const int ERROR_RPC_DEADLINE_EXCEEDED = SYS_ERROR_PREFIX(0016);  // 调用方给的超时时间已经用完, 请求不再执行
 
 
 #endif
\ No newline at end of file
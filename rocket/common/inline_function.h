@@ -0,0 +1,181 @@
+#ifndef ROCKET_RPC_COMMON_INLINE_FUNCTION_H
+#define ROCKET_RPC_COMMON_INLINE_FUNCTION_H
+
+#include <stddef.h>
+#include <new>
+#include <utility>
+#include <functional>
+#include <type_traits>
+
+namespace rocket_rpc {
+
+template <class Signature, size_t InlineSize = 96>
+class InlineFunction;
+
+// 只能移动的可调用对象, 用来替代任务队列和回调中的 std::function
+// 1. 不超过 InlineSize 字节(并且移动不会抛异常)的可调用对象直接放在对象内部, 不申请内存
+//    默认 96 字节, 能放下 RpcDispatcher::dispatch 中最大的那个 lambda(88 字节)
+// 2. 不能拷贝, 投递任务, 保存回调时都是移动, 捕获的 shared_ptr 等不会被再拷贝一次
+// 3. 和 std::function 一样, 调用 const 对象时也按非 const 调用被包装的对象, 所以可以包装 mutable lambda
+// 调用空的 InlineFunction 是未定义行为, 调用前需要判断
+template <class R, class... Args, size_t InlineSize>
+class InlineFunction<R(Args...), InlineSize> {
+  public:
+    InlineFunction() {}
+
+    InlineFunction(std::nullptr_t) {}
+
+    template <class F, class = typename std::enable_if<
+      !std::is_same<typename std::decay<F>::type, InlineFunction>::value &&
+      !std::is_same<typename std::decay<F>::type, std::nullptr_t>::value>::type>
+    InlineFunction(F&& f) {
+      typedef typename std::decay<F>::type Functor;
+      if (isEmpty(f)) {
+        return;
+      }
+      init<Functor>(std::forward<F>(f), std::integral_constant<bool, IsInline<Functor>::value>());
+    }
+
+    InlineFunction(InlineFunction&& other) noexcept {
+      moveFrom(other);
+    }
+
+    InlineFunction& operator=(InlineFunction&& other) noexcept {
+      if (this != &other) {
+        reset();
+        moveFrom(other);
+      }
+      return *this;
+    }
+
+    InlineFunction& operator=(std::nullptr_t) {
+      reset();
+      return *this;
+    }
+
+    InlineFunction(const InlineFunction&) = delete;
+
+    InlineFunction& operator=(const InlineFunction&) = delete;
+
+    ~InlineFunction() {
+      reset();
+    }
+
+    explicit operator bool() const {
+      return m_ops != NULL;
+    }
+
+    R operator()(Args... args) const {
+      return m_ops->invoke(&m_storage, std::forward<Args>(args)...);
+    }
+
+  private:
+    typedef typename std::aligned_storage<InlineSize>::type Storage;
+
+    struct Ops {
+      R (*invoke)(void* storage, Args&&... args);
+      void (*move)(void* dst, void* src);    // 移动到 dst, 并销毁 src
+      void (*destroy)(void* storage);
+    };
+
+    template <class Functor>
+    struct IsInline {
+      static const bool value = sizeof(Functor) <= sizeof(Storage)
+        && std::alignment_of<Functor>::value <= std::alignment_of<Storage>::value
+        && std::is_nothrow_move_constructible<Functor>::value;
+    };
+
+    // 直接放在 m_storage 中
+    template <class Functor>
+    struct InlineOps {
+      static Functor* get(void* storage) {
+        return static_cast<Functor*>(storage);
+      }
+      static R invoke(void* storage, Args&&... args) {
+        return (*get(storage))(std::forward<Args>(args)...);
+      }
+      static void move(void* dst, void* src) {
+        new (dst) Functor(std::move(*get(src)));
+        get(src)->~Functor();
+      }
+      static void destroy(void* storage) {
+        get(storage)->~Functor();
+      }
+      static const Ops* ops() {
+        static const Ops s_ops = {&invoke, &move, &destroy};
+        return &s_ops;
+      }
+    };
+
+    // 放不下的在堆上申请, m_storage 中只保存指针, 移动时只移动指针
+    template <class Functor>
+    struct HeapOps {
+      static Functor* get(void* storage) {
+        return *static_cast<Functor**>(storage);
+      }
+      static R invoke(void* storage, Args&&... args) {
+        return (*get(storage))(std::forward<Args>(args)...);
+      }
+      static void move(void* dst, void* src) {
+        *static_cast<Functor**>(dst) = get(src);
+      }
+      static void destroy(void* storage) {
+        delete get(storage);
+      }
+      static const Ops* ops() {
+        static const Ops s_ops = {&invoke, &move, &destroy};
+        return &s_ops;
+      }
+    };
+
+    template <class Functor, class F>
+    void init(F&& f, std::true_type) {
+      new (&m_storage) Functor(std::forward<F>(f));
+      m_ops = InlineOps<Functor>::ops();
+    }
+
+    template <class Functor, class F>
+    void init(F&& f, std::false_type) {
+      *reinterpret_cast<Functor**>(&m_storage) = new Functor(std::forward<F>(f));
+      m_ops = HeapOps<Functor>::ops();
+    }
+
+    // 空的函数指针和 std::function 包装之后也是空的
+    template <class F>
+    static bool isEmpty(const F&) {
+      return false;
+    }
+
+    template <class Signature>
+    static bool isEmpty(const std::function<Signature>& f) {
+      return !f;
+    }
+
+    template <class T>
+    static bool isEmpty(T* p) {
+      return p == NULL;
+    }
+
+    void moveFrom(InlineFunction& other) {
+      if (other.m_ops) {
+        m_ops = other.m_ops;
+        m_ops->move(&m_storage, &other.m_storage);
+        other.m_ops = NULL;
+      }
+    }
+
+    void reset() {
+      if (m_ops) {
+        m_ops->destroy(&m_storage);
+        m_ops = NULL;
+      }
+    }
+
+  private:
+    const Ops* m_ops {NULL};
+    mutable Storage m_storage;
+};
+
+}
+
+#endif
\ No newline at end of file
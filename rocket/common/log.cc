@@ -3,6 +3,8 @@
 #include <stdio.h>
 #include <assert.h>
 #include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "rocket/common/log.h"
 #include "rocket/common/util.h"
 #include "rocket/common/config.h"
@@ -73,9 +75,12 @@ void Logger::init() {
     return;
   }
 
-  // 注意解决循环依赖问题(构建Logger需要TimerEvent, TimerEvent又引用了Logger::DEBUGLOG, 所以需要二段构造)
-  m_timer_event = std::make_shared<TimerEvent>(Config::GetGlobalConfig()->m_log_sync_interval, true, std::bind(&Logger::syncLoop, this));
-  EventLoop::GetCurrentEventLoop()->addTimerEvent(m_timer_event);
+  // 同步线程会打印日志, 需要在 g_logger 赋值之后再启动, 所以是二段构造
+  m_sync_interval = Config::GetGlobalConfig()->m_log_sync_interval;
+  if (m_sync_interval <= 0) {
+    m_sync_interval = 500;
+  }
+  assert(pthread_create(&m_sync_thread, NULL, &Logger::SyncMain, this) == 0);
   signal(SIGSEGV, CoredumpHandler);
   signal(SIGABRT, CoredumpHandler);
   signal(SIGTERM, CoredumpHandler);
@@ -84,6 +89,15 @@ void Logger::init() {
   signal(SIGSTKFLT, CoredumpHandler);
 }
 
+void* Logger::SyncMain(void* arg) {
+  Logger* logger = reinterpret_cast<Logger*>(arg);
+  while (1) {
+    usleep(logger->m_sync_interval * 1000);
+    logger->syncLoop();
+  }
+  return NULL;
+}
+
 void Logger::flush() {
   syncLoop();
   m_async_logger->stop();
@@ -126,18 +140,22 @@ LogLevel StringToLogLevel(const std::string& log_level) {
   return Unknown;
 }
 
-std::string LogEvent::toString() {
-  struct timeval now_time;
-
-  gettimeofday(&now_time, nullptr);
-
-  struct tm now_time_t;
-  localtime_r(&(now_time.tv_sec), &now_time_t);
+// 同一秒内的日志共用格式化好的时间, 不用每条都调用 localtime_r
+static thread_local time_t t_log_second = -1;
+static thread_local char t_log_second_str[64];
 
-  char buf[128];
-  strftime(&buf[0], 128, "%y-%m-%d %H:%M:%S", &now_time_t);
-  std::string time_str(buf);
-  int ms = now_time.tv_usec / 1000;
+std::string LogEvent::toString() {
+  // loop 线程中使用本轮缓存的时间
+  int64_t now_us = getLoopWallTimeUs();
+  time_t second = now_us / 1000000;
+  if (second != t_log_second) {
+    struct tm now_time_t;
+    localtime_r(&second, &now_time_t);
+    strftime(t_log_second_str, sizeof(t_log_second_str), "%y-%m-%d %H:%M:%S", &now_time_t);
+    t_log_second = second;
+  }
+  std::string time_str(t_log_second_str);
+  int ms = (now_us % 1000000) / 1000;
   time_str = time_str + "." + std::to_string(ms);
 
   m_pid = getPid();
@@ -207,12 +225,17 @@ void* AsyncLogger::Loop(void * arg) {
 
   while (1) {
     ScopeMutex<Mutex> lock(logger->m_mutex);
-    while (logger->m_buffer.empty()) {
+    while (logger->m_buffer.empty() && !logger->m_stop_flag) {
       // printf("begin pthread_cond_wait back \n");
       pthread_cond_wait(&(logger->m_condition), logger->m_mutex.getMutex());
     }
     // printf("pthread_cond_wait back \n");
 
+    // 已经 stop 且没有待写的数据, 直接退出, 否则 CoredumpHandler 中的 pthread_join 会一直阻塞
+    if (logger->m_buffer.empty()) {
+      return NULL;
+    }
+
     std::vector<std::string> tmp;
     tmp.swap(logger->m_buffer.front());
     logger->m_buffer.pop();
@@ -276,7 +299,11 @@ void* AsyncLogger::Loop(void * arg) {
 }
 
 void AsyncLogger::stop() {
+  ScopeMutex<Mutex> lock(m_mutex);
   m_stop_flag = true;
+  lock.unlock();
+
+  pthread_cond_signal(&m_condition);
 }
 
 void AsyncLogger::flush() {
@@ -139,6 +139,9 @@ class Logger {
 
     void flush();
 
+    // 定期执行 syncLoop 的线程, 不依赖 EventLoop, 主线程不跑 loop 的进程(例如只发起 rpc 调用的客户端)日志也能落盘
+    static void* SyncMain(void* arg);
+
     LogLevel getLogLevel() const {
       return m_set_level;
     }
@@ -174,7 +177,9 @@ class Logger {
 
     AsyncLogger::s_ptr m_async_app_logger;
 
-    TimerEvent::s_ptr m_timer_event;
+    pthread_t m_sync_thread;
+
+    int m_sync_interval {0};  // 同步间隔, ms
 
     int m_type {0};
 
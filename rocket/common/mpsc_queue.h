@@ -0,0 +1,98 @@
+#ifndef ROCKET_RPC_COMMON_MPSC_QUEUE_H
+#define ROCKET_RPC_COMMON_MPSC_QUEUE_H
+
+#include <atomic>
+#include <utility>
+
+namespace rocket_rpc {
+
+// 无锁的多生产者单消费者队列(Vyukov 的链表实现)
+// push 可以在任意线程调用, 只有一次原子交换; pop 只能在唯一的消费者线程中调用
+// 生产者交换了 head 但还没链接上 next 的一瞬间, pop 可能暂时看不到这个元素, 调用方需要能接受稍后再取
+template <class T>
+class MpscQueue {
+  public:
+    MpscQueue() {
+      m_head.store(&m_stub, std::memory_order_relaxed);
+      m_tail = &m_stub;
+    }
+
+    ~MpscQueue() {
+      T value;
+      while (pop(value)) {
+      }
+    }
+
+    void push(T value) {
+      Node* node = new Node();
+      node->value = std::move(value);
+      pushNode(node);
+    }
+
+    // 队列为空(或者暂时看不到新元素)时返回 false
+    bool pop(T& value) {
+      Node* tail = m_tail;
+      Node* next = tail->next.load(std::memory_order_acquire);
+
+      // 跳过哨兵节点
+      if (tail == &m_stub) {
+        if (next == NULL) {
+          return false;
+        }
+        m_tail = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+      }
+
+      if (next != NULL) {
+        m_tail = next;
+        value = std::move(tail->value);
+        delete tail;
+        return true;
+      }
+
+      // tail 是最后一个节点, 但还有生产者正在链接, 等它完成
+      if (tail != m_head.load(std::memory_order_acquire)) {
+        return false;
+      }
+
+      // 把哨兵重新放到末尾, 这样才能取出 tail
+      pushNode(&m_stub);
+      next = tail->next.load(std::memory_order_acquire);
+      if (next != NULL) {
+        m_tail = next;
+        value = std::move(tail->value);
+        delete tail;
+        return true;
+      }
+      return false;
+    }
+
+    // 只能在消费者线程中调用, 有生产者正在 push 时也返回 false
+    bool empty() {
+      return m_tail == &m_stub && m_head.load(std::memory_order_seq_cst) == &m_stub;
+    }
+
+  private:
+    struct Node {
+      std::atomic<Node*> next {NULL};
+      T value;
+    };
+
+    void pushNode(Node* node) {
+      node->next.store(NULL, std::memory_order_relaxed);
+      Node* prev = m_head.exchange(node, std::memory_order_acq_rel);
+      prev->next.store(node, std::memory_order_release);
+    }
+
+  private:
+    std::atomic<Node*> m_head;   // 生产者写入的一端
+    // 生产者和消费者访问的字段隔开一个 cache line, 避免伪共享
+    char m_padding[64];
+    Node* m_tail;                // 消费者读取的一端
+    Node m_stub;
+};
+
+}
+
+#endif
\ No newline at end of file
@@ -25,8 +25,10 @@ std::string MsgIDUtil::GenMsgID() {
     for (int i = 0; i < g_msg_id_length; i ++ ) {
       uint8_t x = (uint8_t)(res[i]) % 10;
       res[i] = x + '0';
-      t_max_msg_id_no += "9";
     }
+    // 最高位固定为 0, msg_id 的值不超过 uint64, TinyPB v2 中可以用 8 字节的二进制传输
+    res[0] = '0';
+    t_max_msg_id_no = "0" + std::string(g_msg_id_length - 1, '9');
     t_msg_id_no = res;
   } else {
     size_t i = t_max_msg_id_no.length() - 1;
@@ -15,19 +15,24 @@ class ScopeMutex {
     }
 
     ~ScopeMutex() {
-      m_mutex.unlock();
-      m_is_lock = false;
+      // 已经手动 unlock 过的不能再次 unlock, 否则可能释放掉其他线程刚拿到的锁
+      if (m_is_lock) {
+        m_mutex.unlock();
+        m_is_lock = false;
+      }
     }
 
     void lock() {
       if (!m_is_lock) {
         m_mutex.lock();
+        m_is_lock = true;
       }
     }
 
     void unlock() {
       if (m_is_lock) {
         m_mutex.unlock();
+        m_is_lock = false;
       }
     }
 
@@ -2,6 +2,7 @@
 #define ROCKET_RPC_COMMON_RUN_TIME_H
 
 #include <string>
+#include <stdint.h>
 
 namespace rocket_rpc {
 
@@ -18,6 +19,9 @@ class RunTime {
     std::string m_msgid;
     std::string m_method_name;
     RpcInterface* m_rpc_interface {NULL};
+    // 当前线程正在处理的请求的截止时间(单调时钟, us), 0 表示没有
+    // 只在 CallMethod 执行期间有效, 在其中发起的下游调用的超时时间不会超过它
+    int64_t m_deadline {0};
 
 };
 
@@ -1,7 +1,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/syscall.h>
-#include <sys/time.h>
+#include <time.h>
 #include <string.h>
 #include <arpa/inet.h>
 #include "rocket/common/util.h"
@@ -12,6 +12,10 @@ static int g_pid = 0;
 
 static thread_local int g_thread_id = 0;
 
+static thread_local bool t_loop_time_valid = false;
+static thread_local int64_t t_loop_now_us = 0;
+static thread_local int64_t t_loop_wall_time_us = 0;
+
 pid_t getPid() {
   if (g_pid != 0) {
     return g_pid;
@@ -26,11 +30,38 @@ pid_t getThreadId() {
   return g_thread_id = syscall(SYS_gettid);
 }
 
+int64_t getNowUs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
 int64_t getNowMs() {
-  timeval val;
-  gettimeofday(&val, NULL);
+  return getNowUs() / 1000;
+}
+
+int64_t getWallTimeUs() {
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+int64_t getLoopNowUs() {
+  return t_loop_time_valid ? t_loop_now_us : getNowUs();
+}
+
+int64_t getLoopWallTimeUs() {
+  return t_loop_time_valid ? t_loop_wall_time_us : getWallTimeUs();
+}
+
+void updateLoopTime() {
+  t_loop_now_us = getNowUs();
+  t_loop_wall_time_us = getWallTimeUs();
+  t_loop_time_valid = true;
+}
 
-  return val.tv_sec * 1000 + val.tv_usec / 1000;
+void clearLoopTime() {
+  t_loop_time_valid = false;
 }
 
 int32_t getInt32FromNetByte(const char* buf) {
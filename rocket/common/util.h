@@ -10,8 +10,26 @@ pid_t getPid();
 
 pid_t getThreadId();
 
+// 单调时钟(CLOCK_MONOTONIC), 不受系统时间调整影响, 只能用来计算时间间隔
+int64_t getNowUs();
+
 int64_t getNowMs();
 
+// 墙上时间(CLOCK_REALTIME), 微秒
+int64_t getWallTimeUs();
+
+// EventLoop 每一轮缓存的当前时间, 同一轮里的定时器, 日志等共用, 不用每次都读时钟
+// 在 loop 中的线程返回本轮 poll 返回时的时间, 其他线程直接读时钟
+int64_t getLoopNowUs();
+
+int64_t getLoopWallTimeUs();
+
+// 刷新当前线程缓存的时间, 由 EventLoop 每轮调用
+void updateLoopTime();
+
+// 当前线程退出 loop 后调用, 之后不再使用缓存的时间
+void clearLoopTime();
+
 int32_t getInt32FromNetByte(const char* buf);
 
 }
@@ -0,0 +1,103 @@
+#ifndef ROCKET_RPC_COMMON_WORK_STEAL_DEQUE_H
+#define ROCKET_RPC_COMMON_WORK_STEAL_DEQUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+namespace rocket_rpc {
+
+// 定长的 Chase-Lev 工作窃取队列(内存序参照 Lê 等人在弱内存模型上的实现)
+// push 和 pop 只能在唯一的所有者线程中调用, 在 bottom 一端进出; steal 可以在任意线程调用, 从 top 一端取
+// 元素只能是指针等可以原子读写的小对象, 被覆盖的槽可能正在被窃取者读取, 读到的旧值会在 CAS 失败后丢弃
+// 容量向上取整到 2 的幂, 满了之后 push 返回 false, 不扩容
+template <class T>
+class WorkStealDeque {
+  public:
+    explicit WorkStealDeque(size_t capacity) : m_mask(roundUp(capacity) - 1), m_buffer(m_mask + 1) {
+    }
+
+    // 只能在所有者线程调用, 队列满时返回 false
+    bool push(T value) {
+      int64_t b = m_bottom.load(std::memory_order_relaxed);
+      int64_t t = m_top.load(std::memory_order_acquire);
+      if (b - t > (int64_t)m_mask) {
+        return false;
+      }
+      m_buffer[b & m_mask].store(value, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      m_bottom.store(b + 1, std::memory_order_relaxed);
+      return true;
+    }
+
+    // 只能在所有者线程调用, 从 bottom 一端取(后进先出), 队列为空时返回 false
+    bool pop(T& value) {
+      int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+      m_bottom.store(b, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      int64_t t = m_top.load(std::memory_order_relaxed);
+
+      if (t > b) {
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return false;
+      }
+      value = m_buffer[b & m_mask].load(std::memory_order_relaxed);
+      if (t == b) {
+        // 只剩最后一个, 和窃取者竞争
+        bool succ = m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return succ;
+      }
+      return true;
+    }
+
+    // 任意线程调用, 从 top 一端取(先进先出), 队列为空或者和其他线程竞争失败时返回 false
+    bool steal(T& value) {
+      int64_t t = m_top.load(std::memory_order_acquire);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      int64_t b = m_bottom.load(std::memory_order_acquire);
+      if (t >= b) {
+        return false;
+      }
+      T tmp = m_buffer[t & m_mask].load(std::memory_order_relaxed);
+      if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+        return false;
+      }
+      value = tmp;
+      return true;
+    }
+
+    // 只是一个近似值, 用来判断是否值得去窃取
+    bool empty() const {
+      int64_t b = m_bottom.load(std::memory_order_relaxed);
+      int64_t t = m_top.load(std::memory_order_relaxed);
+      return t >= b;
+    }
+
+    size_t capacity() const {
+      return m_mask + 1;
+    }
+
+  private:
+    static size_t roundUp(size_t capacity) {
+      size_t size = 1;
+      while (size < capacity) {
+        size <<= 1;
+      }
+      return size;
+    }
+
+  private:
+    // 窃取者改 top, 所有者改 bottom, 隔开一个 cache line, 避免伪共享
+    std::atomic<int64_t> m_top {0};
+    char m_padding[64];
+    std::atomic<int64_t> m_bottom {0};
+
+    size_t m_mask {0};
+    std::vector<std::atomic<T> > m_buffer;
+};
+
+}
+
+#endif
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define ROCKET_RPC_NET_CODER_ABSTRACT_CODER_H
 
 #include <vector>
+#include "rocket/common/inline_function.h"
 #include "rocket/net/tcp/tcp_buffer.h"
 #include "rocket/net/coder/abstract_protocol.h"
 
@@ -9,6 +10,8 @@ namespace rocket_rpc {
 
 class AbstractCoder {
   public:
+    // 参数为帧中的 msg_id, 返回 false 的帧在 decode 时直接跳过, 不生成 message 对象
+    typedef InlineFunction<bool(const char* msg_id, int msg_id_len)> FrameFilter;
 
     // 将 message 对象转化为字节流, 写入到 buffer
     virtual void encode(std::vector<AbstractProtocol::s_ptr>& messages, TcpBuffer::s_ptr out_buffer) = 0;
@@ -17,6 +20,13 @@ class AbstractCoder {
     virtual void decode(std::vector<AbstractProtocol::s_ptr>& out_messages, TcpBuffer::s_ptr buffer) = 0;
 
     virtual ~AbstractCoder() {}
+
+    void setFrameFilter(FrameFilter filter) {
+      m_frame_filter = std::move(filter);
+    }
+
+  protected:
+    FrameFilter m_frame_filter;
 };
 
 }
@@ -1,6 +1,7 @@
 #ifndef ROCKET_RPC_NET_CODER_ABSTRACT_PROTOCOL_H
 #define ROCKET_RPC_NET_CODER_ABSTRACT_PROTOCOL_H
 
+#include <stdint.h>
 #include <memory>
 #include <string>
 #include "rocket/net/tcp/tcp_buffer.h"
@@ -15,6 +16,8 @@ struct AbstractProtocol : public std::enable_shared_from_this<AbstractProtocol>
 
   public:
     std::string m_msg_id; // 请求号, 唯一标识一个请求或者响应
+
+    int64_t m_decode_time {0};  // 解出这一帧的时间(us, 单调时钟), 服务端用来计算请求的排队时间
     
 };
 
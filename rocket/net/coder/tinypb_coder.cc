@@ -1,219 +1,657 @@
 #include <vector>
+#include <algorithm>
 #include <string.h>
+#include <stdio.h>
+#include <stdint.h>
 #include <arpa/inet.h>
+#include <google/protobuf/message.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream.h>
 #include "rocket/net/coder/tinypb_coder.h"
 #include "rocket/net/coder/tinypb_protocol.h"
 #include "rocket/common/util.h"
 #include "rocket/common/log.h"
+#include "rocket/common/msg_id_util.h"
+#include "rocket/common/error_code.h"
 
 namespace rocket_rpc {
 
+// 把 TcpBuffer 尾部的空闲空间交给 protobuf 直接写入
+// Next 返回的空间在下一次 Next 或者 finish 时提交, BackUp 退回的部分不提交
+class TcpBufferOutputStream : public google::protobuf::io::ZeroCopyOutputStream {
+  public:
+    TcpBufferOutputStream(TcpBuffer* buffer) : m_buffer(buffer) {}
+
+    bool Next(void** data, int* size) {
+      finish();
+      *data = m_buffer->getWriteSpace(*size);
+      m_pending = *size;
+      return true;
+    }
+
+    void BackUp(int count) {
+      m_pending -= count;
+    }
+
+    int64_t ByteCount() const {
+      return m_committed + m_pending;
+    }
+
+    void finish() {
+      if (m_pending > 0) {
+        m_buffer->moveWriteIndex(m_pending);
+        m_committed += m_pending;
+      }
+      m_pending = 0;
+    }
+
+  private:
+    TcpBuffer* m_buffer {NULL};
+    int64_t m_committed {0};
+    int m_pending {0};
+};
+
+static void writeInt32ToBuffer(TcpBuffer::s_ptr buffer, int32_t value) {
+  int32_t value_net = htonl(value);
+  buffer->writeToBuffer(reinterpret_cast<const char*>(&value_net), sizeof(value_net));
+}
+
+// v2 帧的 flags, 决定可选字段是否存在
+static const uint8_t g_tinypb_v2_flag_method = 0x01;
+static const uint8_t g_tinypb_v2_flag_timeout = 0x02;
+static const uint8_t g_tinypb_v2_flag_error = 0x04;
+
+// magic + version + 最长 5 字节的 body_len
+static const int g_tinypb_v2_max_header_len = 2 + 5;
+
+// v2 中 msg_id 以 uint64 传输, 还原成固定 20 位的十进制字符串
+static const int g_tinypb_v2_msg_id_len = 20;
+
+static int varintSize(uint32_t value) {
+  int size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    ++size;
+  }
+  return size;
+}
+
+static int writeVarintToArray(uint32_t value, char* buf) {
+  int len = 0;
+  while (value >= 0x80) {
+    buf[len++] = (char)((value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  buf[len++] = (char)value;
+  return len;
+}
+
+static void writeVarintToBuffer(TcpBuffer::s_ptr buffer, uint32_t value) {
+  char buf[5];
+  buffer->writeToBuffer(buf, writeVarintToArray(value, buf));
+}
+
+static void appendVarint(std::string& out, uint32_t value) {
+  char buf[5];
+  out.append(buf, writeVarintToArray(value, buf));
+}
+
+// 从 [cur, end) 读取一个 varint, 成功返回 1 并移动 cur, 数据不够返回 0, 超过 5 字节返回 -1
+static int readVarint(const char*& cur, const char* end, uint32_t& value) {
+  uint32_t result = 0;
+  for (int i = 0; i < 5; ++i) {
+    if (cur + i >= end) {
+      return 0;
+    }
+    uint8_t byte = (uint8_t)cur[i];
+    result |= (uint32_t)(byte & 0x7F) << (7 * i);
+    if ((byte & 0x80) == 0) {
+      cur += i + 1;
+      value = result;
+      return 1;
+    }
+  }
+  return -1;
+}
+
+static void writeUInt64ToBuffer(TcpBuffer::s_ptr buffer, uint64_t value) {
+  char buf[sizeof(uint64_t)];
+  for (int i = sizeof(uint64_t) - 1; i >= 0; --i) {
+    buf[i] = (char)(value & 0xFF);
+    value >>= 8;
+  }
+  buffer->writeToBuffer(buf, sizeof(buf));
+}
+
+static uint64_t getUInt64FromNetByte(const char* buf) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < sizeof(uint64_t); ++i) {
+    value = (value << 8) | (uint8_t)buf[i];
+  }
+  return value;
+}
+
+// msg_id 是 20 位十进制数字并且不超过 uint64 时才能转换成 request_id, 转换回去时得到同样的字符串
+static bool msgIdToRequestId(const std::string& msg_id, uint64_t& request_id) {
+  if ((int)msg_id.length() != g_tinypb_v2_msg_id_len) {
+    return false;
+  }
+  uint64_t value = 0;
+  for (size_t i = 0; i < msg_id.length(); ++i) {
+    if (msg_id[i] < '0' || msg_id[i] > '9') {
+      return false;
+    }
+    uint64_t digit = msg_id[i] - '0';
+    if (value > (UINT64_MAX - digit) / 10) {
+      return false;
+    }
+    value = value * 10 + digit;
+  }
+  request_id = value;
+  return true;
+}
+
 // 将 message 对象转化为字节流, 写入到 buffer
 void TinyPBCoder::encode(std::vector<AbstractProtocol::s_ptr>& messages, TcpBuffer::s_ptr out_buffer) {
   for (auto &i : messages) {
     std::shared_ptr<TinyPBProtocol> msg = std::dynamic_pointer_cast<TinyPBProtocol>(i);
-    int len = 0;
-    const char* buf = encodeTinyPB(msg, len);
-    if (buf != NULL && len != 0) {
-      out_buffer->writeToBuffer(buf, len);
+    encodeTinyPB(msg, out_buffer);
+  }
+}
+
+// 开始符 + 结束符 + 6 个 int32 字段(pk_len, msg_id_len, method_name_len, err_code, err_info_len, check_sum)
+static const int g_tinypb_min_frame_len = 2 + 24;
+
+bool TinyPBCoder::parseFrame(const char* begin, int len, TinyPBFrameView& view) {
+  const char* end = begin + len - 1;  // 结束符的位置
+  const char* cur = begin + sizeof(char);
+  // 以 PB_START_WITH_TIMEOUT 开头的帧在 err_code 之后多一个 timeout 字段, 其余与原来的 v1 帧完全相同
+  bool has_timeout = (begin[0] == TinyPBProtocol::PB_START_WITH_TIMEOUT);
+
+  view.pk_len = getInt32FromNetByte(cur);
+  cur += sizeof(int32_t);
+
+  // 读取一个长度字段以及紧跟着的变长数据, 越过结束符视为解析失败
+  auto read_field = [&cur, end](const char*& data, int32_t& data_len) -> bool {
+    if (cur + sizeof(int32_t) > end) {
+      return false;
     }
+    data_len = getInt32FromNetByte(cur);
+    cur += sizeof(int32_t);
+    if (data_len < 0 || data_len > end - cur) {
+      return false;
+    }
+    data = cur;
+    cur += data_len;
+    return true;
+  };
+
+  if (!read_field(view.msg_id, view.msg_id_len) || !read_field(view.method_name, view.method_name_len)) {
+    return false;
+  }
+
+  if (cur + (has_timeout ? 2 : 1) * sizeof(int32_t) > end) {
+    return false;
+  }
+  view.err_code = getInt32FromNetByte(cur);
+  cur += sizeof(int32_t);
+  if (has_timeout) {
+    view.timeout = getInt32FromNetByte(cur);
+    cur += sizeof(int32_t);
+  }
 
-    if (buf) {
-      free((void*)buf);
-      buf = NULL;
+  if (!read_field(view.err_info, view.err_info_len)) {
+    return false;
+  }
+
+  // 剩下的除了校验和都是 pb_data
+  view.pb_data = cur;
+  view.pb_data_len = (end - sizeof(int32_t)) - cur;
+  if (view.pb_data_len < 0) {
+    return false;
+  }
+  view.check_sum = getInt32FromNetByte(end - sizeof(int32_t));
+  view.version = 1;
+  return true;
+}
+
+bool TinyPBCoder::parseFrameV2(const char* begin, int len, TinyPBFrameView& view) {
+  const char* cur = begin;
+  const char* end = begin + len;
+
+  if (end - cur < (int)(1 + sizeof(uint64_t))) {
+    return false;
+  }
+  uint8_t flags = (uint8_t)*cur;
+  cur += 1;
+  if (flags & ~(g_tinypb_v2_flag_method | g_tinypb_v2_flag_timeout | g_tinypb_v2_flag_error)) {
+    return false;
+  }
+  view.request_id = getUInt64FromNetByte(cur);
+  cur += sizeof(uint64_t);
+
+  uint32_t value = 0;
+  if (flags & g_tinypb_v2_flag_method) {
+    if (readVarint(cur, end, value) != 1 || value > INT32_MAX) {
+      return false;
     }
+    view.method_id = value;
   }
+  if (flags & g_tinypb_v2_flag_timeout) {
+    if (readVarint(cur, end, value) != 1 || value > INT32_MAX) {
+      return false;
+    }
+    view.timeout = value;
+  }
+  if (flags & g_tinypb_v2_flag_error) {
+    if (readVarint(cur, end, value) != 1) {
+      return false;
+    }
+    view.err_code = (int32_t)value;
+    if (readVarint(cur, end, value) != 1 || value > (uint32_t)(end - cur)) {
+      return false;
+    }
+    view.err_info = cur;
+    view.err_info_len = value;
+    cur += value;
+  }
+
+  // 剩下的都是 pb_data
+  view.pb_data = cur;
+  view.pb_data_len = end - cur;
+  view.version = 2;
+  return true;
+}
+
+void TinyPBCoder::encodeMethodTable(const std::vector<std::string>& method_names, std::string& out) {
+  out.clear();
+  appendVarint(out, (uint8_t)TinyPBProtocol::PB_V2_VERSION);
+  appendVarint(out, method_names.size());
+  for (size_t i = 0; i < method_names.size(); ++i) {
+    appendVarint(out, i);
+    appendVarint(out, method_names[i].length());
+    out.append(method_names[i]);
+  }
+}
+
+bool TinyPBCoder::parseMethodTable(const char* data, int len, std::unordered_map<std::string, int32_t>& method_ids) {
+  const char* cur = data;
+  const char* end = data + len;
+  uint32_t version = 0;
+  uint32_t count = 0;
+  if (readVarint(cur, end, version) != 1 || readVarint(cur, end, count) != 1) {
+    return false;
+  }
+  if (version != (uint8_t)TinyPBProtocol::PB_V2_VERSION) {
+    return false;
+  }
+  for (uint32_t i = 0; i < count; ++i) {
+    uint32_t id = 0;
+    uint32_t name_len = 0;
+    if (readVarint(cur, end, id) != 1 || id > INT32_MAX) {
+      return false;
+    }
+    if (readVarint(cur, end, name_len) != 1 || name_len > (uint32_t)(end - cur)) {
+      return false;
+    }
+    method_ids[std::string(cur, name_len)] = id;
+    cur += name_len;
+  }
+  return true;
+}
+
+std::shared_ptr<TinyPBProtocol> TinyPBCoder::makeHandshake() {
+  std::shared_ptr<TinyPBProtocol> message = std::make_shared<TinyPBProtocol>();
+  message->m_msg_id = MsgIDUtil::GenMsgID();
+  message->m_method_name = TinyPBProtocol::PB_HANDSHAKE_METHOD;
+  // 请求中带上客户端支持的最高版本
+  appendVarint(message->m_pb_data, (uint8_t)TinyPBProtocol::PB_V2_VERSION);
+  m_handshake_msg_id = message->m_msg_id;
+  return message;
+}
+
+void TinyPBCoder::onHandshakeResponse(const TinyPBFrameView& view) {
+  m_handshake_msg_id.clear();
+  if (view.err_code != 0) {
+    INFOLOG("peer does not support tinypb v2, keep using v1, err_code[%d]", view.err_code);
+    return;
+  }
+  std::unordered_map<std::string, int32_t> method_ids;
+  if (!parseMethodTable(view.pb_data, view.pb_data_len, method_ids)) {
+    ERRORLOG("parse tinypb handshake response error, keep using v1");
+    return;
+  }
+  m_method_ids.swap(method_ids);
+  m_handshake_success = true;
+  INFOLOG("tinypb handshake success, use v2, methods[%d]", (int)m_method_ids.size());
 }
 
 // 将 buffer 里面的字节流转换为 message 对象
+// 直接在 buffer 的内存上解析, 每一帧只把 msg_id, method_name, err_info, pb_data 拷贝到 message 里
+// 帧跨越了 buffer 的多个 block 时, 先把这一帧拼接到 scratch 中再解析
+// 每一帧按第一个字节区分 v1 和 v2; v2 帧没有结束符, 只在帧的边界上识别
 void TinyPBCoder::decode(std::vector<AbstractProtocol::s_ptr>& out_messages, TcpBuffer::s_ptr buffer) {
-  
-  while (1) {
-    // 遍历 buffer, 找到 PB_START, 找到之后, 解析出整包的长度. 然后得到结束符的位置, 判断是否为 PB_END
-    std::vector<char> tmp = buffer->m_buffer;
-    int start_index = buffer->readIndex();
-    int end_index = -1;
+  std::string scratch;
+  int offset = 0;
+  // 同一次可读事件解出的帧使用同一个时间
+  int64_t now = getLoopNowUs();
+  char msg_id_buf[g_tinypb_v2_msg_id_len + 1];
 
-    int pk_len = 0;
-    bool parse_success = false;
-    int i = 0;
-    for (i = start_index; i < buffer->writeIndex(); i ++ ) {
-      if (tmp[i] == TinyPBProtocol::PB_START) {
-        // 从下取四个字节, 由于是网络字节序, 需要转化为主机字节序
-        if (i + 1 < buffer->writeIndex()) {
-          pk_len = getInt32FromNetByte(&tmp[i + 1]);
-          DEBUGLOG("get pk_len = %d", pk_len);
-
-          // 结束符的索引
-          int j = i + pk_len - 1;
-          if (j >= buffer->writeIndex()) {
-            continue;
-          }
-          if (tmp[j] == TinyPBProtocol::PB_END) {
-            start_index = i;
-            end_index = j;
-            parse_success = true;
-            break;
-          }
-        }
-      }
+  while (1) {
+    char first_char = 0;
+    if (!buffer->peek(&first_char, offset, 1)) {
+      break;
     }
 
-    if (parse_success) {
-      buffer->moveReadIndex(end_index - start_index + 1);
-      std::shared_ptr<TinyPBProtocol> message = std::make_shared<TinyPBProtocol>();
-      message->m_pk_len = pk_len;
+    int start_index = 0;
+    int frame_len = 0;
+    TinyPBFrameView view;
+    bool parse_success = false;
 
-      int msg_id_len_index = start_index + sizeof(char) + sizeof(message->m_pk_len);
-      if (msg_id_len_index >= end_index) {
-        message->parse_success = false;
-        ERRORLOG("parse error, msg_id_len_index[%d] >= end_index[%d]", msg_id_len_index, end_index);
-        continue;
+    if (first_char == TinyPBProtocol::PB_V2_MAGIC) {
+      char header[g_tinypb_v2_max_header_len];
+      int header_len = std::min(buffer->readAble() - offset, g_tinypb_v2_max_header_len);
+      buffer->peek(header, offset, header_len);
+      if (header_len < 2) {
+        break;
       }
-      message->m_msg_id_len = getInt32FromNetByte(&tmp[msg_id_len_index]);
-      DEBUGLOG("parse msg_id_len=%d", message->m_msg_id_len);
-
-      int msg_id_index = msg_id_len_index + sizeof(message->m_msg_id_len);
-      char msg_id[100] = {0};
-      memcpy(&msg_id[0], &tmp[msg_id_index], message->m_msg_id_len);
-      message->m_msg_id = std::string(msg_id);
-      DEBUGLOG("parse msg_id=%s", message->m_msg_id.c_str());
-
-      int method_name_len_index = msg_id_index + message->m_msg_id_len;
-      if (method_name_len_index >= end_index) {
-        message->parse_success = false;
-        ERRORLOG("parse error, method_name_len_index[%d] >= end_index[%d]", method_name_len_index, end_index);
+      if (header[1] != TinyPBProtocol::PB_V2_VERSION) {
+        ERRORLOG("decode error, unknown tinypb version[%d]", (int)header[1]);
+        offset += 1;
         continue;
       }
-      message->m_method_name_len = getInt32FromNetByte(&tmp[method_name_len_index]);
-
-      int method_name_index = method_name_len_index + sizeof(message->m_method_name_len);
-      char method_name[512] = {0};
-      memcpy(&method_name[0], &tmp[method_name_index], message->m_method_name_len);
-      message->m_method_name = std::string(method_name);
-      DEBUGLOG("parse method_name=%s", message->m_method_name.c_str());
-
-      int err_code_index = method_name_index + message->m_method_name_len;
-      if (err_code_index >= end_index) {
-        message->parse_success = false;
-        ERRORLOG("parse error, err_code_index[%d] >= end_index[%d]", err_code_index, end_index);
+      const char* cur = header + 2;
+      uint32_t body_len = 0;
+      int rt = readVarint(cur, header + header_len, body_len);
+      if (rt == 0) {
+        // 长度字段还没收全
+        break;
+      }
+      if (rt < 0 || body_len > (uint32_t)(INT32_MAX - g_tinypb_v2_max_header_len)) {
+        ERRORLOG("decode error, invalid tinypb v2 body length");
+        offset += 1;
         continue;
       }
-      message->m_err_code = getInt32FromNetByte(&tmp[err_code_index]);
+      header_len = cur - header;
+      start_index = offset;
+      frame_len = header_len + body_len;
 
-      int error_info_len_index = err_code_index + sizeof(message->m_err_code);
-      if (error_info_len_index >= end_index) {
-        message->parse_success = false;
-        ERRORLOG("parse error, error_info_len_index[%d] >= end_index[%d]", error_info_len_index, end_index);
+      // 整包还没收全, 等下次可读时再解析
+      if (frame_len > buffer->readAble() - start_index) {
+        break;
+      }
+
+      const char* frame = buffer->peekContiguous(start_index, frame_len, scratch);
+      parse_success = parseFrameV2(frame + header_len, body_len, view);
+      if (parse_success) {
+        snprintf(msg_id_buf, sizeof(msg_id_buf), "%020llu", (unsigned long long)view.request_id);
+        view.msg_id = msg_id_buf;
+        view.msg_id_len = g_tinypb_v2_msg_id_len;
+        view.pk_len = frame_len;
+      }
+    } else {
+      // 遍历 buffer, 找到 PB_START, 找到之后, 解析出整包的长度. 然后得到结束符的位置, 判断是否为 PB_END
+      // 带 timeout 的 v1 帧和 v2 帧一样只在帧的边界上识别
+      if (first_char == TinyPBProtocol::PB_START_WITH_TIMEOUT) {
+        start_index = offset;
+      } else {
+        start_index = buffer->find(TinyPBProtocol::PB_START, offset);
+      }
+      if (start_index == -1) {
+        break;
+      }
+
+      // 长度字段还没收全, 等下次可读时再解析
+      char pk_len_buf[sizeof(int32_t)];
+      if (!buffer->peek(pk_len_buf, start_index + 1, sizeof(pk_len_buf))) {
+        break;
+      }
+      frame_len = getInt32FromNetByte(pk_len_buf);
+      if (frame_len < g_tinypb_min_frame_len) {
+        offset = start_index + 1;
         continue;
       }
-      message->m_err_info_len = getInt32FromNetByte(&tmp[error_info_len_index]);
-
-      int error_info_index = error_info_len_index + sizeof(message->m_err_info_len);
-      char error_info[512] = {0};
-      memcpy(&error_info[0], &tmp[error_info_index], message->m_err_info_len);
-      message->m_err_info = std::string(error_info);
-      DEBUGLOG("parse error_info=%s", message->m_err_info.c_str());
-
-      int pb_data_len = message->m_pk_len - message->m_method_name_len - message->m_msg_id_len - message->m_err_info_len - 2 - 24;
-      int pb_data_index = error_info_index + message->m_err_info_len;
-      message->m_pb_data = std::string(&tmp[pb_data_index], pb_data_len);
-
-      // 这里去解析校验和
-      int check_sum_index = pb_data_index + pb_data_len;
-      if (check_sum_index >= end_index) {
-        message->parse_success = false;
-        ERRORLOG("parse error, check_sum_index[%d] >= end_index[%d]", check_sum_index, end_index);
+
+      // 整包还没收全, 等下次可读时再解析, 不再往后扫描包体
+      if (frame_len > buffer->readAble() - start_index) {
+        break;
+      }
+
+      char end_char = 0;
+      buffer->peek(&end_char, start_index + frame_len - 1, 1);
+      if (end_char != TinyPBProtocol::PB_END) {
+        offset = start_index + 1;
         continue;
       }
-      message->m_check_sum = getInt32FromNetByte(&tmp[check_sum_index]);
 
+      const char* frame = buffer->peekContiguous(start_index, frame_len, scratch);
+      parse_success = parseFrame(frame, frame_len, view);
+    }
+
+    if (parse_success && !m_handshake_msg_id.empty() && view.version == 1
+      && m_handshake_msg_id.compare(0, std::string::npos, view.msg_id, view.msg_id_len) == 0) {
+      // 握手的回包由 coder 自己处理
+      onHandshakeResponse(view);
+    } else if (parse_success && m_frame_filter && !m_frame_filter(view.msg_id, view.msg_id_len)) {
+      // 没有人在等这一帧(例如调用已经超时), 直接丢弃, 不拷贝包体
+      DEBUGLOG("discard frame, msg_id=%s", std::string(view.msg_id, view.msg_id_len).c_str());
+    } else if (parse_success) {
+      std::shared_ptr<TinyPBProtocol> message = std::make_shared<TinyPBProtocol>();
+      message->m_version = view.version;
+      message->m_pk_len = view.pk_len;
+      message->m_msg_id_len = view.msg_id_len;
+      message->m_msg_id.assign(view.msg_id, view.msg_id_len);
+      message->m_method_name_len = view.method_name_len;
+      message->m_method_name.assign(view.method_name, view.method_name_len);
+      message->m_method_id = view.method_id;
+      message->m_err_code = view.err_code;
+      message->m_timeout = view.timeout;
+      message->m_err_info_len = view.err_info_len;
+      message->m_err_info.assign(view.err_info, view.err_info_len);
+      message->m_pb_data.assign(view.pb_data, view.pb_data_len);
+      message->m_check_sum = view.check_sum;
       message->parse_success = true;
+      message->m_decode_time = now;
 
-      out_messages.push_back(message);
-    }
+      DEBUGLOG("parse msg_id=%s, version=%d, method_name=%s, method_id=%d, error_info=%s", message->m_msg_id.c_str(), message->m_version,
+        message->m_method_name.c_str(), message->m_method_id, message->m_err_info.c_str());
 
-    if (i >= buffer->writeIndex()) { // 如果读完所有buffer, 直接返回即可
-      DEBUGLOG("decode end, read all buffer data");
-      return;
+      out_messages.push_back(message);
+    } else {
+      ERRORLOG("parse error, invalid field length in frame, version[%d], pk_len[%d]", first_char == TinyPBProtocol::PB_V2_MAGIC ? 2 : 1, frame_len);
     }
 
+    // 这一帧(以及它前面无法识别的字节)已经处理完, 从 buffer 中移除, 读完的 block 会被归还
+    buffer->moveReadIndex(start_index + frame_len);
+    offset = 0;
   }
+
+  DEBUGLOG("decode end, read all buffer data");
 }
 
-const char* TinyPBCoder::encodeTinyPB(std::shared_ptr<TinyPBProtocol> message, int& len) {
+// 各字段直接追加到 out_buffer 中, 不再先拼出整帧再拷贝
+// 设置了 m_pb_message 时 protobuf 直接序列化到 out_buffer 的 block 里, 从 handler 到 socket 只有这一次写入
+void TinyPBCoder::encodeTinyPB(std::shared_ptr<TinyPBProtocol> message, TcpBuffer::s_ptr out_buffer) {
   if (message->m_msg_id.empty()) {
     message->m_msg_id = "12345678";
   }
   DEBUGLOG("msg_id = %s", message->m_msg_id.c_str());
-  int pk_len = 2 + 24 + message->m_msg_id.length() + message->m_method_name.length() + message->m_err_info.length() + message->m_pb_data.length();
-  DEBUGLOG("pk_len = %d", pk_len);
 
-  char* buf = reinterpret_cast<char*>(malloc(pk_len));
-  char* tmp = buf;
+  // 握手之后的请求按 method 名换成 method id
+  if (message->m_version < 2 && message->m_method_id < 0 && !m_method_ids.empty()) {
+    auto it = m_method_ids.find(message->m_method_name);
+    if (it != m_method_ids.end()) {
+      message->m_method_id = it->second;
+      message->m_version = 2;
+    }
+  }
+
+  uint64_t request_id = 0;
+  if (message->m_version >= 2 && msgIdToRequestId(message->m_msg_id, request_id)) {
+    encodeTinyPBV2(message, request_id, out_buffer);
+    return;
+  }
+  message->m_version = 1;
+
+  // ByteSizeLong 会缓存各字段的大小, 下面的 SerializeWithCachedSizes 不用再算一遍
+  int64_t pb_data_len = message->m_pb_message ? (int64_t)message->m_pb_message->ByteSizeLong() : (int64_t)message->m_pb_data.length();
+  // 只有确认对端能识别时才带上 timeout, 否则发送与原来完全相同的 v1 帧
+  bool with_timeout = message->m_timeout > 0 && m_handshake_success;
+  int64_t pk_len = g_tinypb_min_frame_len + (with_timeout ? sizeof(int32_t) : 0)
+    + message->m_msg_id.length() + message->m_method_name.length() + message->m_err_info.length() + pb_data_len;
+  if (pk_len > INT32_MAX) {
+    ERRORLOG("encode message[%s] error, package too large, pk_len[%lld]", message->m_msg_id.c_str(), (long long)pk_len);
+    message->m_pb_message = NULL;
+    message->m_arena.reset();
+    if (toSerializeErrorReply(message, "reply package too large")) {
+      encodeTinyPB(message, out_buffer);
+    }
+    return;
+  }
+  DEBUGLOG("pk_len = %lld", (long long)pk_len);
 
-  *tmp = TinyPBProtocol::PB_START;
-  tmp ++ ;
+  // out_buffer 中已有的数据可能正在发送, 出错时只撤销这一帧
+  int frame_begin = out_buffer->readAble();
+  out_buffer->writeToBuffer(with_timeout ? &TinyPBProtocol::PB_START_WITH_TIMEOUT : &TinyPBProtocol::PB_START, 1);
+  writeInt32ToBuffer(out_buffer, pk_len);
 
-  int32_t pk_len_net = htonl(pk_len);
-  memcpy(tmp, &pk_len_net, sizeof(pk_len_net));
-  tmp += sizeof(pk_len_net);
+  writeInt32ToBuffer(out_buffer, message->m_msg_id.length());
+  out_buffer->writeToBuffer(message->m_msg_id.data(), message->m_msg_id.length());
 
-  int msg_id_len = message->m_msg_id.length();
-  int32_t msg_id_len_net = htonl(msg_id_len);
-  memcpy(tmp, &msg_id_len_net, sizeof(msg_id_len_net));
-  tmp += sizeof(msg_id_len_net);
+  writeInt32ToBuffer(out_buffer, message->m_method_name.length());
+  out_buffer->writeToBuffer(message->m_method_name.data(), message->m_method_name.length());
 
-  if (!message->m_msg_id.empty()) {
-    memcpy(tmp, &(message->m_msg_id[0]), msg_id_len);
-    tmp += msg_id_len;
+  writeInt32ToBuffer(out_buffer, message->m_err_code);
+  if (with_timeout) {
+    writeInt32ToBuffer(out_buffer, message->m_timeout);
   }
 
-  int method_name_len = message->m_method_name.length();
-  int32_t method_name_len_net = htonl(method_name_len);
-  memcpy(tmp, &method_name_len_net, sizeof(method_name_len_net));
-  tmp += sizeof(method_name_len_net);
+  writeInt32ToBuffer(out_buffer, message->m_err_info.length());
+  out_buffer->writeToBuffer(message->m_err_info.data(), message->m_err_info.length());
 
-  if (!message->m_method_name.empty()) {
-    memcpy(tmp, &(message->m_method_name[0]), method_name_len);
-    tmp += method_name_len;
+  if (!writePbData(message, pb_data_len, out_buffer)) {
+    out_buffer->truncate(frame_begin);
+    message->m_arena.reset();
+    if (toSerializeErrorReply(message, "serialize error")) {
+      encodeTinyPB(message, out_buffer);
+    }
+    return;
   }
 
-  int32_t err_code_net = htonl(message->m_err_code);
-  memcpy(tmp, &err_code_net, sizeof(err_code_net));
-  tmp += sizeof(err_code_net);
+  writeInt32ToBuffer(out_buffer, 1);
+  out_buffer->writeToBuffer(&TinyPBProtocol::PB_END, 1);
+
+  // 回包已经写入 out_buffer, 这个请求的 message, controller 等对象随 arena 一次性释放
+  message->m_arena.reset();
 
-  int err_info_len = message->m_err_info.length();
-  int32_t err_info_len_net = htonl(err_info_len);
-  memcpy(tmp, &err_info_len_net, sizeof(err_info_len_net));
-  tmp += sizeof(err_info_len_net);
+  message->m_pk_len = pk_len;
+  message->m_msg_id_len = message->m_msg_id.length();
+  message->m_method_name_len = message->m_method_name.length();
+  message->m_err_info_len = message->m_err_info.length();
+  message->parse_success = true;
 
-  if (!message->m_err_info.empty()) {
-    memcpy(tmp, &(message->m_err_info[0]), err_info_len);
-    tmp += err_info_len;
+  DEBUGLOG("encode message[%s] success", message->m_msg_id.c_str());
+}
+
+void TinyPBCoder::encodeTinyPBV2(std::shared_ptr<TinyPBProtocol> message, uint64_t request_id, TcpBuffer::s_ptr out_buffer) {
+  uint8_t flags = 0;
+  int64_t body_len = 1 + sizeof(uint64_t);
+  if (message->m_method_id >= 0) {
+    flags |= g_tinypb_v2_flag_method;
+    body_len += varintSize(message->m_method_id);
+  }
+  if (message->m_timeout > 0) {
+    flags |= g_tinypb_v2_flag_timeout;
+    body_len += varintSize(message->m_timeout);
+  }
+  if (message->m_err_code != 0 || !message->m_err_info.empty()) {
+    flags |= g_tinypb_v2_flag_error;
+    body_len += varintSize(message->m_err_code) + varintSize(message->m_err_info.length()) + message->m_err_info.length();
   }
 
-  if (!message->m_pb_data.empty()) {
-    memcpy(tmp, &(message->m_pb_data[0]), message->m_pb_data.length());
-    tmp += message->m_pb_data.length();
+  int64_t pb_data_len = message->m_pb_message ? (int64_t)message->m_pb_message->ByteSizeLong() : (int64_t)message->m_pb_data.length();
+  body_len += pb_data_len;
+  if (body_len > INT32_MAX - g_tinypb_v2_max_header_len) {
+    ERRORLOG("encode message[%s] error, package too large, body_len[%lld]", message->m_msg_id.c_str(), (long long)body_len);
+    message->m_pb_message = NULL;
+    message->m_arena.reset();
+    if (toSerializeErrorReply(message, "reply package too large")) {
+      encodeTinyPBV2(message, request_id, out_buffer);
+    }
+    return;
   }
 
-  int32_t check_sum_net = htonl(1);
-  memcpy(tmp, &check_sum_net, sizeof(check_sum_net));
-  tmp += sizeof(check_sum_net);
+  int frame_begin = out_buffer->readAble();
+  char header[g_tinypb_v2_max_header_len + 1];
+  header[0] = TinyPBProtocol::PB_V2_MAGIC;
+  header[1] = TinyPBProtocol::PB_V2_VERSION;
+  int header_len = 2 + writeVarintToArray(body_len, header + 2);
+  header[header_len] = (char)flags;
+  out_buffer->writeToBuffer(header, header_len + 1);
+
+  writeUInt64ToBuffer(out_buffer, request_id);
+  if (flags & g_tinypb_v2_flag_method) {
+    writeVarintToBuffer(out_buffer, message->m_method_id);
+  }
+  if (flags & g_tinypb_v2_flag_timeout) {
+    writeVarintToBuffer(out_buffer, message->m_timeout);
+  }
+  if (flags & g_tinypb_v2_flag_error) {
+    writeVarintToBuffer(out_buffer, message->m_err_code);
+    writeVarintToBuffer(out_buffer, message->m_err_info.length());
+    out_buffer->writeToBuffer(message->m_err_info.data(), message->m_err_info.length());
+  }
 
-  *tmp = TinyPBProtocol::PB_END;
+  if (!writePbData(message, pb_data_len, out_buffer)) {
+    out_buffer->truncate(frame_begin);
+    message->m_arena.reset();
+    if (toSerializeErrorReply(message, "serialize error")) {
+      encodeTinyPBV2(message, request_id, out_buffer);
+    }
+    return;
+  }
 
-  message->m_pk_len = pk_len;
-  message->m_msg_id_len = msg_id_len;
-  message->m_method_name_len = method_name_len;
-  message->m_err_info_len = err_info_len;
+  message->m_arena.reset();
+
+  message->m_pk_len = header_len + body_len;
+  message->m_msg_id_len = message->m_msg_id.length();
+  message->m_err_info_len = message->m_err_info.length();
   message->parse_success = true;
-  len = pk_len;
 
-  DEBUGLOG("encode message[%s] success", message->m_msg_id.c_str());
+  DEBUGLOG("encode message[%s] success, version 2, pk_len[%d]", message->m_msg_id.c_str(), message->m_pk_len);
+}
+
+bool TinyPBCoder::toSerializeErrorReply(std::shared_ptr<TinyPBProtocol> message, const char* err_info) {
+  if (!m_is_server || (message->m_err_code == ERROR_FAILED_SERIALIZE && message->m_pb_data.empty())) {
+    return false;
+  }
+  message->m_pb_message = NULL;
+  message->m_pb_data.clear();
+  message->m_err_code = ERROR_FAILED_SERIALIZE;
+  message->m_err_info = err_info;
+  return true;
+}
 
-  return buf;
+bool TinyPBCoder::writePbData(std::shared_ptr<TinyPBProtocol> message, int64_t pb_data_len, TcpBuffer::s_ptr out_buffer) {
+  if (message->m_pb_message) {
+    TcpBufferOutputStream stream(out_buffer.get());
+    {
+      // CodedOutputStream 析构时会把没用完的空间 BackUp 回来
+      google::protobuf::io::CodedOutputStream coded_stream(&stream);
+      message->m_pb_message->SerializeWithCachedSizes(&coded_stream);
+    }
+    stream.finish();
+    message->m_pb_message = NULL;
+    // message 在 ByteSizeLong 之后被修改过, 前面写下的长度已经不对了
+    if (stream.ByteCount() != pb_data_len) {
+      ERRORLOG("encode message[%s] error, serialized size %lld not equal to %lld, drop this frame", message->m_msg_id.c_str(),
+        (long long)stream.ByteCount(), (long long)pb_data_len);
+      return false;
+    }
+  } else {
+    out_buffer->writeToBuffer(message->m_pb_data.data(), message->m_pb_data.length());
+  }
+  return true;
 }
 
 }
\ No newline at end of file
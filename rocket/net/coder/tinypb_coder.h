@@ -1,16 +1,48 @@
 #ifndef ROCKET_RPC_NET_CODER_TINYPB_CODER_H
 #define ROCKET_RPC_NET_CODER_TINYPB_CODER_H
 
+#include <string>
+#include <vector>
+#include <unordered_map>
 #include "rocket/net/coder/abstract_coder.h"
 #include "rocket/net/coder/tinypb_protocol.h"
 
 namespace rocket_rpc {
 
+// 指向 buffer 中一个完整 TinyPB 帧各字段的视图, 不拷贝数据
+// 只在 buffer 没有被修改(写入, moveReadIndex 等), 以及拼接用的 scratch 没有被复用之前有效
+struct TinyPBFrameView {
+  int32_t version {1};
+  int32_t pk_len {0};
+  const char* msg_id {NULL};
+  int32_t msg_id_len {0};
+  const char* method_name {NULL};
+  int32_t method_name_len {0};
+  int32_t method_id {-1};
+  uint64_t request_id {0};    // v2 帧中二进制的 msg_id
+  int32_t err_code {0};
+  int32_t timeout {0};
+  const char* err_info {NULL};
+  int32_t err_info_len {0};
+  const char* pb_data {NULL};
+  int32_t pb_data_len {0};
+  int32_t check_sum {0};
+};
+
+// v1 帧: 开始符 | pk_len | msg_id_len | msg_id | method_name_len | method_name | err_code | [timeout] | err_info_len | err_info | pb_data | check_sum | 结束符
+//   整数都是 4 字节网络字节序; 开始符为 PB_START_WITH_TIMEOUT 时才有 timeout 字段, 只在握手成功之后发送
+//   开始符为 PB_START 的帧与最初的 TinyPB 格式逐字节相同, 不支持握手的老版本客户端和服务端都可以直接解析
+// v2 帧: magic | version | body_len | flags | request_id | [method_id] | [timeout] | [err_code | err_info_len | err_info] | pb_data
+//   body_len, method_id, timeout, err_code, err_info_len 都是 varint, request_id 为 8 字节网络字节序, 中括号内的字段由 flags 决定是否存在
+//   msg_id 是 20 位十进制数字并且不超过 uint64 时才能用 v2 发送, 其他 msg_id 继续使用 v1
+// 客户端连接建立后先用 v1 帧发送握手请求, 服务端回复所有方法的 id, 之后的请求按 method 名换成 id 用 v2 发送
+// 握手回包到达之前, 或者对端只支持 v1 时, 请求都用 v1 发送; 服务端按请求的版本回包, decode 自动识别两种格式
 class TinyPBCoder : public AbstractCoder {
 
   public:
 
-    TinyPBCoder() {}
+    // is_server 为 true 时是服务端连接的 coder, 回包无法编码时改为发送同一个 msg_id 的错误回包
+    explicit TinyPBCoder(bool is_server = false) : m_is_server(is_server) {}
     
     ~TinyPBCoder() {}
 
@@ -20,8 +52,44 @@ class TinyPBCoder : public AbstractCoder {
     // 将 buffer 里面的字节流转换为 message 对象
     void decode(std::vector<AbstractProtocol::s_ptr>& out_messages, TcpBuffer::s_ptr buffer);
 
+    // 生成客户端连接的握手请求, 回包在 decode 时由 coder 自己处理, 不会交给上层
+    std::shared_ptr<TinyPBProtocol> makeHandshake();
+
+    // 解析 [begin, begin + len) 这一帧(包含开始符和结束符), 各字段长度不合法时返回 false
+    static bool parseFrame(const char* begin, int len, TinyPBFrameView& view);
+
+    // 解析 v2 帧 body_len 之后的 [begin, begin + len), 各字段不合法时返回 false
+    static bool parseFrameV2(const char* begin, int len, TinyPBFrameView& view);
+
+    // 握手回包的 pb_data: 版本号 | 方法数 | (method_id | name_len | name)..., 都是 varint
+    static void encodeMethodTable(const std::vector<std::string>& method_names, std::string& out);
+
+    static bool parseMethodTable(const char* data, int len, std::unordered_map<std::string, int32_t>& method_ids);
+
+  private:
+    void encodeTinyPB(std::shared_ptr<TinyPBProtocol> message, TcpBuffer::s_ptr out_buffer);
+
+    void encodeTinyPBV2(std::shared_ptr<TinyPBProtocol> message, uint64_t request_id, TcpBuffer::s_ptr out_buffer);
+
+    // 把 pb_data(或者直接序列化 m_pb_message) 写到 out_buffer
+    // 序列化出来的长度与 pb_data_len 不一致时返回 false, 由调用方撤销整帧
+    bool writePbData(std::shared_ptr<TinyPBProtocol> message, int64_t pb_data_len, TcpBuffer::s_ptr out_buffer);
+
+    void onHandshakeResponse(const TinyPBFrameView& view);
+
+    // 把无法编码的回包换成 ERROR_FAILED_SERIALIZE 错误回包, 调用方重新 encode 即可
+    // 客户端的请求, 或者本身已经是这种错误回包时返回 false, 只能丢弃
+    bool toSerializeErrorReply(std::shared_ptr<TinyPBProtocol> message, const char* err_info);
+
   private:
-    const char* encodeTinyPB(std::shared_ptr<TinyPBProtocol> message, int& len);
+    bool m_is_server {false};
+
+    std::string m_handshake_msg_id;   // 握手请求的 msg_id, 回包处理完之后清空
+
+    bool m_handshake_success {false};   // 对端支持 v2 以及带 timeout 的 v1 帧
+
+    // 握手得到的 method 全名 -> method id, 为空时请求都用 v1 发送
+    std::unordered_map<std::string, int32_t> m_method_ids;
 };
 
 }
@@ -4,5 +4,11 @@ namespace rocket_rpc {
 
 char TinyPBProtocol::PB_START = 0x02;
 char TinyPBProtocol::PB_END = 0x03;
+char TinyPBProtocol::PB_START_WITH_TIMEOUT = 0x04;
+
+char TinyPBProtocol::PB_V2_MAGIC = 0x7E;
+char TinyPBProtocol::PB_V2_VERSION = 0x02;
+
+const char* TinyPBProtocol::PB_HANDSHAKE_METHOD = "rocket_rpc.TinyPB.Handshake";
 
 }
\ No newline at end of file
@@ -2,8 +2,16 @@
 #define ROCKET_RPC_NET_CODER_TINYPB_PROTOCOL_H
 
 #include <string>
+#include <memory>
 #include "rocket/net/coder/abstract_protocol.h"
 
+namespace google {
+namespace protobuf {
+class Message;
+class Arena;
+}
+}
+
 namespace rocket_rpc {
 
 struct TinyPBProtocol : public AbstractProtocol {
@@ -16,18 +24,36 @@ struct TinyPBProtocol : public AbstractProtocol {
     static char PB_START;
     static char PB_END;
 
+    // 在 err_code 之后带 timeout 字段的 v1 帧的开始符, 只发给握手成功的对端, 老版本的对端只会收到 PB_START 开头的帧
+    static char PB_START_WITH_TIMEOUT;
+
+    // v2 帧以 magic + 版本号开头, 与 v1 的开始符不同, decode 时按第一个字节区分
+    static char PB_V2_MAGIC;
+    static char PB_V2_VERSION;
+
+    // 客户端连接建立后发送的握手请求的方法名, 用 v1 帧发送, 只支持 v1 的服务端会当作找不到的 service 忽略
+    static const char* PB_HANDSHAKE_METHOD;
+
   public:
+    int32_t m_version {1};      // 帧格式版本, 服务端回包使用与请求相同的版本
     int32_t m_pk_len {0};
     int32_t m_msg_id_len {0};
     // msg_id 继承父类
 
     int32_t m_method_name_len {0};
     std::string m_method_name;
+    int32_t m_method_id {-1};   // v2 请求中代替 method_name 的 id, 由握手时服务端下发, -1 表示没有
     int32_t m_err_code {0};
+    int32_t m_timeout {0};      // 请求方剩余的超时时间(ms), 0 表示不限制, 回包中不使用; 对端不支持时不会发送
     int32_t m_err_info_len {0};
     std::string m_err_info;
     std::string m_pb_data;
+    // 不为空时 encode 直接把它序列化到 out_buffer 中, 不再经过 m_pb_data, encode 之后置空
+    // 调用方需要保证它在 encode 之前有效并且已经 IsInitialized
+    const google::protobuf::Message* m_pb_message {NULL};
     int32_t m_check_sum {0};
+    // 服务端回包持有请求的 arena(m_pb_message 就分配在其中), encode 之后释放
+    std::shared_ptr<google::protobuf::Arena> m_arena;
 
     bool parse_success {false};
 
@@ -0,0 +1,60 @@
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include "rocket/net/epoll_poller.h"
+#include "rocket/common/log.h"
+
+namespace rocket_rpc {
+
+EpollPoller::EpollPoller() {
+  m_epoll_fd = epoll_create(10);
+
+  if (m_epoll_fd == -1) {
+    ERRORLOG("failed to create event loop, epoll_create error, error info[%d]", errno);
+    exit(0);
+  }
+}
+
+EpollPoller::~EpollPoller() {
+  close(m_epoll_fd);
+}
+
+void EpollPoller::addEvent(FdEvent* event) {
+  epoll_event tmp = event->getEpollEvent();
+  if (event->isRegistered() && event->getRegisteredEvents() == tmp.events) {
+    return;
+  }
+  int op = event->isRegistered() ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+  INFOLOG("epoll_event.events = %d", (int)tmp.events);
+  int rt = epoll_ctl(m_epoll_fd, op, event->getFd(), &tmp);
+  if (rt == -1 && op == EPOLL_CTL_MOD && errno == ENOENT) {
+    // fd 没有先 delete 就被关闭了, 内核已经自动移除, 重新注册
+    rt = epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, event->getFd(), &tmp);
+  }
+  if (rt == -1) {
+    ERRORLOG("failed epoll_ctl when add fd %d, errno=%d, error=%s", event->getFd(), errno, strerror(errno));
+    return;
+  }
+  event->setRegistered(true, tmp.events);
+  DEBUGLOG("add event success, fd[%d]", event->getFd());
+}
+
+void EpollPoller::deleteEvent(FdEvent* event) {
+  if (!event->isRegistered()) {
+    return;
+  }
+  epoll_event tmp = event->getEpollEvent();
+  int rt = epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, event->getFd(), &tmp);
+  if (rt == -1) {
+    ERRORLOG("failed epoll_ctl when delete fd %d, errno=%d, error=%s", event->getFd(), errno, strerror(errno));
+  }
+  event->setRegistered(false, 0);
+  DEBUGLOG("delete event success, fd[%d]", event->getFd());
+}
+
+int EpollPoller::poll(epoll_event* events, int max_events, int timeout) {
+  return epoll_wait(m_epoll_fd, events, max_events, timeout);
+}
+
+}
\ No newline at end of file
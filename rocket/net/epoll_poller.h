@@ -0,0 +1,29 @@
+#ifndef ROCKET_RPC_NET_EPOLL_POLLER_H
+#define ROCKET_RPC_NET_EPOLL_POLLER_H
+
+#include "rocket/net/poller.h"
+
+namespace rocket_rpc {
+
+// 基于 epoll 的 IO 多路复用, 默认水平触发, FdEvent 设置了 EPOLLET 时为边缘触发
+// fd 是否已经注册以及注册的事件记录在 FdEvent 中, 监听事件没有变化时不调用 epoll_ctl
+class EpollPoller : public Poller {
+
+  public:
+    EpollPoller();
+
+    ~EpollPoller();
+
+    void addEvent(FdEvent* event);
+
+    void deleteEvent(FdEvent* event);
+
+    int poll(epoll_event* events, int max_events, int timeout);
+
+  private:
+    int m_epoll_fd {-1};
+};
+
+}
+
+#endif
\ No newline at end of file
@@ -2,44 +2,22 @@
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include <string.h>
+#include <time.h>
 #include "rocket/net/eventloop.h"
 #include "rocket/common/log.h"
 #include "rocket/common/util.h"
-
-#define ADD_TO_EPOLL() \
-    auto it = m_listen_fds.find(event->getFd()); \
-    int op = EPOLL_CTL_ADD; \
-    if (it != m_listen_fds.end()) { \
-      op = EPOLL_CTL_MOD; \
-    } \
-    epoll_event tmp = event->getEpollEvent(); \
-    INFOLOG("epoll_event.events = %d", (int)tmp.events); \
-    int rt = epoll_ctl(m_epoll_fd, op, event->getFd(), &tmp); \
-    if (rt == -1) { \
-      ERRORLOG("failed epoll_ctl when add fd %d, errno=%d, error=%s", event->getFd(), errno, strerror(errno)); \
-    } \
-    m_listen_fds.insert(event->getFd()); \
-    DEBUGLOG("add event success, fd[%d]", event->getFd()); \
-  
-#define DELETE_TO_EPOLL() \
-    auto it = m_listen_fds.find(event->getFd()); \
-    if (it == m_listen_fds.end()) { \
-      return; \
-    } \
-    int op = EPOLL_CTL_DEL; \
-    epoll_event tmp = event->getEpollEvent(); \
-    int rt = epoll_ctl(m_epoll_fd, op, event->getFd(), &tmp); \
-    if (rt == -1) { \
-      ERRORLOG("failed epoll_ctl when add fd %d, errno=%d, error=%s", event->getFd(), errno, strerror(errno)); \
-    } \
-    m_listen_fds.erase(event->getFd()); \
-    DEBUGLOG("delete event success, fd[%d]", event->getFd()); \
+#include "rocket/common/config.h"
+#include "rocket/net/timing_wheel_timer.h"
+#include "rocket/net/epoll_poller.h"
+#include "rocket/net/io_uring_poller.h"
 
 namespace rocket_rpc {
 
 static thread_local EventLoop* t_current_eventloop = NULL;
 static int g_epoll_max_timeout = 10000;
-static int g_epoll_max_events = 10;
+static int g_init_poll_events = 16;
+static int g_max_poll_events = 4096;
+static int g_max_tasks_per_loop = 1024;
 
 EventLoop::EventLoop() {
   if (t_current_eventloop != NULL) {
@@ -47,14 +25,9 @@ EventLoop::EventLoop() {
     exit(0);
   }
   m_thread_id = getThreadId();
+  m_poll_events.resize(g_init_poll_events);
 
-  m_epoll_fd = epoll_create(10);
-
-  if (m_epoll_fd == -1) {
-    ERRORLOG("failed to create event loop, epoll_create error, error info[%d]", errno);
-    exit(0);
-  }
-
+  initPoller();
   initWakeUpFdEvent();
   initTimer();
   INFOLOG("succ create event loop in thread %d", m_thread_id);
@@ -62,7 +35,6 @@ EventLoop::EventLoop() {
 }
 
 EventLoop::~EventLoop() {
-  close(m_epoll_fd);
   if (m_wakeup_fd_event) {
     delete m_wakeup_fd_event;
     m_wakeup_fd_event = NULL;
@@ -71,10 +43,37 @@ EventLoop::~EventLoop() {
     delete m_timer;
     m_timer = NULL;
   }
+  if (m_poller) {
+    delete m_poller;
+    m_poller = NULL;
+  }
+}
+
+void EventLoop::initPoller() {
+  // 默认使用 epoll, 配置为 io_uring 时使用 io_uring, 内核不支持时退回 epoll
+  Config* config = Config::GetGlobalConfig();
+  if (config && config->m_poller_type == "io_uring") {
+    IoUringPoller* poller = new IoUringPoller();
+    if (poller->isValid()) {
+      m_poller = poller;
+      return;
+    }
+    ERRORLOG("io_uring not available, fallback to epoll");
+    delete poller;
+  }
+  m_poller = new EpollPoller();
+  // io_uring 的 poll 请求每次完成后都会重新挂上, 没有边缘触发, 所以只在 epoll 下开启
+  m_edge_triggered = config && config->m_poller_edge_triggered;
 }
 
 void EventLoop::initTimer() {
-  m_timer = new Timer();
+  // 默认使用时间轮, 配置为 multimap 时使用原来按到期时间排序的实现
+  Config* config = Config::GetGlobalConfig();
+  if (config && config->m_timer_type == "multimap") {
+    m_timer = new Timer();
+  } else {
+    m_timer = new TimingWheelTimer();
+  }
   addEpollEvent(m_timer);
 }
 
@@ -82,6 +81,14 @@ void EventLoop::addTimerEvent(TimerEvent::s_ptr event) {
   m_timer->addTimerEvent(event);
 }
 
+void EventLoop::deleteTimerEvent(TimerEvent::s_ptr event) {
+  m_timer->deleteTimerEvent(event);
+}
+
+Timer* EventLoop::getTimer() {
+  return m_timer;
+}
+
 
 void EventLoop::initWakeUpFdEvent() {
   m_wakeup_fd = eventfd(0, EFD_NONBLOCK);
@@ -93,11 +100,10 @@ void EventLoop::initWakeUpFdEvent() {
 
   m_wakeup_fd_event = new WakeUpFdEvent(m_wakeup_fd);
 
+  // 一次 read 就会把 eventfd 的计数清零
   m_wakeup_fd_event->listen(FdEvent::IN_EVENT, [this]() {
-    char buf[8];
-    while (read(m_wakeup_fd, buf, 8) != -1 && errno != EAGAIN) {
-    }
-    DEBUGLOG("read full bytes from wakeup fd[%d]", m_wakeup_fd);
+    uint64_t count = 0;
+    read(m_wakeup_fd, &count, sizeof(count));
   });
 
   addEpollEvent(m_wakeup_fd_event);
@@ -105,49 +111,82 @@ void EventLoop::initWakeUpFdEvent() {
 
 void EventLoop::loop() {
   m_is_looping = true;
+  updateLoopTime();
+  int64_t work_begin = getLoopNowUs();
   while (!m_stop_flag) {
-    ScopeMutex<Mutex> lock(m_mutex);
-    std::queue<std::function<void()>> tmp_tasks;
-    m_pending_tasks.swap(tmp_tasks);
-    lock.unlock();
-
-    // 执行任务队列中的所有任务
-    while (!tmp_tasks.empty()) {
-      std::function<void()> cb = tmp_tasks.front();
-      tmp_tasks.pop();
+    // 执行任务队列中的任务, 任务里再投递的任务留到下一轮, 单轮最多执行 g_max_tasks_per_loop 个
+    int task_count = 0;
+    InlineFunction<void()> cb;
+    while (task_count < g_max_tasks_per_loop && m_pending_tasks.pop(cb)) {
+      task_count ++ ;
       if (cb) {
         cb();
       }
     }
 
+    // 发送这一轮(以及上一轮 IO 事件中)产生的回包, 每个连接只写一次
+    runFlushTasks();
+
     // 如果有定时任务需要执行, 那么执行
     // 1. 怎么判断一个定时任务需要执行? (now() > TimerEvent.arrive_time)
     // 2. arrive_time 如何让 eventloop 监听
 
     int timeout = g_epoll_max_timeout;
-    epoll_event result_events[g_epoll_max_events];
-    // DEBUGLOG("now begin to epoll_wait");
-    int rt = epoll_wait(m_epoll_fd, result_events, g_epoll_max_events, timeout);
-    // DEBUGLOG("now end epoll_wait, rt = %d", rt);
+    if (task_count == g_max_tasks_per_loop || !m_flush_tasks.empty()) {
+      timeout = 0;
+    }
+
+    if (m_busy_poll_us > 0) {
+      increase(m_work_us, getNowUs() - work_begin);
+    }
+
+    // 开启 busy poll 时, 先用 0 超时轮询一段时间, 这段时间内有事件或者任务就不用睡眠
+    int rt = 0;
+    bool polled = false;
+    if (timeout != 0 && m_busy_poll_us > 0) {
+      polled = busyPoll(rt);
+    }
+
+    if (!polled) {
+      // 先声明要睡眠, 再检查一次有没有新任务:
+      // 生产者先 push 再把 m_sleeping 改为 false, 两边都是 seq_cst, 所以要么这里看到了新任务, 要么生产者负责写 eventfd
+      m_sleeping.store(true);
+      if (!m_pending_tasks.empty() || m_stop_flag.load()) {
+        timeout = 0;
+      }
+      // DEBUGLOG("now begin to epoll_wait");
+      rt = m_poller->poll(&m_poll_events[0], m_poll_events.size(), timeout);
+      m_sleeping.store(false);
+      // DEBUGLOG("now end epoll_wait, rt = %d", rt);
+    }
+
+    // 本轮的定时器, 回调, 日志共用这个时间
+    updateLoopTime();
+    if (m_busy_poll_us > 0) {
+      work_begin = getLoopNowUs();
+    }
 
     if (rt < 0) {
-      ERRORLOG("epoll_wait error, errno=%s", errno);
+      if (errno != EINTR) {
+        ERRORLOG("poll error, errno=%d, error=%s", errno, strerror(errno));
+      }
     } else {
       for (int i = 0; i < rt; i ++ ) {
-        epoll_event trigger_event = result_events[i];
+        epoll_event trigger_event = m_poll_events[i];
         FdEvent* fd_event = static_cast<FdEvent*>(trigger_event.data.ptr);
         if (fd_event == NULL) {
           ERRORLOG("fd_event = NULL, continue");
           continue;
         }
 
+        // 已经在 loop 线程中, 直接执行回调, 不再经过任务队列
         if (trigger_event.events & EPOLLIN) {
           // DEBUGLOG("fd %d trigger EPOLLIN event", fd_event->getFd());
-          addTask(fd_event->handler(FdEvent::IN_EVENT));
+          fd_event->invoke(FdEvent::IN_EVENT);
         }
         if (trigger_event.events & EPOLLOUT) {
           // DEBUGLOG("fd %d trigger EPOLLOUT event", fd_event->getFd());
-          addTask(fd_event->handler(FdEvent::OUT_EVENT));
+          fd_event->invoke(FdEvent::OUT_EVENT);
         }
 
         // if (! (trigger_event.events & EPOLLIN) && ! (trigger_event.events & EPOLLOUT)) {
@@ -160,19 +199,29 @@ void EventLoop::loop() {
           DEBUGLOG("fd %d trigger EPOLLERROR event", fd_event->getFd());
           // 删除出错的套接字
           deleteEpollEvent(fd_event);
-          if (fd_event->handler(FdEvent::ERROR_EVENT) != nullptr) {
-            DEBUGLOG("fd %d add error callback", fd_event->getFd())
-            addTask(fd_event->handler(FdEvent::ERROR_EVENT));
-          }
+          DEBUGLOG("fd %d invoke error callback", fd_event->getFd())
+          fd_event->invoke(FdEvent::ERROR_EVENT);
         }
       }
+
+      // 事件数组被填满说明就绪的 fd 比较多, 扩大一倍, 减少处理同样多事件需要的 poll 次数
+      if (rt == (int)m_poll_events.size() && m_poll_events.size() < (size_t)g_max_poll_events) {
+        m_poll_events.resize(m_poll_events.size() * 2);
+      }
     }
 
   }
+  // 退出 loop 后缓存的时间不再刷新, 之后直接读时钟
+  clearLoopTime();
 }
 
 void EventLoop::wakeup() {
-  INFOLOG("WAKE UP");
+  // loop 醒着时一定会在睡眠前再检查一次任务队列, 已经有别的线程唤醒过时 eventfd 也已经可读, 都不需要再写
+  if (!m_sleeping.exchange(false)) {
+    m_wakeup_suppressed.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  m_wakeup_issued.fetch_add(1, std::memory_order_relaxed);
   m_wakeup_fd_event->wakeup();
 }
 
@@ -187,35 +236,56 @@ void EventLoop::dealWakeup() {
 
 void EventLoop::addEpollEvent(FdEvent* event) {
   if (isInLoopThread()) {
-    ADD_TO_EPOLL();
+    m_poller->addEvent(event);
   } else {
-    auto cb = [this, event]() {
-      ADD_TO_EPOLL();
-    };
-    addTask(cb, false);
+    // 需要唤醒, 否则要等到 epoll_wait 超时才会被注册
+    addTask([this, event]() {
+      m_poller->addEvent(event);
+    }, true);
   }
 }
 
 void EventLoop::deleteEpollEvent(FdEvent* event) {
   if (isInLoopThread()) {
-    DELETE_TO_EPOLL();
+    m_poller->deleteEvent(event);
   } else {
-    auto cb = [this, event]() {
-      DELETE_TO_EPOLL();
-    };
-    addTask(cb, true);
+    addTask([this, event]() {
+      m_poller->deleteEvent(event);
+    }, true);
   }
 }
 
-void EventLoop::addTask(std::function<void()> cb, bool is_wake_up /*=false*/) {
-  ScopeMutex<Mutex> lock(m_mutex);
-  m_pending_tasks.push(cb);
-  lock.unlock();
+void EventLoop::addTask(InlineFunction<void()> cb, bool is_wake_up /*=false*/) {
+  m_pending_tasks.push(std::move(cb));
   if (is_wake_up) {
     wakeup();
   }
 }
 
+bool EventLoop::isEdgeTriggered() {
+  return m_edge_triggered;
+}
+
+bool EventLoop::isCompletionIO() {
+  return m_poller->isCompletionBased();
+}
+
+void EventLoop::submitRead(FdEvent* event, char* buf, int size, std::shared_ptr<void> holder) {
+  m_poller->submitRead(event, buf, size, std::move(holder));
+}
+
+void EventLoop::submitWrite(FdEvent* event, const iovec* iov, int iov_count, std::shared_ptr<void> holder) {
+  m_poller->submitWrite(event, iov, iov_count, std::move(holder));
+}
+
+void EventLoop::submitAccept(FdEvent* event, sockaddr* addr, socklen_t* addr_len, std::shared_ptr<void> holder) {
+  m_poller->submitAccept(event, addr, addr_len, std::move(holder));
+}
+
+FixedBlockRegion* EventLoop::getFixedBlockRegion() {
+  return m_poller->getFixedBlockRegion();
+}
+
 bool EventLoop::isInLoopThread() {
   return getThreadId() == m_thread_id;
 }
@@ -232,4 +302,73 @@ bool EventLoop::isLooping() {
   return m_is_looping;
 }
 
+bool EventLoop::busyPoll(int& rt) {
+  // 轮询期间 m_sleeping 保持 false, 其他线程投递任务时不会写 eventfd, 由这里检查任务队列
+  int64_t begin = getNowUs();
+  int64_t now = begin;
+  bool found = false;
+  while (true) {
+    rt = m_poller->poll(&m_poll_events[0], m_poll_events.size(), 0);
+    now = getNowUs();
+    if (rt != 0 || !m_pending_tasks.empty() || m_stop_flag.load()) {
+      found = true;
+      break;
+    }
+    if (now - begin >= m_busy_poll_us) {
+      break;
+    }
+  }
+  increase(m_spin_us, now - begin);
+  increase(found ? m_spin_hits : m_spin_misses, 1);
+  return found;
+}
+
+void EventLoop::setBusyPollUs(int busy_poll_us) {
+  m_busy_poll_us = busy_poll_us;
+}
+
+void EventLoop::getBusyPollStats(BusyPollStats& stats) {
+  stats.spin_us = m_spin_us.load(std::memory_order_relaxed);
+  stats.work_us = m_work_us.load(std::memory_order_relaxed);
+  stats.spin_hits = m_spin_hits.load(std::memory_order_relaxed);
+  stats.spin_misses = m_spin_misses.load(std::memory_order_relaxed);
+}
+
+void EventLoop::addFlushTask(InlineFunction<void()> cb) {
+  m_flush_tasks.push_back(std::move(cb));
+}
+
+void EventLoop::runFlushTasks() {
+  if (m_flush_tasks.empty()) {
+    return;
+  }
+  // 换出来再执行, 执行过程中新加入的留到下一轮
+  m_running_flush_tasks.swap(m_flush_tasks);
+  for (size_t i = 0; i < m_running_flush_tasks.size(); ++i) {
+    m_running_flush_tasks[i]();
+  }
+  m_running_flush_tasks.clear();
+}
+
+void EventLoop::addWriteStats(int64_t frames, int64_t syscalls) {
+  increase(m_write_frames, frames);
+  increase(m_write_syscalls, syscalls);
+}
+
+int64_t EventLoop::getWriteFrameCount() {
+  return m_write_frames.load(std::memory_order_relaxed);
+}
+
+int64_t EventLoop::getWriteSyscallCount() {
+  return m_write_syscalls.load(std::memory_order_relaxed);
+}
+
+int64_t EventLoop::getWakeupIssuedCount() {
+  return m_wakeup_issued.load(std::memory_order_relaxed);
+}
+
+int64_t EventLoop::getWakeupSuppressedCount() {
+  return m_wakeup_suppressed.load(std::memory_order_relaxed);
+}
+
 }
\ No newline at end of file
@@ -2,17 +2,26 @@
 #define ROCKET_RPC_NET_EVENTLOOP_H
 
 #include <pthread.h>
-#include <set>
 #include <functional>
-#include <queue>
 #include <memory>
-#include "rocket/common/mutex.h"
+#include <atomic>
+#include <vector>
+#include "rocket/common/mpsc_queue.h"
+#include "rocket/common/inline_function.h"
 #include "rocket/net/fd_event.h"
 #include "rocket/net/wakeup_fd_event.h"
 #include "rocket/net/timer.h"
+#include "rocket/net/poller.h"
 
 namespace rocket_rpc {
 
+struct BusyPollStats {
+  int64_t spin_us {0};      // 0 超时轮询花费的时间
+  int64_t work_us {0};      // 执行任务, 回调, 发送花费的时间
+  int64_t spin_hits {0};    // 轮询期间等到了事件或者任务的次数
+  int64_t spin_misses {0};  // 轮询超时, 转为阻塞等待的次数
+};
+
 class EventLoop {
 
   public:
@@ -22,6 +31,7 @@ class EventLoop {
 
     void loop();
 
+    // 唤醒 loop, 只有 loop 正要睡眠或者已经睡在 epoll_wait 上时才会真正写 eventfd
     void wakeup();
 
     void stop();
@@ -32,12 +42,54 @@ class EventLoop {
 
     bool isInLoopThread();
 
-    void addTask(std::function<void()> cb, bool is_wake_up = false);
+    void addTask(InlineFunction<void()> cb, bool is_wake_up = false);
+
+    // 在本轮 loop 进入 epoll_wait 之前执行, 用于把这一轮产生的回包合并成一次发送, 只能在 loop 线程中调用
+    void addFlushTask(InlineFunction<void()> cb);
 
     void addTimerEvent(TimerEvent::s_ptr event);
 
+    void deleteTimerEvent(TimerEvent::s_ptr event);
+
+    Timer* getTimer();
+
     bool isLooping();
 
+    // 连接是否使用边缘触发, 只有 epoll 支持
+    bool isEdgeTriggered();
+
+    // 连接的读写和 accept 是否使用完成模式(io_uring), 是的话用下面的 submit 接口代替监听可读可写事件
+    // 完成后执行 FdEvent 原来的可读(读, accept)或者可写(写)回调, 结果通过 FdEvent::getResult 获取
+    bool isCompletionIO();
+
+    // 以下只能在 loop 线程中调用, 提交在本轮 loop 的 poll 中和等待一起完成
+    void submitRead(FdEvent* event, char* buf, int size, std::shared_ptr<void> holder);
+
+    void submitWrite(FdEvent* event, const iovec* iov, int iov_count, std::shared_ptr<void> holder);
+
+    void submitAccept(FdEvent* event, sockaddr* addr, socklen_t* addr_len, std::shared_ptr<void> holder);
+
+    // 读缓冲区优先从这里分配, 不支持时返回 NULL
+    FixedBlockRegion* getFixedBlockRegion();
+
+    // 实际写了 eventfd 的唤醒次数
+    int64_t getWakeupIssuedCount();
+
+    // 因为 loop 醒着(或者已经被唤醒)而省掉的唤醒次数
+    int64_t getWakeupSuppressedCount();
+
+    // 记录写出的消息数和写 socket 的系统调用次数, 只能在 loop 线程中调用
+    void addWriteStats(int64_t frames, int64_t syscalls);
+
+    int64_t getWriteFrameCount();
+
+    int64_t getWriteSyscallCount();
+
+    // 进入阻塞等待之前先用 0 超时轮询的时间(微秒), 0 表示不轮询, 需要在 loop 开始之前设置
+    void setBusyPollUs(int busy_poll_us);
+
+    void getBusyPollStats(BusyPollStats& stats);
+
   public:
     static EventLoop* GetCurrentEventLoop();
   
@@ -48,22 +100,56 @@ class EventLoop {
 
     void initTimer();
 
+    void initPoller();
+
+    void runFlushTasks();
+
+    // 0 超时轮询 m_busy_poll_us, 等到了事件或者任务时返回 true, rt 为 poll 的返回值
+    bool busyPoll(int& rt);
+
+    // 只有 loop 线程修改计数, 其他线程只读, 所以不需要原子的加法
+    static void increase(std::atomic<int64_t>& counter, int64_t value) {
+      counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
   private:
     pid_t m_thread_id {0};
 
-    int m_epoll_fd {0};
+    Poller* m_poller {NULL};
+
+    bool m_edge_triggered {false};
+
+    // poll 返回的就绪事件, 被填满时扩大
+    std::vector<epoll_event> m_poll_events;
+
+    int m_busy_poll_us {0};
+    std::atomic<int64_t> m_spin_us {0};
+    std::atomic<int64_t> m_work_us {0};
+    std::atomic<int64_t> m_spin_hits {0};
+    std::atomic<int64_t> m_spin_misses {0};
 
     int m_wakeup_fd {0};
 
     WakeUpFdEvent* m_wakeup_fd_event {NULL};
 
-    bool m_stop_flag {false};
+    std::atomic<bool> m_stop_flag {false};
+
+    // loop 准备进入(或者已经在) epoll_wait 时为 true, 第一个把它改为 false 的线程负责写 eventfd
+    std::atomic<bool> m_sleeping {false};
+
+    std::atomic<int64_t> m_wakeup_issued {0};
+    std::atomic<int64_t> m_wakeup_suppressed {0};
 
-    std::set<int> m_listen_fds;
+    // 其他线程投递过来的任务, 无锁队列, 只有 loop 线程消费
+    MpscQueue<InlineFunction<void()>> m_pending_tasks;
 
-    std::queue<std::function<void()>> m_pending_tasks;
+    // 本轮 loop 结束前要执行的发送任务, 只有 loop 线程访问
+    std::vector<InlineFunction<void()>> m_flush_tasks;
+    std::vector<InlineFunction<void()>> m_running_flush_tasks;
 
-    Mutex m_mutex;    
+    // 只有 loop 线程修改, 其他线程只读
+    std::atomic<int64_t> m_write_frames {0};
+    std::atomic<int64_t> m_write_syscalls {0};
 
     Timer* m_timer {NULL};
 
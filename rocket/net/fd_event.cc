@@ -27,32 +27,49 @@ void FdEvent::setNonBlock() {
   fcntl(m_fd, F_SETFL, flag | O_NONBLOCK);
 }
 
-std::function<void()> FdEvent::handler(TriggerEvent event) {
-  if (event == TriggerEvent::IN_EVENT) {
-    return m_read_callback;
-  } else if (event == TriggerEvent::OUT_EVENT) {
-    return m_write_callback;
-  } else if (event == TriggerEvent::ERROR_EVENT) {
-    return m_error_callback;
+void FdEvent::invoke(TriggerEvent event_type) {
+  InlineFunction<void()>* callback = NULL;
+  if (event_type == TriggerEvent::IN_EVENT) {
+    callback = &m_read_callback;
+  } else if (event_type == TriggerEvent::OUT_EVENT) {
+    callback = &m_write_callback;
+  } else if (event_type == TriggerEvent::ERROR_EVENT) {
+    callback = &m_error_callback;
+  }
+  if (callback == NULL || !(*callback)) {
+    return;
+  }
+
+  // 回调执行期间可能重新 listen, 把正在执行的这个回调替换掉
+  // 所以先移出来再执行(移动不会分配内存), 执行完没有被替换时再放回去
+  InlineFunction<void()> cb = std::move(*callback);
+  *callback = nullptr;
+  cb();
+  if (!(*callback)) {
+    *callback = std::move(cb);
   }
-  return nullptr;
 }
 
-void FdEvent::listen(TriggerEvent event_type, std::function<void()> callback, std::function<void()> error_callback /*= nullptr*/) {
+void FdEvent::listen(TriggerEvent event_type, InlineFunction<void()> callback, InlineFunction<void()> error_callback /*= nullptr*/) {
   if (event_type == TriggerEvent::IN_EVENT) {
     m_listen_events.events |= EPOLLIN;
-    m_read_callback = callback;
+    m_read_callback = std::move(callback);
   } else {
     m_listen_events.events |= EPOLLOUT;
-    m_write_callback = callback;
+    m_write_callback = std::move(callback);
   }
 
-  if (error_callback == nullptr) {
-    m_error_callback = error_callback;
+  m_error_callback = std::move(error_callback);
+
+  m_listen_events.data.ptr = this;
+}
+
+void FdEvent::setEdgeTriggered(bool edge_triggered) {
+  if (edge_triggered) {
+    m_listen_events.events |= EPOLLET;
   } else {
-    m_error_callback = nullptr;
+    m_listen_events.events &= (~EPOLLET);
   }
-
   m_listen_events.data.ptr = this;
 }
 
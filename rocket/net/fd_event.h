@@ -3,6 +3,7 @@
 
 #include <functional>
 #include <sys/epoll.h>
+#include "rocket/common/inline_function.h"
 
 namespace rocket_rpc {
 
@@ -23,9 +24,10 @@ class FdEvent {
 
     void setNonBlock();
 
-    std::function<void()> handler(TriggerEvent event_type);
+    // 在 loop 线程中直接执行对应的回调, 没有设置回调时什么也不做
+    void invoke(TriggerEvent event_type);
 
-    void listen(TriggerEvent event_type, std::function<void()> callback, std::function<void()> error_callback = nullptr);
+    void listen(TriggerEvent event_type, InlineFunction<void()> callback, InlineFunction<void()> error_callback = nullptr);
 
     // 取消监听
     void cancel(TriggerEvent event_type);
@@ -37,15 +39,56 @@ class FdEvent {
     epoll_event getEpollEvent() {
       return m_listen_events;
     }
+
+    // 边缘触发, 之后注册时带上 EPOLLET
+    void setEdgeTriggered(bool edge_triggered);
+
+    bool isEdgeTriggered() const {
+      return m_listen_events.events & EPOLLET;
+    }
+
+    // 当前在 poller 中注册的事件, 由 poller 维护, 用来区分 ADD 和 MOD 以及跳过没有变化的修改
+    bool isRegistered() const {
+      return m_registered;
+    }
+
+    uint32_t getRegisteredEvents() const {
+      return m_registered_events;
+    }
+
+    void setRegistered(bool registered, uint32_t events) {
+      m_registered = registered;
+      m_registered_events = events;
+    }
+
+    // io_uring 完成模式下由 poller 填入的读写(或 accept)结果, 在对应回调中获取
+    // 含义与 read/write/accept 的返回值相同, 出错时为 -errno
+    void setResult(TriggerEvent event_type, int result) {
+      if (event_type == OUT_EVENT) {
+        m_out_result = result;
+      } else {
+        m_in_result = result;
+      }
+    }
+
+    int getResult(TriggerEvent event_type) const {
+      return event_type == OUT_EVENT ? m_out_result : m_in_result;
+    }
   
   protected:
     int m_fd {-1};
 
     epoll_event m_listen_events;
 
-    std::function<void()> m_read_callback {nullptr};
-    std::function<void()> m_write_callback {nullptr};
-    std::function<void()> m_error_callback {nullptr};
+    bool m_registered {false};
+    uint32_t m_registered_events {0};
+
+    int m_in_result {0};
+    int m_out_result {0};
+
+    InlineFunction<void()> m_read_callback;
+    InlineFunction<void()> m_write_callback;
+    InlineFunction<void()> m_error_callback;
 };
 
 }
@@ -3,6 +3,7 @@
 #include "rocket/net/io_thread.h"
 #include "rocket/common/log.h"
 #include "rocket/common/util.h"
+#include "rocket/net/tcp/buffer_block_pool.h"
 
 namespace rocket_rpc {
 
@@ -41,6 +42,8 @@ void* IOThread::Main(void* arg) {
 
   thread->m_event_loop = new EventLoop();
   thread->m_thread_id = getThreadId();
+  // 每个 IO 线程有自己的 buffer block 池, 连接的读写缓冲区都从这里分配
+  BufferBlockPool* block_pool = BufferBlockPool::GetBufferBlockPool();
 
   // 唤醒等待的线程
   sem_post(&thread->m_init_semaphore);
@@ -51,7 +54,22 @@ void* IOThread::Main(void* arg) {
   DEBUGLOG("IOThread %d start loop", thread->m_thread_id);
   thread->m_event_loop->loop();
 
-  DEBUGLOG("IOThread %d end loop ", thread->m_thread_id);
+  BufferBlockPoolStats stats;
+  block_pool->getStats(stats);
+  DEBUGLOG("IOThread %d end loop, buffer block pool alloc[%lld] hit rate[%.2f] resident[%lld B]", thread->m_thread_id,
+    (long long)stats.alloc_count, stats.hitRate(), (long long)stats.resident_bytes);
+
+  EventLoop* event_loop = thread->m_event_loop;
+  int64_t frames = event_loop->getWriteFrameCount();
+  int64_t syscalls = event_loop->getWriteSyscallCount();
+  DEBUGLOG("IOThread %d end loop, write frames[%lld] syscalls[%lld] frames per syscall[%.2f]", thread->m_thread_id,
+    (long long)frames, (long long)syscalls, syscalls == 0 ? 0 : (double)frames / syscalls);
+
+  BusyPollStats busy_poll_stats;
+  event_loop->getBusyPollStats(busy_poll_stats);
+  DEBUGLOG("IOThread %d end loop, busy poll spin[%lld us] work[%lld us] spin hits[%lld] misses[%lld]", thread->m_thread_id,
+    (long long)busy_poll_stats.spin_us, (long long)busy_poll_stats.work_us,
+    (long long)busy_poll_stats.spin_hits, (long long)busy_poll_stats.spin_misses);
 
   return NULL;
 }
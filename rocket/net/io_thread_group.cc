@@ -33,4 +33,12 @@ IOThread* IOThreadGroup::getIOThread() {
   return m_io_thread_groups[m_index ++ ];
 }
 
+IOThread* IOThreadGroup::getIOThread(int index) {
+  return m_io_thread_groups[index];
+}
+
+int IOThreadGroup::getSize() {
+  return m_size;
+}
+
 }
\ No newline at end of file
@@ -20,6 +20,11 @@ class IOThreadGroup {
 
     IOThread* getIOThread();
 
+    // 按下标获取 IO 线程, index 需要小于线程数
+    IOThread* getIOThread(int index);
+
+    int getSize();
+
   private:
 
     int m_size {0};
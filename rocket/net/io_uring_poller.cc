@@ -0,0 +1,439 @@
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "rocket/net/io_uring_poller.h"
+#include "rocket/common/log.h"
+
+namespace rocket_rpc {
+
+static const unsigned g_ring_entries = 256;
+
+// 取消 poll 请求的 sqe 使用的 user_data, 它的完成事件直接丢弃
+static const uint64_t g_cancel_user_data = UINT64_MAX;
+
+// 读写操作的 user_data 最高位为 1, 低 32 位是 Op 的下标; poll 请求的 user_data 高 32 位是 fd, 最高位一定是 0
+static const uint64_t g_op_user_data_flag = 1ULL << 63;
+
+// 注册给内核的读缓冲区大小(block 数), 4MB, 空闲连接只占一个 block
+static const int g_fixed_region_blocks = 1024;
+
+static uint64_t opUserData(int index, uint32_t seq) {
+  return g_op_user_data_flag | ((uint64_t)(seq & 0x7fffffff) << 32) | (uint32_t)index;
+}
+
+// poll 能识别的事件, EPOLLET 等只对 epoll 有意义的标志需要去掉
+static const uint32_t g_poll_mask = EPOLLIN | EPOLLOUT | EPOLLPRI | EPOLLRDHUP;
+
+static unsigned loadAcquire(unsigned* p) {
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void storeRelease(unsigned* p, unsigned value) {
+  __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+IoUringPoller::IoUringPoller() {
+  if (!init()) {
+    ERRORLOG("failed to init io_uring, errno=%d, error=%s", errno, strerror(errno));
+  }
+}
+
+IoUringPoller::~IoUringPoller() {
+  // m_fixed_region 中的 block 可能还在 TcpBuffer 中, 不释放
+  if (m_cq_ring && m_cq_ring != m_sq_ring) {
+    munmap(m_cq_ring, m_cq_ring_size);
+  }
+  if (m_sq_ring) {
+    munmap(m_sq_ring, m_sq_ring_size);
+  }
+  if (m_sqes) {
+    munmap(m_sqes, m_sq_entries * sizeof(io_uring_sqe));
+  }
+  if (m_ring_fd != -1) {
+    close(m_ring_fd);
+  }
+}
+
+bool IoUringPoller::init() {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  m_ring_fd = syscall(__NR_io_uring_setup, g_ring_entries, &params);
+  if (m_ring_fd < 0) {
+    m_ring_fd = -1;
+    return false;
+  }
+
+  // 带超时的等待需要 IORING_FEAT_EXT_ARG(5.11)
+  if (!(params.features & IORING_FEAT_EXT_ARG)) {
+    ERRORLOG("io_uring does not support IORING_FEAT_EXT_ARG, kernel too old");
+    close(m_ring_fd);
+    m_ring_fd = -1;
+    errno = ENOTSUP;
+    return false;
+  }
+
+  m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap && m_cq_ring_size > m_sq_ring_size) {
+    m_sq_ring_size = m_cq_ring_size;
+  }
+
+  m_sq_ring = mmap(NULL, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+  if (m_sq_ring == MAP_FAILED) {
+    m_sq_ring = NULL;
+    return false;
+  }
+  if (single_mmap) {
+    m_cq_ring = m_sq_ring;
+    m_cq_ring_size = m_sq_ring_size;
+  } else {
+    m_cq_ring = mmap(NULL, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_CQ_RING);
+    if (m_cq_ring == MAP_FAILED) {
+      m_cq_ring = NULL;
+      return false;
+    }
+  }
+
+  m_sq_entries = params.sq_entries;
+  void* sqes = mmap(NULL, m_sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    return false;
+  }
+  m_sqes = reinterpret_cast<io_uring_sqe*>(sqes);
+
+  char* sq = reinterpret_cast<char*>(m_sq_ring);
+  m_sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+  m_sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  m_sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  m_sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  m_sq_local_tail = *m_sq_tail;
+
+  char* cq = reinterpret_cast<char*>(m_cq_ring);
+  m_cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  m_cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  m_cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+  INFOLOG("succ init io_uring, fd[%d], sq entries[%u], cq entries[%u]", m_ring_fd, params.sq_entries, params.cq_entries);
+  return true;
+}
+
+bool IoUringPoller::isValid() {
+  return m_sqes != NULL;
+}
+
+IoUringPoller::Registration& IoUringPoller::getRegistration(int fd) {
+  if (fd >= (int)m_registrations.size()) {
+    m_registrations.resize(fd + 1);
+  }
+  return m_registrations[fd];
+}
+
+void IoUringPoller::scheduleArm(int fd) {
+  Registration& reg = m_registrations[fd];
+  if (!reg.need_arm) {
+    reg.need_arm = true;
+    m_arm_fds.push_back(fd);
+  }
+}
+
+void IoUringPoller::cancelArmed(int fd, Registration& reg) {
+  if (reg.armed) {
+    io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = userData(fd, reg.generation);
+    sqe->user_data = g_cancel_user_data;
+    reg.armed = false;
+  }
+  // 旧请求已经产生但还没处理的完成事件也一并作废
+  reg.generation ++ ;
+}
+
+void IoUringPoller::cancelOps(Registration& reg) {
+  for (int kind = OP_IN; kind <= OP_OUT; ++kind) {
+    int index = reg.ops[kind];
+    if (index < 0) {
+      continue;
+    }
+    io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = opUserData(index, m_ops[index].seq);
+    sqe->user_data = g_cancel_user_data;
+    reg.ops[kind] = -1;
+  }
+  reg.op_generation ++ ;
+}
+
+void IoUringPoller::addEvent(FdEvent* event) {
+  int fd = event->getFd();
+  Registration& reg = getRegistration(fd);
+  uint32_t mask = event->getEpollEvent().events & g_poll_mask;
+
+  if (reg.event == event && reg.mask == mask) {
+    return;
+  }
+
+  cancelArmed(fd, reg);
+  reg.event = event;
+  reg.mask = mask;
+  if (mask != 0) {
+    scheduleArm(fd);
+  }
+  DEBUGLOG("add event success, fd[%d], events[%u]", fd, mask);
+}
+
+void IoUringPoller::deleteEvent(FdEvent* event) {
+  int fd = event->getFd();
+  if (fd < 0 || fd >= (int)m_registrations.size() || m_registrations[fd].event != event) {
+    return;
+  }
+  Registration& reg = m_registrations[fd];
+  cancelArmed(fd, reg);
+  // 被取消的操作的 holder 要等完成事件到达才释放, 在这之前内核可能还在使用缓冲区
+  cancelOps(reg);
+  reg.event = NULL;
+  reg.mask = 0;
+  DEBUGLOG("delete event success, fd[%d]", fd);
+}
+
+io_uring_sqe* IoUringPoller::prepareOp(FdEvent* event, OpKind kind, std::shared_ptr<void>& holder) {
+  int fd = event->getFd();
+  Registration& reg = getRegistration(fd);
+  if (reg.event != event) {
+    if (reg.event != NULL) {
+      cancelArmed(fd, reg);
+      cancelOps(reg);
+      reg.mask = 0;
+    }
+    reg.event = event;
+  }
+
+  int index = 0;
+  if (!m_free_ops.empty()) {
+    index = m_free_ops.back();
+    m_free_ops.pop_back();
+  } else {
+    index = m_ops.size();
+    m_ops.push_back(Op());
+  }
+  Op& op = m_ops[index];
+  op.event = event;
+  op.fd = fd;
+  op.generation = reg.op_generation;
+  op.seq ++ ;
+  op.kind = kind;
+  op.holder = std::move(holder);
+  reg.ops[kind] = index;
+
+  io_uring_sqe* sqe = getSqe();
+  sqe->fd = fd;
+  sqe->user_data = opUserData(index, op.seq);
+  return sqe;
+}
+
+void IoUringPoller::submitRead(FdEvent* event, char* buf, int size, std::shared_ptr<void> holder) {
+  io_uring_sqe* sqe = prepareOp(event, OP_IN, holder);
+  // 在注册过的区域内时内核直接使用已经映射好的页, 否则和 recv 一样每次都要映射
+  if (m_fixed_region && m_fixed_region->contains(buf, size)) {
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->buf_index = 0;
+  } else {
+    sqe->opcode = IORING_OP_RECV;
+  }
+  sqe->addr = (uint64_t)(uintptr_t)buf;
+  sqe->len = size;
+}
+
+void IoUringPoller::submitWrite(FdEvent* event, const iovec* iov, int iov_count, std::shared_ptr<void> holder) {
+  io_uring_sqe* sqe = prepareOp(event, OP_OUT, holder);
+  sqe->opcode = IORING_OP_WRITEV;
+  m_pending_writes ++ ;
+  sqe->addr = (uint64_t)(uintptr_t)iov;
+  sqe->len = iov_count;
+}
+
+void IoUringPoller::submitAccept(FdEvent* event, sockaddr* addr, socklen_t* addr_len, std::shared_ptr<void> holder) {
+  io_uring_sqe* sqe = prepareOp(event, OP_IN, holder);
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->addr = (uint64_t)(uintptr_t)addr;
+  sqe->addr2 = (uint64_t)(uintptr_t)addr_len;
+}
+
+FixedBlockRegion* IoUringPoller::getFixedBlockRegion() {
+  if (m_fixed_region_inited) {
+    return m_fixed_region;
+  }
+  m_fixed_region_inited = true;
+
+  FixedBlockRegion* region = new FixedBlockRegion(g_fixed_region_blocks);
+  if (!region->isValid()) {
+    delete region;
+    return NULL;
+  }
+  // 整个区域注册为 0 号固定缓冲区, READ_FIXED 可以读到其中任意一段
+  iovec iov;
+  iov.iov_base = region->getBase();
+  iov.iov_len = region->getSize();
+  int rt = syscall(__NR_io_uring_register, m_ring_fd, IORING_REGISTER_BUFFERS, &iov, 1);
+  if (rt < 0) {
+    // 一般是 RLIMIT_MEMLOCK 不够, 退回普通的 recv
+    ERRORLOG("failed to register io_uring buffers, size[%zu], errno=%d, error=%s", region->getSize(), errno, strerror(errno));
+    delete region;
+    return NULL;
+  }
+  m_fixed_region = region;
+  INFOLOG("succ register io_uring fixed buffers, size[%zu]", region->getSize());
+  return m_fixed_region;
+}
+
+bool IoUringPoller::completeOp(io_uring_cqe* cqe, epoll_event& event) {
+  int index = (int)(uint32_t)cqe->user_data;
+  if (index >= (int)m_ops.size()) {
+    return false;
+  }
+  Op& op = m_ops[index];
+  if (cqe->user_data != opUserData(index, op.seq) || op.event == NULL) {
+    return false;
+  }
+
+  // 内核已经不再使用缓冲区, holder 留到下一次 poll 再释放
+  m_finished_holders.push_back(std::move(op.holder));
+  m_free_ops.push_back(index);
+  FdEvent* fd_event = op.event;
+  op.event = NULL;
+
+  Registration& reg = m_registrations[op.fd];
+  if (reg.ops[op.kind] == index) {
+    reg.ops[op.kind] = -1;
+  }
+  if (reg.event != fd_event || reg.op_generation != op.generation) {
+    return false;
+  }
+
+  fd_event->setResult(op.kind == OP_OUT ? FdEvent::OUT_EVENT : FdEvent::IN_EVENT, cqe->res);
+  event.events = op.kind == OP_OUT ? EPOLLOUT : EPOLLIN;
+  event.data.ptr = fd_event;
+  return true;
+}
+
+io_uring_sqe* IoUringPoller::getSqe() {
+  if (m_sq_local_tail - loadAcquire(m_sq_head) >= m_sq_entries) {
+    enter(m_sq_local_tail - loadAcquire(m_sq_head), 0, 0, 0);
+  }
+  unsigned index = m_sq_local_tail & m_sq_mask;
+  io_uring_sqe* sqe = &m_sqes[index];
+  memset(sqe, 0, sizeof(io_uring_sqe));
+  m_sq_array[index] = index;
+  m_sq_local_tail ++ ;
+  return sqe;
+}
+
+int IoUringPoller::enter(unsigned to_submit, unsigned min_complete, unsigned flags, int timeout) {
+  storeRelease(m_sq_tail, m_sq_local_tail);
+
+  __kernel_timespec ts;
+  io_uring_getevents_arg arg;
+  memset(&arg, 0, sizeof(arg));
+  if (timeout >= 0) {
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (timeout % 1000) * 1000000LL;
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+  }
+  arg.sigmask_sz = _NSIG / 8;
+
+  return syscall(__NR_io_uring_enter, m_ring_fd, to_submit, min_complete, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+int IoUringPoller::poll(epoll_event* events, int max_events, int timeout) {
+  // 上一轮完成的操作的回调都已经执行完了
+  m_finished_holders.clear();
+
+  // 上一轮完成的, 以及新注册的 fd 重新挂上 poll 请求, 还可读写的 fd 会立即产生完成事件
+  for (size_t i = 0; i < m_arm_fds.size(); ++i) {
+    int fd = m_arm_fds[i];
+    Registration& reg = m_registrations[fd];
+    reg.need_arm = false;
+    if (reg.event == NULL || reg.armed || reg.mask == 0) {
+      continue;
+    }
+    io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = reg.mask;
+    sqe->user_data = userData(fd, reg.generation);
+    reg.armed = true;
+  }
+  m_arm_fds.clear();
+
+  // 完成队列中还有上次没处理完的事件时不等待
+  unsigned min_complete = 1;
+  if (timeout == 0 || loadAcquire(m_cq_tail) != *m_cq_head) {
+    min_complete = 0;
+    timeout = 0;
+  } else if (m_pending_writes > 0) {
+    // 套接字缓冲区有空间时写操作在提交时就完成了, 只为它的完成事件返回一次会多一轮 enter
+    // 所以连同下一个事件一起等, 写没有立即完成时最多多等 1ms
+    min_complete += m_pending_writes;
+    if (timeout < 0 || timeout > 1) {
+      timeout = 1;
+    }
+  }
+  m_pending_writes = 0;
+
+  // 提交和等待在同一次系统调用中完成
+  int rt = enter(m_sq_local_tail - loadAcquire(m_sq_head), min_complete, IORING_ENTER_GETEVENTS, timeout);
+  if (rt < 0 && errno != ETIME && errno != EINTR) {
+    return -1;
+  }
+
+  int count = 0;
+  unsigned head = *m_cq_head;
+  unsigned tail = loadAcquire(m_cq_tail);
+  while (head != tail && count < max_events) {
+    io_uring_cqe* cqe = &m_cqes[head & m_cq_mask];
+    head ++ ;
+
+    if (cqe->user_data == g_cancel_user_data) {
+      continue;
+    }
+    if (cqe->user_data & g_op_user_data_flag) {
+      if (completeOp(cqe, events[count])) {
+        count ++ ;
+      }
+      continue;
+    }
+    int fd = (int)(cqe->user_data >> 32);
+    uint32_t generation = (uint32_t)cqe->user_data;
+    if (fd >= (int)m_registrations.size()) {
+      continue;
+    }
+    Registration& reg = m_registrations[fd];
+    if (reg.event == NULL || reg.generation != generation) {
+      continue;
+    }
+    reg.armed = false;
+    scheduleArm(fd);
+
+    if (cqe->res == -ECANCELED) {
+      continue;
+    }
+    events[count].events = cqe->res < 0 ? EPOLLERR : (uint32_t)cqe->res;
+    events[count].data.ptr = reg.event;
+    count ++ ;
+  }
+  storeRelease(m_cq_head, head);
+
+  if (count == 0 && rt < 0 && errno == EINTR) {
+    return -1;
+  }
+  return count;
+}
+
+}
\ No newline at end of file
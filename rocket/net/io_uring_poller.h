@@ -0,0 +1,141 @@
+#ifndef ROCKET_RPC_NET_IO_URING_POLLER_H
+#define ROCKET_RPC_NET_IO_URING_POLLER_H
+
+#include <vector>
+#include <memory>
+#include <stdint.h>
+#include <linux/io_uring.h>
+#include "rocket/net/poller.h"
+#include "rocket/net/tcp/fixed_block_region.h"
+
+namespace rocket_rpc {
+
+// 基于 io_uring 的 IO 多路复用, 直接使用系统调用, 不依赖 liburing
+// 每个 fd 挂一个单次的 IORING_OP_POLL_ADD, 完成后在下一次 poll 时重新挂上, 语义与水平触发的 epoll 相同
+// 注册, 修改, 删除都只是往提交队列里放 sqe, 和等待一起在一次 io_uring_enter 里提交
+// 一轮 loop 只需要一次系统调用, 而 epoll 每次修改监听事件都要单独调用一次 epoll_ctl
+// 连接的读写和 accept 使用完成模式: 直接提交 READ_FIXED/RECV, WRITEV, ACCEPT, 完成后才通知, 不再有单独的 read/write 系统调用
+class IoUringPoller : public Poller {
+
+  public:
+    IoUringPoller();
+
+    ~IoUringPoller();
+
+    // 内核不支持 io_uring(或者被禁用)时返回 false, 此时不能使用
+    bool isValid();
+
+    void addEvent(FdEvent* event);
+
+    void deleteEvent(FdEvent* event);
+
+    int poll(epoll_event* events, int max_events, int timeout);
+
+    bool isCompletionBased() {
+      return true;
+    }
+
+    void submitRead(FdEvent* event, char* buf, int size, std::shared_ptr<void> holder);
+
+    void submitWrite(FdEvent* event, const iovec* iov, int iov_count, std::shared_ptr<void> holder);
+
+    void submitAccept(FdEvent* event, sockaddr* addr, socklen_t* addr_len, std::shared_ptr<void> holder);
+
+    // 第一次调用时创建并注册
+    FixedBlockRegion* getFixedBlockRegion();
+
+  private:
+    enum OpKind {
+      OP_IN = 0,    // 读和 accept, 完成后返回 EPOLLIN
+      OP_OUT = 1,   // 写, 完成后返回 EPOLLOUT
+    };
+
+    struct Registration {
+      FdEvent* event {NULL};
+      uint32_t mask {0};        // 监听的事件
+      uint32_t generation {0};  // 每次重新注册或者删除都加一, 用来丢弃旧的 poll 请求的完成事件
+      bool armed {false};       // 是否有在途的 poll 请求
+      bool need_arm {false};    // 是否在 m_arm_fds 中
+      uint32_t op_generation {0};   // 删除时加一, 用来丢弃已经取消的读写操作的完成事件
+      int ops[2] {-1, -1};          // 在途的读写操作在 m_ops 中的下标, 删除时用来取消
+    };
+
+    // 在途的读写操作, 完成事件到达之前一直占用
+    struct Op {
+      FdEvent* event {NULL};
+      int fd {-1};
+      uint32_t generation {0};  // 提交时的 op_generation
+      uint32_t seq {0};         // 每次占用加一, 和下标一起组成 user_data, 避免取消请求作用到复用这个下标的新操作上
+      OpKind kind {OP_IN};
+      std::shared_ptr<void> holder;
+    };
+
+    bool init();
+
+    Registration& getRegistration(int fd);
+
+    // 下一次 poll 时重新挂上 poll 请求
+    void scheduleArm(int fd);
+
+    // 取消在途的 poll 请求
+    void cancelArmed(int fd, Registration& reg);
+
+    // 取消在途的读写操作, 之后到达的完成事件不再通知
+    void cancelOps(Registration& reg);
+
+    // 取一个空闲的 sqe, 提交队列满时先提交一次
+    io_uring_sqe* getSqe();
+
+    int enter(unsigned to_submit, unsigned min_complete, unsigned flags, int timeout);
+
+    // 占用一个 Op 并返回对应的 sqe, user_data 已经填好
+    io_uring_sqe* prepareOp(FdEvent* event, OpKind kind, std::shared_ptr<void>& holder);
+
+    // 处理读写操作的完成事件, 需要通知时返回 true
+    bool completeOp(io_uring_cqe* cqe, epoll_event& event);
+
+    static uint64_t userData(int fd, uint32_t generation) {
+      return ((uint64_t)(uint32_t)fd << 32) | generation;
+    }
+
+  private:
+    int m_ring_fd {-1};
+
+    // 提交队列
+    void* m_sq_ring {NULL};
+    size_t m_sq_ring_size {0};
+    unsigned* m_sq_head {NULL};
+    unsigned* m_sq_tail {NULL};
+    unsigned* m_sq_array {NULL};
+    unsigned m_sq_mask {0};
+    unsigned m_sq_entries {0};
+    unsigned m_sq_local_tail {0};
+    io_uring_sqe* m_sqes {NULL};
+
+    // 完成队列, 内核支持 IORING_FEAT_SINGLE_MMAP 时与提交队列共用一次映射
+    void* m_cq_ring {NULL};
+    size_t m_cq_ring_size {0};
+    unsigned* m_cq_head {NULL};
+    unsigned* m_cq_tail {NULL};
+    unsigned m_cq_mask {0};
+    io_uring_cqe* m_cqes {NULL};
+
+    std::vector<Registration> m_registrations;   // 以 fd 为下标
+    std::vector<int> m_arm_fds;
+
+    std::vector<Op> m_ops;
+    std::vector<int> m_free_ops;
+
+    // 本轮完成的操作的 holder, 留到下一次 poll 才释放, 保证本轮回调执行时对象还在
+    std::vector<std::shared_ptr<void>> m_finished_holders;
+
+    // 上次 enter 之后新提交的写操作个数
+    unsigned m_pending_writes {0};
+
+    FixedBlockRegion* m_fixed_region {NULL};
+    bool m_fixed_region_inited {false};
+};
+
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,50 @@
+#ifndef ROCKET_RPC_NET_POLLER_H
+#define ROCKET_RPC_NET_POLLER_H
+
+#include <memory>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include "rocket/net/fd_event.h"
+
+namespace rocket_rpc {
+
+class FixedBlockRegion;
+
+// IO 多路复用的接口, 有 EpollPoller 和 IoUringPoller 两种实现, 由 EventLoop 根据配置选择
+// 所有函数都只在 EventLoop 所在的线程中调用
+class Poller {
+
+  public:
+    virtual ~Poller() {}
+
+    // 注册或者更新 fd 监听的事件, 以 event->getEpollEvent() 为准
+    virtual void addEvent(FdEvent* event) = 0;
+
+    virtual void deleteEvent(FdEvent* event) = 0;
+
+    // 等待事件, 用法与 epoll_wait 相同, events[i].data.ptr 为对应的 FdEvent
+    virtual int poll(epoll_event* events, int max_events, int timeout) = 0;
+
+    // 以下为完成模式(io_uring)的接口: 读写和 accept 由 poller 提交给内核执行, 不再是就绪通知之后再调用 read/write
+    // 完成后 poll 返回对应 fd 的 EPOLLIN(读, accept) 或 EPOLLOUT(写) 事件, 结果通过 FdEvent::getResult 获取
+    // holder 一直持有到内核返回完成事件(包括被 deleteEvent 取消的), 保证在途操作使用的缓冲区有效
+    virtual bool isCompletionBased() {
+      return false;
+    }
+
+    virtual void submitRead(FdEvent* event, char* buf, int size, std::shared_ptr<void> holder) {}
+
+    virtual void submitWrite(FdEvent* event, const iovec* iov, int iov_count, std::shared_ptr<void> holder) {}
+
+    virtual void submitAccept(FdEvent* event, sockaddr* addr, socklen_t* addr_len, std::shared_ptr<void> holder) {}
+
+    // 已经注册给内核的读缓冲区, 从这里分配的 block 读的时候不需要每次映射用户内存, 不支持时返回 NULL
+    virtual FixedBlockRegion* getFixedBlockRegion() {
+      return NULL;
+    }
+};
+
+}
+
+#endif
\ No newline at end of file
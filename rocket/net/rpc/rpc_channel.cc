@@ -7,10 +7,13 @@
 #include "rocket/net/rpc/rpc_controller.h"
 #include "rocket/net/coder/tinypb_protocol.h"
 #include "rocket/net/tcp/tcp_client.h"
+#include "rocket/net/tcp/tcp_client_pool.h"
+#include "rocket/net/rpc/rpc_client_runtime.h"
 #include "rocket/common/log.h"
 #include "rocket/common/msg_id_util.h"
 #include "rocket/common/error_code.h"
 #include "rocket/common/run_time.h"
+#include "rocket/common/util.h"
 #include "rocket/net/timer_event.h"
 
 namespace rocket_rpc {
@@ -24,18 +27,47 @@ RpcChannel::~RpcChannel() {
   INFOLOG("~RpcChannel");
 }
 
-void RpcChannel::callBack() {
-  RpcController* my_controller = dynamic_cast<RpcController*>(getController());
-  if (my_controller->Finished()) {
+void RpcChannel::callBack(RpcCall::s_ptr call) {
+  if (call->is_finished) {
     return;
   }
+  call->is_finished = true;
 
-  if (m_closure) {
-    m_closure->Run();
-    if (m_controller) {
-      my_controller->SetFinished(true);
+  // 定时任务和读回调里持有 channel, 摘除它们可能释放掉最后一个引用, 回调结束前要保证 channel 还活着
+  s_ptr channel = shared_from_this();
+
+  // 调用已经结束, 把超时定时任务从定时器中摘除, 不用等到超时时间到达
+  if (call->timer_event) {
+    if (call->client) {
+      call->client->deleteTimerEvent(call->timer_event);
+    } else {
+      call->timer_event->setCanceled(true);
+    }
+    call->timer_event.reset();
+  }
+
+  // 先把连接还给连接池, 这样 closure 里发起的下一次调用可以直接复用
+  releaseClient(call);
+
+  if (call->controller) {
+    call->controller->SetFinished(true);
+  }
+
+  google::protobuf::Closure* done = call->done;
+  if (done) {
+    if (m_executor) {
+      m_executor([done]() {
+        done->Run();
+      });
+    } else {
+      done->Run();
     }
   }
+
+  // 同步调用, 唤醒等待的调用方线程
+  if (call->sync_sem) {
+    sem_post(call->sync_sem);
+  }
 }
 
 void RpcChannel::Init(controller_s_ptr controller, message_s_ptr req, message_s_ptr resp, closure_s_ptr done) {
@@ -49,29 +81,40 @@ void RpcChannel::Init(controller_s_ptr controller, message_s_ptr req, message_s_
   m_is_init = true;
 }
 
+void RpcChannel::setExecutor(Executor executor) {
+  m_executor = executor;
+}
+
 void RpcChannel::CallMethod(const google::protobuf::MethodDescriptor* method,
                       google::protobuf::RpcController* controller, const google::protobuf::Message* request,
                       google::protobuf::Message* response, google::protobuf::Closure* done) {
 
   std::shared_ptr<TinyPBProtocol> req_protocol = std::make_shared<TinyPBProtocol>();
-  
+
+  RpcCall::s_ptr call = std::make_shared<RpcCall>();
+  call->response = response;
+  call->done = done;
+  call->request = req_protocol;
+
   RpcController* my_controller = dynamic_cast<RpcController*>(controller);
+  call->controller = my_controller;
   if (my_controller == NULL || request == NULL || response == NULL) {
     ERRORLOG("failed callmethod, RpcController convert error");
-    my_controller->SetError(ERROR_RPC_CHANNEL_INIT, "controller or request or response MULL");
-    callBack();
+    if (my_controller) {
+      my_controller->SetError(ERROR_RPC_CHANNEL_INIT, "controller or request or response MULL");
+    }
+    callBack(call);
     return;
   }
 
   if (m_peer_addr == nullptr) {
     ERRORLOG("failed get peer addr");
     my_controller->SetError(ERROR_RPC_PEER_ADDR, "peer addr nullptr");
-    callBack();
+    callBack(call);
     return;
   }
 
-  m_client = std::make_shared<TcpClient>(m_peer_addr);
-
+  // msg_id 要在调用方线程里取, RunTime 是线程局部的
   if (my_controller->GetMsgId().empty()) {
     // 先从 runtime 里面取, 取不到再生成一个
     // 这样的目的是为了实现 msg_id 的透传, 假设服务 A 调用了 B, 那么同一个 msgid 可以在服务 A 和 B 之间串起来, 方便日志追踪
@@ -89,15 +132,33 @@ void RpcChannel::CallMethod(const google::protobuf::MethodDescriptor* method,
     req_protocol->m_msg_id = my_controller->GetMsgId();
   }
 
+  // 在处理上游请求的过程中发起的调用, 超时时间不超过上游请求剩余的时间, 上游已经超时的话不再发出
+  int64_t deadline = RunTime::GetRunTime()->m_deadline;
+  if (deadline != 0) {
+    int64_t remain = (deadline - getNowUs()) / 1000;
+    if (remain <= 0) {
+      std::string err_info = "upstream deadline exceeded";
+      my_controller->SetError(ERROR_RPC_DEADLINE_EXCEEDED, err_info);
+      ERRORLOG("%s | %s", req_protocol->m_msg_id.c_str(), err_info.c_str());
+      callBack(call);
+      return;
+    }
+    if (remain < my_controller->GetTimeout()) {
+      my_controller->SetTimeout(remain);
+    }
+  }
+  // 把剩余的超时时间带给服务端(连接握手成功之后才会发送), 服务端据此拒绝已经超时的请求(回复超时错误), 并继续往下游传递
+  req_protocol->m_timeout = my_controller->GetTimeout();
+
   req_protocol->m_method_name = method->full_name();
   INFOLOG("%s | call method name [%s]", req_protocol->m_msg_id.c_str(), req_protocol->m_method_name.c_str());
 
-  if (!m_is_init) {
-
-    std::string err_info = "RpcChannel not call init()";
-    my_controller->SetError(ERROR_RPC_CHANNEL_INIT, err_info);
-    ERRORLOG("%s | %s, RpcChannel not init", req_protocol->m_msg_id.c_str(), err_info.c_str());
-    callBack();
+  RpcClientRuntime* runtime = RpcClientRuntime::GetRpcClientRuntime();
+  if (done == NULL && runtime->isInIOThread()) {
+    std::string err_info = "can not call rpc synchronously in client io thread";
+    my_controller->SetError(ERROR_RPC_SYNC_IN_IO_THREAD, err_info);
+    ERRORLOG("%s | %s", req_protocol->m_msg_id.c_str(), err_info.c_str());
+    callBack(call);
     return;
   }
 
@@ -106,89 +167,126 @@ void RpcChannel::CallMethod(const google::protobuf::MethodDescriptor* method,
     std::string err_info = "failed to serialize";
     my_controller->SetError(ERROR_FAILED_SERIALIZE, err_info);
     ERRORLOG("%s | %s, origin request [%s]", req_protocol->m_msg_id.c_str(), err_info.c_str(), request->ShortDebugString().c_str());
-    callBack();
+    callBack(call);
     return;
   }
 
+  sem_t sync_sem;
+  if (done == NULL) {
+    sem_init(&sync_sem, 0, 0);
+    call->sync_sem = &sync_sem;
+  }
+
   s_ptr channel = shared_from_this();  // 只可用智能指针构造, 不用裸指针 or 栈对象
 
+  // 投递到客户端 IO 线程上执行, 当前线程就是客户端 IO 线程时直接执行
+  EventLoop* event_loop = runtime->getEventLoop();
+  if (event_loop->isInLoopThread()) {
+    startCall(call);
+  } else {
+    event_loop->addTask([channel, call]() {
+      channel->startCall(call);
+    }, true);
+  }
+
+  if (done == NULL) {
+    sem_wait(&sync_sem);
+    sem_destroy(&sync_sem);
+  }
+}
+
+void RpcChannel::startCall(RpcCall::s_ptr call) {
+  std::shared_ptr<TinyPBProtocol> req_protocol = call->request;
+  RpcController* my_controller = call->controller;
+
+  // 连接是多路复用的, 按 msg_id 从连接池中选一个在途请求最少的连接
+  call->client = TcpClientPool::GetTcpClientPool()->acquire(m_peer_addr, req_protocol->m_msg_id);
+
+  s_ptr channel = shared_from_this();
+
   // 执行之后定时器自行析构
-  TimerEvent::s_ptr timer_event = std::make_shared<TimerEvent>(my_controller->GetTimeout(), false, [my_controller, channel]() mutable {
+  call->timer_event = std::make_shared<TimerEvent>(my_controller->GetTimeout(), false, [my_controller, channel, call]() mutable {
     INFOLOG("%s | call rpc timeout arrive", my_controller->GetMsgId().c_str());
-    if (my_controller->Finished()) {
+    if (call->is_finished) {
       channel.reset();
       return;
     }
 
-    my_controller->StartCancel();
     my_controller->SetError(ERROR_RPC_CALL_TIMEOUT, "rpc call timeout " + std::to_string(my_controller->GetTimeout()));
+    my_controller->StartCancel();
 
-    channel->callBack();
+    channel->callBack(call);
     channel.reset();
   });
 
-  m_client->addTimerEvent(timer_event);  // 为 rpc 调用添加定时任务
+  call->client->addTimerEvent(call->timer_event);  // 为 rpc 调用添加定时任务
+
+  // 连接上的回调都由该连接自己持有, 这里直接捕获裸指针即可
+  TcpClient* client = call->client.get();
 
-  m_client->connect([req_protocol, this]() mutable {
+  client->connect([req_protocol, channel, call, client]() mutable {
 
-    RpcController* my_controller = dynamic_cast<RpcController*>(getController());
+    RpcController* my_controller = call->controller;
+    if (call->is_finished) {
+      // 在等待 connect 的时候已经超时了
+      return;
+    }
 
-    if (getTcpClient()->getConnectErrorCode() != 0) {
-      my_controller->SetError(getTcpClient()->getConnectErrorCode(), getTcpClient()->getConnectErrorInfo());
+    if (client->getConnectErrorCode() != 0) {
+      my_controller->SetError(client->getConnectErrorCode(), client->getConnectErrorInfo());
       ERRORLOG("%s | connect error, error code[%d], error info[%s], peer addr[%s]", 
         req_protocol->m_msg_id.c_str(), my_controller->GetErrorCode(), 
-        my_controller->GetErrorInfo().c_str(), getTcpClient()->getPeerAddr()->toString().c_str());
+        my_controller->GetErrorInfo().c_str(), client->getPeerAddr()->toString().c_str());
 
-      callBack();
+      channel->callBack(call);
 
       return;
     }
 
     INFOLOG("%s | connect success, peer addr[%s], local addr[%s]", 
       req_protocol->m_msg_id.c_str(),
-      getTcpClient()->getPeerAddr()->toString().c_str(),
-      getTcpClient()->getLocalAddr()->toString().c_str());
+      client->getPeerAddr()->toString().c_str(),
+      client->getLocalAddr()->toString().c_str());
+
+    // 先注册读回调再发送, 同一个连接上的多个请求按发送顺序写出, 回包按 msg_id 各自完成
+    // 读回调在超时的时候会被取消, 这里持有 call 不会一直留在连接上
+    RpcChannel* this_channel = channel.get();
+    client->readMessage(req_protocol->m_msg_id, [this_channel, call, client, my_controller](AbstractProtocol::s_ptr msg) mutable {
+      std::shared_ptr<TinyPBProtocol> resp_protocol = std::dynamic_pointer_cast<TinyPBProtocol>(msg);
+      INFOLOG("%s | success get rpc response, call method name[%s], peer addr[%s], local addr[%s]", 
+        resp_protocol->m_msg_id.c_str(), call->request->m_method_name.c_str(),
+        client->getPeerAddr()->toString().c_str(), client->getLocalAddr()->toString().c_str());
+
+      if (!(call->response->ParseFromString(resp_protocol->m_pb_data))) {
+        ERRORLOG("%s | serialize error, peer addr[%s], local addr[%s]", 
+          resp_protocol->m_msg_id.c_str(),
+          client->getPeerAddr()->toString().c_str(), client->getLocalAddr()->toString().c_str());
+        my_controller->SetError(ERROR_FAILED_SERIALIZE, "serialize error");
+        this_channel->callBack(call);
+        return;
+      }
+      
+      if (resp_protocol->m_err_code != 0) {
+        ERRORLOG("%s | call rpc method[%s] failed, error code[%d], error info [%s], peer addr[%s], local addr[%s]", 
+          resp_protocol->m_msg_id.c_str(), call->request->m_method_name.c_str(), 
+          resp_protocol->m_err_code, resp_protocol->m_err_info.c_str(), 
+          client->getPeerAddr()->toString().c_str(), client->getLocalAddr()->toString().c_str());
+        my_controller->SetError(resp_protocol->m_err_code, resp_protocol->m_err_info);
+        this_channel->callBack(call);
+        return;
+      }
+
+      INFOLOG("%s | call rpc success, call method name[%s], peer addr[%s], local addr[%s]",
+        resp_protocol->m_msg_id.c_str(), call->request->m_method_name.c_str(), 
+        client->getPeerAddr()->toString().c_str(), client->getLocalAddr()->toString().c_str());
+
+      this_channel->callBack(call);
+    });
 
-    getTcpClient()->writeMessage(req_protocol, [req_protocol, this, my_controller](AbstractProtocol::s_ptr) mutable {
+    client->writeMessage(req_protocol, [req_protocol, client](AbstractProtocol::s_ptr) mutable {
       INFOLOG("%s | send request success. method_name[%s], peer addr[%s], local addr[%s]", 
         req_protocol->m_msg_id.c_str(), req_protocol->m_method_name.c_str(),
-        getTcpClient()->getPeerAddr()->toString().c_str(), getTcpClient()->getLocalAddr()->toString().c_str());
-        
-      getTcpClient()->readMessage(req_protocol->m_msg_id, [this, my_controller](AbstractProtocol::s_ptr msg) mutable {
-        std::shared_ptr<TinyPBProtocol> resp_protocol = std::dynamic_pointer_cast<TinyPBProtocol>(msg);
-        INFOLOG("%s | success get rpc response, call method name[%s], peer addr[%s], local addr[%s]", 
-          resp_protocol->m_msg_id.c_str(), resp_protocol->m_method_name.c_str(),
-          getTcpClient()->getPeerAddr()->toString().c_str(), getTcpClient()->getLocalAddr()->toString().c_str());
-
-        if (!(getResposne()->ParseFromString(resp_protocol->m_pb_data))) {
-          ERRORLOG("%s | serialize error, peer addr[%s], local addr[%s]", 
-            resp_protocol->m_msg_id.c_str(),
-            getTcpClient()->getPeerAddr()->toString().c_str(), getTcpClient()->getLocalAddr()->toString().c_str());
-          my_controller->SetError(ERROR_FAILED_SERIALIZE, "serialize error");
-          callBack();
-          return;
-        }
-        
-        if (resp_protocol->m_err_code != 0) {
-          ERRORLOG("%s | call rpc method[%s] failed, error code[%d], error info [%s], peer addr[%s], local addr[%s]", 
-            resp_protocol->m_msg_id.c_str(), resp_protocol->m_method_name, 
-            resp_protocol->m_err_code, resp_protocol->m_err_info, 
-            getTcpClient()->getPeerAddr()->toString().c_str(), getTcpClient()->getLocalAddr()->toString().c_str());
-          my_controller->SetError(resp_protocol->m_err_code, resp_protocol->m_err_info);
-          callBack();
-          return;
-        }
-
-        INFOLOG("%s | call rpc success, call method name[%s], peer addr[%s], local addr[%s]",
-          resp_protocol->m_msg_id.c_str(), resp_protocol->m_method_name.c_str(), 
-          getTcpClient()->getPeerAddr()->toString().c_str(), getTcpClient()->getLocalAddr()->toString().c_str());
-
-
-        // channel.reset();  // 将 rpc channel 的引用计数减一, 方便析构
-        callBack();
-
-      });
-
+        client->getPeerAddr()->toString().c_str(), client->getLocalAddr()->toString().c_str());
     });
 
   });
@@ -212,8 +310,16 @@ google::protobuf::Closure* RpcChannel::getClosure() {
   return m_closure.get();
 }
 
-TcpClient* RpcChannel::getTcpClient() {
-  return m_client.get();
+void RpcChannel::releaseClient(RpcCall::s_ptr call) {
+  if (!call->client) {
+    return;
+  }
+  RpcController* my_controller = call->controller;
+
+  // 连接被多个调用共享, 只取消本次调用的读回调(超时等情况下还留在连接上), 迟到的回包到达后会被直接丢弃
+  call->client->cancelReadMessage(my_controller->GetMsgId());
+  TcpClientPool::GetTcpClientPool()->release(call->client, my_controller->GetMsgId());
+  call->client.reset();
 }
 
 NetAddr::s_ptr RpcChannel::FindAddr(const std::string& str) {
@@ -3,9 +3,13 @@
 
 #include <google/protobuf/service.h>
 #include <memory>
+#include <functional>
+#include <semaphore.h>
 #include "rocket/net/tcp/net_addr.h"
 #include "rocket/net/tcp/tcp_client.h"
 #include "rocket/net/timer_event.h"
+#include "rocket/net/coder/tinypb_protocol.h"
+#include "rocket/net/rpc/rpc_controller.h"
 
 namespace rocket_rpc {
 
@@ -25,6 +29,23 @@ namespace rocket_rpc {
   stub_name(channel.get()).method_name(controller.get(), request.get(), response.get(), closure.get()); \
   } \
   
+// 一次 rpc 调用的状态
+// 同一个 channel 上可以同时有多个调用(可以来自不同线程), 调用相关的状态都放在这里, 而不是 channel 上
+struct RpcCall {
+  typedef std::shared_ptr<RpcCall> s_ptr;
+
+  RpcController* controller {NULL};
+  google::protobuf::Message* response {NULL};
+  google::protobuf::Closure* done {NULL};
+
+  std::shared_ptr<TinyPBProtocol> request;
+  TcpClient::s_ptr client;      // 本次调用使用的连接, 由客户端 IO 线程从连接池中获取
+  TimerEvent::s_ptr timer_event;
+
+  sem_t* sync_sem {NULL};       // 同步调用时, 调用方线程在这上面等待
+  bool is_finished {false};
+};
+
 class RpcChannel : public google::protobuf::RpcChannel, public std::enable_shared_from_this<RpcChannel> {
 
   public:
@@ -33,6 +54,9 @@ class RpcChannel : public google::protobuf::RpcChannel, public std::enable_share
     typedef std::shared_ptr<google::protobuf::Message> message_s_ptr;
     typedef std::shared_ptr<google::protobuf::Closure> closure_s_ptr;
 
+    // 执行调用完成回调(done)的执行器, 为空时 done 直接在客户端 IO 线程上执行
+    typedef std::function<void(std::function<void()>)> Executor;
+
   public:
     // 获取 addr
     // 若 str 是 ip:port, 直接返回
@@ -44,12 +68,21 @@ class RpcChannel : public google::protobuf::RpcChannel, public std::enable_share
 
     ~RpcChannel();
 
+    // 可选, 让 channel 持有这些对象直到 channel 析构(CALLRPC 宏使用)
+    // 多个线程共享同一个 channel 时不要调用, 直接 CallMethod 即可
     void Init(controller_s_ptr controller, message_s_ptr req, message_s_ptr resp, closure_s_ptr done);
 
+    // 可以在任意线程调用, 调用会投递到客户端 IO 线程上执行
+    // done 不为空时异步调用, 完成后 done 在客户端 IO 线程(或者 executor)上执行
+    // done 为空时同步调用, 阻塞当前线程直到调用完成, 不能在客户端 IO 线程中使用
+    // controller/request/response/done 需要保证在调用完成之前有效
     void CallMethod(const google::protobuf::MethodDescriptor* method,
                           google::protobuf::RpcController* controller, const google::protobuf::Message* request,
                           google::protobuf::Message* response, google::protobuf::Closure* done);
 
+    // 需要在发起调用之前设置
+    void setExecutor(Executor executor);
+
     google::protobuf::RpcController* getController();
 
     google::protobuf::Message* getRequest();
@@ -58,10 +91,15 @@ class RpcChannel : public google::protobuf::RpcChannel, public std::enable_share
 
     google::protobuf::Closure* getClosure();
 
-    TcpClient* getTcpClient();
-
   private:
-    void callBack();
+    // 在客户端 IO 线程上执行: 获取连接, 添加超时定时器, 发送请求
+    void startCall(RpcCall::s_ptr call);
+
+    // 调用结束(成功/失败/超时), 只会执行一次
+    void callBack(RpcCall::s_ptr call);
+
+    // 将本次调用使用的连接归还给连接池
+    void releaseClient(RpcCall::s_ptr call);
 
   private:
     NetAddr::s_ptr m_peer_addr {nullptr};
@@ -74,7 +112,7 @@ class RpcChannel : public google::protobuf::RpcChannel, public std::enable_share
 
     bool m_is_init {false};
 
-    TcpClient::s_ptr m_client {nullptr};
+    Executor m_executor;
 
 };
 
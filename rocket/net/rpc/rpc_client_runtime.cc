@@ -0,0 +1,61 @@
+#include "rocket/net/rpc/rpc_client_runtime.h"
+#include "rocket/common/config.h"
+#include "rocket/common/log.h"
+#include "rocket/common/mutex.h"
+#include "rocket/net/fd_event_group.h"
+
+namespace rocket_rpc {
+
+static RpcClientRuntime* g_rpc_client_runtime = NULL;
+static Mutex g_rpc_client_runtime_mutex;
+
+RpcClientRuntime* RpcClientRuntime::GetRpcClientRuntime() {
+  ScopeMutex<Mutex> lock(g_rpc_client_runtime_mutex);
+  if (g_rpc_client_runtime == NULL) {
+    int io_threads = 1;
+    Config* config = Config::GetGlobalConfig();
+    if (config && config->m_client_io_threads > 0) {
+      io_threads = config->m_client_io_threads;
+    }
+    g_rpc_client_runtime = new RpcClientRuntime(io_threads);
+  }
+  return g_rpc_client_runtime;
+}
+
+RpcClientRuntime::RpcClientRuntime(int io_threads) : m_io_threads(io_threads) {
+  // FdEventGroup 是懒加载的, 先在当前线程创建好, 避免多个 IO 线程同时初始化
+  FdEventGroup::GetFdEventGroup();
+
+  m_io_thread_group = new IOThreadGroup(m_io_threads);
+  m_io_thread_group->start();
+  INFOLOG("rpc client runtime start, io threads[%d]", m_io_threads);
+}
+
+RpcClientRuntime::~RpcClientRuntime() {
+  if (m_io_thread_group) {
+    delete m_io_thread_group;
+    m_io_thread_group = NULL;
+  }
+}
+
+EventLoop* RpcClientRuntime::getEventLoop() {
+  for (int i = 0; i < m_io_threads; ++i) {
+    EventLoop* event_loop = m_io_thread_group->getIOThread(i)->getEventLoop();
+    if (event_loop->isInLoopThread()) {
+      return event_loop;
+    }
+  }
+  unsigned int index = m_index.fetch_add(1) % m_io_threads;
+  return m_io_thread_group->getIOThread(index)->getEventLoop();
+}
+
+bool RpcClientRuntime::isInIOThread() {
+  for (int i = 0; i < m_io_threads; ++i) {
+    if (m_io_thread_group->getIOThread(i)->getEventLoop()->isInLoopThread()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}
\ No newline at end of file
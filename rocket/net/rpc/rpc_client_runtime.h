@@ -0,0 +1,40 @@
+#ifndef ROCKET_RPC_NET_RPC_RPC_CLIENT_RUNTIME_H
+#define ROCKET_RPC_NET_RPC_RPC_CLIENT_RUNTIME_H
+
+#include <atomic>
+#include "rocket/net/eventloop.h"
+#include "rocket/net/io_thread_group.h"
+
+namespace rocket_rpc {
+
+// 客户端运行时, 持有一组客户端专用的 IO 线程
+// 任意线程发起的 rpc 调用都会投递到其中一个 IO 线程上执行(connect/读写/超时), 调用方线程不会被阻塞
+// 每个 IO 线程有自己的 TcpClientPool
+class RpcClientRuntime {
+  public:
+    RpcClientRuntime(int io_threads);
+
+    ~RpcClientRuntime();
+
+    // 选一个 IO 线程的 eventloop 用于发起调用
+    // 当前线程就是客户端 IO 线程时直接使用当前线程, 否则轮询
+    EventLoop* getEventLoop();
+
+    // 当前线程是否是客户端 IO 线程
+    bool isInIOThread();
+
+  public:
+    // 第一次调用时创建并启动 IO 线程, 线程数取配置 <client><io_threads>, 默认 1
+    static RpcClientRuntime* GetRpcClientRuntime();
+
+  private:
+    int m_io_threads {0};
+
+    IOThreadGroup* m_io_thread_group {NULL};
+
+    std::atomic<unsigned int> m_index {0};
+};
+
+}
+
+#endif
\ No newline at end of file
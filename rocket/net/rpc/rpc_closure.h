@@ -7,6 +7,7 @@
 #include "rocket/common/run_time.h"
 #include "rocket/common/log.h"
 #include "rocket/common/exception.h"
+#include "rocket/common/inline_function.h"
 #include "rocket/net/rpc/rpc_interface.h"
 
 namespace rocket_rpc {
@@ -15,7 +16,7 @@ class RpcClosure : public google::protobuf::Closure {
   public:
     typedef std::shared_ptr<RpcInterface> it_s_ptr;
 
-    RpcClosure(it_s_ptr interface, std::function<void()> cb) : m_rpc_interface(interface), m_cb(cb) {
+    RpcClosure(it_s_ptr interface, InlineFunction<void()> cb) : m_rpc_interface(interface), m_cb(std::move(cb)) {
       INFOLOG("RpcClosure");
     }
 
@@ -30,7 +31,7 @@ class RpcClosure : public google::protobuf::Closure {
         RunTime::GetRunTime()->m_rpc_interface = m_rpc_interface.get();
       }
       try {
-        if (m_cb != nullptr) {
+        if (m_cb) {
           m_cb();
         }
         if (m_rpc_interface) {
@@ -63,7 +64,7 @@ class RpcClosure : public google::protobuf::Closure {
   
   private:
     it_s_ptr m_rpc_interface {nullptr};
-    std::function<void()> m_cb {nullptr};
+    InlineFunction<void()> m_cb;
 };
 
 }
@@ -1,27 +1,29 @@
+#include <algorithm>
 #include <google/protobuf/service.h>
 #include <google/protobuf/descriptor.h>
 #include <google/protobuf/message.h>
+#include <google/protobuf/arena.h>
 
 #include "rocket/net/rpc/rpc_dispatcher.h"
 #include "rocket/net/rpc/rpc_controller.h"
 #include "rocket/net/rpc/rpc_closure.h"
 #include "rocket/net/coder/tinypb_protocol.h"
+#include "rocket/net/coder/tinypb_coder.h"
 #include "rocket/net/tcp/net_addr.h"
 #include "rocket/net/tcp/tcp_connection.h"
 #include "rocket/common/log.h"
 #include "rocket/common/error_code.h"
 #include "rocket/common/run_time.h"
+#include "rocket/common/config.h"
+#include "rocket/common/util.h"
 
 namespace rocket_rpc {
 
-#define DELETE_RESOURCE(XX) \
-  if (XX != NULL) { \
-    delete XX; \
-    XX = NULL; \
-  } 
-
 static RpcDispatcher* g_rpc_dispatcher = NULL;
 
+// 请求 arena 第一个 block 的上限, 个别特别大的请求不会把之后所有请求的第一个 block 都撑大
+static const int64_t g_max_arena_start_block_size = 64 * 1024;
+
 RpcDispatcher* RpcDispatcher::GetRpcDispatcher() {
   if (g_rpc_dispatcher != NULL) {
     return g_rpc_dispatcher;
@@ -35,77 +37,230 @@ void RpcDispatcher::dispatch(AbstractProtocol::s_ptr request, AbstractProtocol::
   std::shared_ptr<TinyPBProtocol> req_protocol = std::dynamic_pointer_cast<TinyPBProtocol>(request);
   std::shared_ptr<TinyPBProtocol> resp_protocol = std::dynamic_pointer_cast<TinyPBProtocol>(response);
 
-  std::string method_full_name = req_protocol->m_method_name;
-  std::string service_name;
-  std::string method_name;
-
   resp_protocol->m_msg_id = req_protocol->m_msg_id;
   resp_protocol->m_method_name = req_protocol->m_method_name;
+  resp_protocol->m_version = req_protocol->m_version;
 
-  if (!parseServiceFullName(method_full_name, service_name, method_name)) {
-    setTinyPBError(resp_protocol, ERROR_PARSE_SERVICE_NAME, "parse service name error");
-    return;
+  // v2 请求直接按握手时下发的 method id 取; v1 请求按 method 全名查一次注册时建好的分发表, 不拆分字符串, 也不再走 protobuf 的反射查找
+  MethodEntry* entry = NULL;
+  if (req_protocol->m_method_id >= 0) {
+    entry = findMethodById(req_protocol->m_method_id);
+  } else {
+    entry = findMethod(req_protocol->m_method_name);
   }
+  if (entry == NULL) {
+    if (req_protocol->m_method_id >= 0) {
+      ERRORLOG("%s | method id[%d] not found", req_protocol->m_msg_id.c_str(), req_protocol->m_method_id);
+      setTinyPBError(resp_protocol, ERROR_METHOD_NOT_FOUND, "method not found");
+      return;
+    }
+    if (req_protocol->m_method_name == TinyPBProtocol::PB_HANDSHAKE_METHOD) {
+      // 客户端连接的握手, 回复所有方法的 id, 之后的请求可以用 v2 发送
+      INFOLOG("%s | tinypb handshake from peer[%s]", req_protocol->m_msg_id.c_str(), connection->getPeerAddr()->toString().c_str());
+      resp_protocol->m_pb_data = m_handshake_data;
+      reply(connection->shared_from_this(), resp_protocol);
+      return;
+    }
 
-  auto it = m_service_map.find(service_name);
-  if (it == m_service_map.end()) {
-    ERRORLOG("%s | service name[%s] not found", req_protocol->m_msg_id.c_str(), service_name.c_str());
-    setTinyPBError(resp_protocol, ERROR_SERVICE_NOT_FOUND, "service not found");
+    // 查不到时才拆分全名, 区分具体是哪一种错误
+    std::string service_name;
+    std::string method_name;
+    if (!parseServiceFullName(req_protocol->m_method_name, service_name, method_name)) {
+      setTinyPBError(resp_protocol, ERROR_PARSE_SERVICE_NAME, "parse service name error");
+    } else if (m_service_map.find(service_name) == m_service_map.end()) {
+      ERRORLOG("%s | service name[%s] not found", req_protocol->m_msg_id.c_str(), service_name.c_str());
+      setTinyPBError(resp_protocol, ERROR_SERVICE_NOT_FOUND, "service not found");
+    } else {
+      ERRORLOG("%s | method name[%s] not found in service[%s]", req_protocol->m_msg_id.c_str(), method_name.c_str(), service_name.c_str());
+      setTinyPBError(resp_protocol, ERROR_METHOD_NOT_FOUND, "method not found");
+    }
     return;
   }
 
-  service_s_ptr service = (*it).second;
+  // 调用方给的超时时间是相对值, 从解包时开始计算截止时间, 不依赖两端的时钟一致
+  int64_t deadline = 0;
+  if (req_protocol->m_timeout > 0) {
+    deadline = req_protocol->m_decode_time + req_protocol->m_timeout * 1000LL;
+  }
 
-  const google::protobuf::MethodDescriptor* method = service->GetDescriptor()->FindMethodByName(method_name);
-  if (method == NULL) {
-    ERRORLOG("%s | method name[%s] not found in service[%s]", req_protocol->m_msg_id.c_str(), method_name.c_str(), service_name.c_str());
-    setTinyPBError(resp_protocol, ERROR_METHOD_NOT_FOUND, "method not found");
+  // 已经超时的请求不再反序列化和执行; 这里和业务队列里超时的请求一样, 都回复 ERROR_RPC_DEADLINE_EXCEEDED,
+  // 回包很小, 调用方已经放弃等待时会按 msg_id 找不到读回调而丢弃, 还在等的调用方能立即得到明确的错误
+  if (isExpired(deadline)) {
+    ERRORLOG("%s | request expired before dispatch, timeout[%d ms], reject request", req_protocol->m_msg_id.c_str(), req_protocol->m_timeout);
+    setTinyPBError(resp_protocol, ERROR_RPC_DEADLINE_EXCEEDED, "deadline exceeded");
+    reply(connection->shared_from_this(), resp_protocol);
     return;
   }
 
-  google::protobuf::Message* req_msg = service->GetRequestPrototype(method).New();
+  // 请求和回包的 message 以及 controller 都从这个请求自己的 arena 中分配, 不再逐个 new/delete
+  // arena 挂在回包上, 回包 encode 之后(或者请求中途失败, 回包被丢弃时)整体释放
+  google::protobuf::ArenaOptions arena_options;
+  arena_options.start_block_size = getArenaStartBlockSize(entry);
+  arena_options.max_block_size = std::max(arena_options.start_block_size, arena_options.max_block_size);
+  std::shared_ptr<google::protobuf::Arena> arena = std::make_shared<google::protobuf::Arena>(arena_options);
+  resp_protocol->m_arena = arena;
+
+  google::protobuf::Message* req_msg = entry->request_prototype->New(arena.get());
 
   // 反序列化, 将 pb_data 反序列化为 req_msg
   if (!req_msg->ParseFromString(req_protocol->m_pb_data)) {
     ERRORLOG("%s | deserialize error", req_protocol->m_msg_id.c_str());
     setTinyPBError(resp_protocol, ERROR_FAILED_DESERIALIZE, "deserialize error");
-    DELETE_RESOURCE(req_msg);
     return;
   }
 
   INFOLOG("%s | get rpc request[%s]", req_protocol->m_msg_id.c_str(), req_msg->ShortDebugString().c_str());
 
-  google::protobuf::Message* resp_msg = service->GetResponsePrototype(method).New();
+  google::protobuf::Message* resp_msg = entry->response_prototype->New(arena.get());
 
-  RpcController* rpc_controller = new RpcController();
+  RpcController* rpc_controller = google::protobuf::Arena::Create<RpcController>(arena.get());
   rpc_controller->SetLocalAddr(connection->getLocalAddr());
   rpc_controller->SetPeerAddr(connection->getPeerAddr());
   rpc_controller->SetMsgId(req_protocol->m_msg_id);
 
   RunTime::GetRunTime()->m_msgid = req_protocol->m_msg_id;
-  RunTime::GetRunTime()->m_method_name = method_name;  
+  RunTime::GetRunTime()->m_method_name = entry->method->name();
 
-  RpcClosure* closure = new RpcClosure(nullptr, [req_msg, resp_msg, req_protocol, resp_protocol, connection, rpc_controller, this]() mutable {
-    if (!resp_msg->SerializeToString(&(resp_protocol->m_pb_data))) {
+  // 方法可能在业务线程中执行, 也可能由业务代码在别的线程中完成, 闭包持有连接, 保证回包时连接还在
+  TcpConnection::s_ptr conn = connection->shared_from_this();
+
+  RpcClosure* closure = new RpcClosure(nullptr, [req_msg, resp_msg, req_protocol, resp_protocol, conn, entry, this]() mutable {
+    if (resp_protocol->m_err_code != 0) {
+      // 执行之前就被拒绝了, 直接回复错误, 为这个请求创建的对象随 arena 一起释放
+    } else if (!resp_msg->IsInitialized()) {
+      // 不在这里序列化, 由 encode 直接序列化到连接的 out_buffer 中, 这里只检查能否序列化
       ERRORLOG("%s | serialize error, origin message [%s]", req_protocol->m_msg_id.c_str(), req_msg->ShortDebugString().c_str());
       setTinyPBError(resp_protocol, ERROR_FAILED_SERIALIZE, "serialize error");
     } else {
+      resp_protocol->m_pb_message = resp_msg;
       resp_protocol->m_err_code = 0;
       resp_protocol->m_err_info = "";
       INFOLOG("%s | dispatch success, request[%s], response[%s]", req_protocol->m_msg_id.c_str(), req_msg->ShortDebugString().c_str(), resp_msg->ShortDebugString().c_str());
     }   
 
-    std::vector<AbstractProtocol::s_ptr> reply_messages;
-    reply_messages.emplace_back(resp_protocol);
-    connection->reply(reply_messages);
+    if (entry->max_concurrency > 0) {
+      entry->inflight.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    if (resp_protocol->m_arena) {
+      updateArenaHint(entry, resp_protocol->m_arena->SpaceUsed());
+    }
+
+    // 回包 encode 之后 arena 就被释放, 之后不能再访问 req_msg, resp_msg 和 controller
+    reply(conn, resp_protocol);
+  });
+
+  // 并发数在请求进入时就加上, 不论成功还是被拒绝都由 closure 减去
+  if (entry->max_concurrency > 0 && entry->inflight.fetch_add(1, std::memory_order_relaxed) >= entry->max_concurrency) {
+    ERRORLOG("%s | method[%s] reach max concurrency[%d], reject request", req_protocol->m_msg_id.c_str(), entry->full_name.c_str(), entry->max_concurrency);
+    reject(closure, resp_protocol, ERROR_SERVICE_BUSY, "method concurrency limit");
+    return;
+  }
+
+  ServiceRuntime* runtime = entry->runtime;
+  Codel* codel = runtime ? runtime->codel : NULL;
+  int64_t decode_time = req_protocol->m_decode_time;
+
+  if (runtime == NULL || runtime->pool == NULL) {
+    if (isOverloaded(codel, decode_time)) {
+      ERRORLOG("%s | service[%s] overloaded, queueing delay too long, reject request", req_protocol->m_msg_id.c_str(), entry->service->GetDescriptor()->full_name().c_str());
+      reject(closure, resp_protocol, ERROR_SERVER_OVERLOADED, "server overloaded");
+      return;
+    }
+    callMethod(entry, rpc_controller, req_msg, resp_msg, closure, deadline);
+    return;
+  }
 
-    // DELETE_RESOURCE(req_msg);
-    // DELETE_RESOURCE(resp_msg);
-    // DELETE_RESOURCE(rpc_controller);
+  // IO 线程只负责解包和反序列化, 方法交给该 service 的业务线程执行, 慢请求不会阻塞同一 IO 线程上的其他连接
+  bool rt = runtime->pool->submit([entry, rpc_controller, req_msg, resp_msg, closure, resp_protocol, codel, decode_time, deadline, this]() {
+    // 在队列里等得太久的请求不再执行, 调用方多半已经超时
+    if (isOverloaded(codel, decode_time)) {
+      ERRORLOG("%s | service[%s] overloaded, queueing delay too long, reject request", rpc_controller->GetMsgId().c_str(), entry->service->GetDescriptor()->full_name().c_str());
+      reject(closure, resp_protocol, ERROR_SERVER_OVERLOADED, "server overloaded");
+      return;
+    }
+    // 和分发前就已超时的请求一样, 回复 ERROR_RPC_DEADLINE_EXCEEDED
+    if (isExpired(deadline)) {
+      ERRORLOG("%s | request expired in worker queue, reject request", rpc_controller->GetMsgId().c_str());
+      reject(closure, resp_protocol, ERROR_RPC_DEADLINE_EXCEEDED, "deadline exceeded");
+      return;
+    }
+    callMethod(entry, rpc_controller, req_msg, resp_msg, closure, deadline);
   });
 
-  service->CallMethod(method, rpc_controller, req_msg, resp_msg, closure);
+  if (!rt) {
+    ERRORLOG("%s | worker queue of service[%s] is full, reject request", req_protocol->m_msg_id.c_str(), entry->service->GetDescriptor()->full_name().c_str());
+    reject(closure, resp_protocol, ERROR_SERVICE_BUSY, "service busy");
+  }
+}
+
+bool RpcDispatcher::isOverloaded(Codel* codel, int64_t decode_time) {
+  if (codel == NULL || decode_time == 0) {
+    return false;
+  }
+  int64_t now = getNowUs();
+  return codel->overloaded(now - decode_time, now);
+}
+
+size_t RpcDispatcher::getArenaStartBlockSize(MethodEntry* entry) {
+  // 比最近的平均用量多留 1/4, 大部分请求只需要一个 block; 没有统计时用 protobuf 的默认值
+  google::protobuf::ArenaOptions default_options;
+  int64_t avg_used = entry->arena_avg_used.load(std::memory_order_relaxed);
+  int64_t size = avg_used + avg_used / 4;
+  size = std::max(size, (int64_t)default_options.start_block_size);
+  size = std::min(size, (int64_t)g_max_arena_start_block_size);
+  return size;
+}
 
+void RpcDispatcher::updateArenaHint(MethodEntry* entry, int64_t used) {
+  // 滑动平均, 多个线程同时更新时丢掉一次更新也没有关系
+  int64_t avg_used = entry->arena_avg_used.load(std::memory_order_relaxed);
+  if (avg_used == 0) {
+    avg_used = used;
+  } else {
+    avg_used += (used - avg_used) / 8;
+  }
+  entry->arena_avg_used.store(avg_used, std::memory_order_relaxed);
+}
+
+bool RpcDispatcher::isExpired(int64_t deadline) {
+  return deadline != 0 && getNowUs() >= deadline;
+}
+
+void RpcDispatcher::callMethod(MethodEntry* entry, RpcController* controller,
+  google::protobuf::Message* request, google::protobuf::Message* response, RpcClosure* done, int64_t deadline) {
+  RunTime* run_time = RunTime::GetRunTime();
+  run_time->m_msgid = controller->GetMsgId();
+  run_time->m_method_name = entry->method->name();
+  run_time->m_deadline = deadline;
+
+  entry->service->CallMethod(entry->method, controller, request, response, done);
+
+  // 方法返回之后当前线程不再处理这个请求, 之后在这个线程里发起的调用不受它的截止时间限制
+  run_time->m_deadline = 0;
+}
+
+void RpcDispatcher::reject(RpcClosure* closure, std::shared_ptr<TinyPBProtocol> message, int32_t err_code, const std::string& err_info) {
+  setTinyPBError(message, err_code, err_info);
+  closure->Run();
+  delete closure;
+}
+
+void RpcDispatcher::reply(TcpConnection::s_ptr connection, std::shared_ptr<TinyPBProtocol> message) {
+  EventLoop* event_loop = connection->getEventLoop();
+  if (event_loop->isInLoopThread()) {
+    std::vector<AbstractProtocol::s_ptr> reply_messages;
+    reply_messages.emplace_back(message);
+    connection->reply(reply_messages);
+    return;
+  }
+
+  // 在业务线程中完成的调用, 由 IO 线程 encode 并发送, 连接的缓冲区只在 IO 线程中访问
+  event_loop->addTask([connection, message]() {
+    std::vector<AbstractProtocol::s_ptr> reply_messages;
+    reply_messages.emplace_back(message);
+    connection->reply(reply_messages);
+  }, true);
 }
 
 bool RpcDispatcher::parseServiceFullName(const std::string& full_name, std::string& service_name, std::string& method_name) {
@@ -127,8 +282,115 @@ bool RpcDispatcher::parseServiceFullName(const std::string& full_name, std::stri
 }
 
 void RpcDispatcher::registerService(service_s_ptr service) {
-  std::string service_name = service->GetDescriptor()->full_name();
+  const google::protobuf::ServiceDescriptor* descriptor = service->GetDescriptor();
+  std::string service_name = descriptor->full_name();
+  if (m_service_map.find(service_name) != m_service_map.end()) {
+    ERRORLOG("service[%s] already registered, ignore it", service_name.c_str());
+    return;
+  }
   m_service_map[service_name] = service;
+
+  const RpcServiceConfig* service_config = NULL;
+  Config* config = Config::GetGlobalConfig();
+  if (config) {
+    auto it = config->m_rpc_services.find(service_name);
+    if (it != config->m_rpc_services.end()) {
+      service_config = &it->second;
+    }
+  }
+
+  // 只有配置了的 service 才有业务线程池和过载保护
+  ServiceRuntime* runtime = NULL;
+  if (service_config) {
+    runtime = new ServiceRuntime();
+    if (service_config->worker_threads > 0) {
+      runtime->pool = new WorkerPool(service_name, service_config->worker_threads, service_config->queue_size);
+      runtime->pool->start();
+    }
+    if (service_config->codel_target > 0) {
+      runtime->codel = new Codel(service_config->codel_target * 1000LL, service_config->codel_interval * 1000LL);
+    }
+  }
+
+  // 每个 method 的分发信息在注册时一次性算好, 之后 dispatch 只读, 不需要加锁
+  for (int i = 0; i < descriptor->method_count(); ++i) {
+    const google::protobuf::MethodDescriptor* method = descriptor->method(i);
+    MethodEntry* entry = new MethodEntry();
+    entry->full_name = method->full_name();
+    entry->hash = hashMethodName(entry->full_name);
+    entry->service = service.get();
+    entry->method = method;
+    entry->request_prototype = &service->GetRequestPrototype(method);
+    entry->response_prototype = &service->GetResponsePrototype(method);
+    entry->runtime = runtime;
+    if (service_config) {
+      auto limit_it = service_config->method_max_concurrency.find(method->name());
+      if (limit_it != service_config->method_max_concurrency.end()) {
+        entry->max_concurrency = limit_it->second;
+      }
+    }
+    m_method_entries.push_back(entry);
+  }
+
+  rebuildMethodTable();
+}
+
+uint64_t RpcDispatcher::hashMethodName(const std::string& full_name) {
+  // FNV-1a
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < full_name.length(); ++i) {
+    hash ^= (unsigned char)full_name[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+void RpcDispatcher::rebuildMethodTable() {
+  // 槽数取 2 的幂并且不少于 method 数的 4 倍, 线性探测时绝大多数查找第一个槽就命中
+  size_t size = 16;
+  while (size < m_method_entries.size() * 4) {
+    size <<= 1;
+  }
+  m_method_slots.assign(size, MethodSlot());
+  m_method_slot_mask = size - 1;
+
+  std::vector<std::string> method_names;
+  for (size_t i = 0; i < m_method_entries.size(); ++i) {
+    MethodEntry* entry = m_method_entries[i];
+    size_t index = entry->hash & m_method_slot_mask;
+    while (m_method_slots[index].entry != NULL) {
+      index = (index + 1) & m_method_slot_mask;
+    }
+    m_method_slots[index].hash = entry->hash;
+    m_method_slots[index].entry = entry;
+    method_names.push_back(entry->full_name);
+  }
+
+  // method id 就是 entry 在 m_method_entries 中的下标, 注册之后不会改变
+  TinyPBCoder::encodeMethodTable(method_names, m_handshake_data);
+}
+
+RpcDispatcher::MethodEntry* RpcDispatcher::findMethodById(int32_t method_id) {
+  if (method_id < 0 || method_id >= (int32_t)m_method_entries.size()) {
+    return NULL;
+  }
+  return m_method_entries[method_id];
+}
+
+RpcDispatcher::MethodEntry* RpcDispatcher::findMethod(const std::string& full_name) {
+  if (m_method_slots.empty()) {
+    return NULL;
+  }
+  uint64_t hash = hashMethodName(full_name);
+  size_t index = hash & m_method_slot_mask;
+  while (m_method_slots[index].entry != NULL) {
+    const MethodSlot& slot = m_method_slots[index];
+    if (slot.hash == hash && slot.entry->full_name == full_name) {
+      return slot.entry;
+    }
+    index = (index + 1) & m_method_slot_mask;
+  }
+  return NULL;
 }
 
 void RpcDispatcher::setTinyPBError(std::shared_ptr<TinyPBProtocol> msg, int32_t err_code, const std::string err_info) {
@@ -2,14 +2,20 @@
 #define ROCKET_RPC_NET_RPC_RPC_DISPATCHER_H
 
 #include <map>
+#include <vector>
+#include <atomic>
 #include <memory>
 #include <google/protobuf/service.h>
 #include "rocket/net/coder/abstract_protocol.h"
 #include "rocket/net/coder/tinypb_protocol.h"
+#include "rocket/net/worker_pool.h"
+#include "rocket/common/codel.h"
 
 namespace rocket_rpc {
 
 class TcpConnection;
+class RpcClosure;
+class RpcController;
 
 class RpcDispatcher {
 
@@ -23,6 +29,7 @@ class RpcDispatcher {
 
     void dispatch(AbstractProtocol::s_ptr request, AbstractProtocol::s_ptr response, TcpConnection* connection);
 
+    // 根据配置创建 service 的业务线程池和过载保护
     void registerService(service_s_ptr service);
 
     void setTinyPBError(std::shared_ptr<TinyPBProtocol> msg, int32_t err_code, const std::string err_info);
@@ -30,8 +37,76 @@ class RpcDispatcher {
   private:
     bool parseServiceFullName(const std::string& full_name, std::string& service_name, std::string& method_name);
 
+    // 回包交给连接所在的 IO 线程发送, 可以在任意线程调用
+    void reply(std::shared_ptr<TcpConnection> connection, std::shared_ptr<TinyPBProtocol> message);
+
+    // 根据请求的排队时间判断是否要拒绝, codel 为空时不拒绝
+    bool isOverloaded(Codel* codel, int64_t decode_time);
+
+    // deadline 为 0 表示没有截止时间, 不会过期
+    bool isExpired(int64_t deadline);
+
+    struct MethodEntry;
+
+    // 设置当前线程的 RunTime 之后执行方法, deadline 为请求的截止时间(单调时钟, us)
+    void callMethod(MethodEntry* entry, RpcController* controller,
+      google::protobuf::Message* request, google::protobuf::Message* response, RpcClosure* done, int64_t deadline);
+
+    // 根据这个 method 最近的请求实际用掉的 arena 内存决定新请求 arena 第一个 block 的大小
+    size_t getArenaStartBlockSize(MethodEntry* entry);
+
+    void updateArenaHint(MethodEntry* entry, int64_t used);
+
+    static uint64_t hashMethodName(const std::string& full_name);
+
+    // 按 method 全名查分发表, 找不到时返回 NULL
+    MethodEntry* findMethod(const std::string& full_name);
+
+    // 按握手时下发的 method id 查找, 找不到时返回 NULL
+    MethodEntry* findMethodById(int32_t method_id);
+
+    // 注册 service 之后重建分发表以及握手回包
+    void rebuildMethodTable();
+
+    // 请求在执行之前被拒绝, 通过 closure 回复错误并释放为请求创建的对象
+    void reject(RpcClosure* closure, std::shared_ptr<TinyPBProtocol> message, int32_t err_code, const std::string& err_info);
+
+  private:
+    // service 的执行方式和过载保护, 注册时根据配置创建, 没有配置的 service 没有
+    struct ServiceRuntime {
+      WorkerPool* pool {NULL};    // 为空时直接在 IO 线程中执行
+      Codel* codel {NULL};        // 为空时不检查排队时间
+    };
+
+    // 一个 method 分发时需要的所有信息, 注册时创建, 之后不再释放
+    struct MethodEntry {
+      std::string full_name;
+      uint64_t hash {0};
+      google::protobuf::Service* service {NULL};
+      const google::protobuf::MethodDescriptor* method {NULL};
+      const google::protobuf::Message* request_prototype {NULL};
+      const google::protobuf::Message* response_prototype {NULL};
+      ServiceRuntime* runtime {NULL};
+
+      int max_concurrency {0};                  // 0 表示不限制
+      std::atomic<int> inflight {0};            // 排队中和执行中的请求数
+      std::atomic<int64_t> arena_avg_used {0};  // 每个请求的 arena 实际用掉的内存的滑动平均(字节)
+    };
+
+    // 开放寻址的哈希表槽, 比较时先比 hash, 命中之后才比较字符串
+    struct MethodSlot {
+      uint64_t hash {0};
+      MethodEntry* entry {NULL};
+    };
+
   private:
     std::map<std::string, service_s_ptr> m_service_map;
+
+    std::vector<MethodEntry*> m_method_entries;
+    std::vector<MethodSlot> m_method_slots;
+    size_t m_method_slot_mask {0};
+
+    std::string m_handshake_data;   // 握手回包的内容, 所有方法的 id, 注册 service 之后重新生成
 };
 
 }
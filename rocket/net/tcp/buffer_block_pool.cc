@@ -0,0 +1,180 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include "rocket/net/tcp/buffer_block_pool.h"
+#include "rocket/common/mutex.h"
+#include "rocket/common/config.h"
+#include "rocket/common/log.h"
+
+namespace rocket_rpc {
+
+const int BufferBlockPool::BLOCK_SIZE;
+
+static thread_local BufferBlockPool* t_buffer_block_pool = NULL;
+
+// 所有线程的 block 池, 只用于汇总统计, 池随线程创建后不会释放
+static std::vector<BufferBlockPool*> g_buffer_block_pools;
+static Mutex g_buffer_block_pools_mutex;
+
+// 每个线程的空闲链表默认最多缓存 1MB
+static int g_default_max_free_blocks = 256;
+
+// -1 表示还没有确定
+static int g_use_hugepage = -1;
+
+// 大页区域的大小
+static const size_t g_hugepage_region_size = 2 * 1024 * 1024;
+
+// hugepage 模式下各线程空闲链表放不下的 block, 由所有线程共享
+static std::vector<char*> g_shared_free_blocks;
+static Mutex g_shared_free_blocks_mutex;
+
+BufferBlockPool* BufferBlockPool::GetBufferBlockPool() {
+  if (t_buffer_block_pool) {
+    return t_buffer_block_pool;
+  }
+
+  Config* config = Config::GetGlobalConfig();
+  int max_free_blocks = config ? config->m_buffer_max_free_blocks : g_default_max_free_blocks;
+
+  ScopeMutex<Mutex> lock(g_buffer_block_pools_mutex);
+  // block 会在线程之间流动, 所以是否使用大页必须在进程内统一, 以第一个池创建时的配置为准
+  if (g_use_hugepage == -1) {
+    g_use_hugepage = (config && config->m_buffer_hugepage) ? 1 : 0;
+  }
+  t_buffer_block_pool = new BufferBlockPool(max_free_blocks, g_use_hugepage == 1);
+  g_buffer_block_pools.push_back(t_buffer_block_pool);
+  return t_buffer_block_pool;
+}
+
+void BufferBlockPool::GetGlobalStats(BufferBlockPoolStats& stats) {
+  stats = BufferBlockPoolStats();
+  ScopeMutex<Mutex> lock(g_buffer_block_pools_mutex);
+  for (size_t i = 0; i < g_buffer_block_pools.size(); ++i) {
+    BufferBlockPoolStats tmp;
+    g_buffer_block_pools[i]->getStats(tmp);
+    stats.alloc_count += tmp.alloc_count;
+    stats.hit_count += tmp.hit_count;
+    stats.free_blocks += tmp.free_blocks;
+    stats.resident_bytes += tmp.resident_bytes;
+  }
+  lock.unlock();
+
+  ScopeMutex<Mutex> shared_lock(g_shared_free_blocks_mutex);
+  stats.free_blocks += g_shared_free_blocks.size();
+}
+
+BufferBlockPool::BufferBlockPool(int max_free_blocks, bool use_hugepage)
+  : m_max_free_blocks(max_free_blocks), m_use_hugepage(use_hugepage) {
+  m_free_blocks.reserve(max_free_blocks);
+}
+
+BufferBlockPool::~BufferBlockPool() {
+  // 大页区域中的 block 不能单独 free
+  if (!m_use_hugepage) {
+    for (size_t i = 0; i < m_free_blocks.size(); ++i) {
+      free(m_free_blocks[i]);
+    }
+  }
+  m_free_blocks.clear();
+}
+
+char* BufferBlockPool::allocate() {
+  increase(m_alloc_count, 1);
+  if (m_free_blocks.empty() && m_use_hugepage) {
+    fetchSharedBlocks();
+  }
+  if (!m_free_blocks.empty()) {
+    char* block = m_free_blocks.back();
+    m_free_blocks.pop_back();
+    increase(m_hit_count, 1);
+    increase(m_free_blocks_count, -1);
+    return block;
+  }
+
+  if (m_use_hugepage) {
+    return allocateFromRegion();
+  }
+  increase(m_resident_bytes, BLOCK_SIZE);
+  return reinterpret_cast<char*>(malloc(BLOCK_SIZE));
+}
+
+void BufferBlockPool::deallocate(char* block) {
+  if (block == NULL) {
+    return;
+  }
+  if ((int)m_free_blocks.size() < m_max_free_blocks) {
+    m_free_blocks.push_back(block);
+    increase(m_free_blocks_count, 1);
+    return;
+  }
+  if (m_use_hugepage) {
+    // 大页区域中的 block 不能单独 free, 连同空闲链表的后一半一起放入共享链表, 一次加锁移动一批
+    int move_count = m_max_free_blocks / 2;
+    ScopeMutex<Mutex> lock(g_shared_free_blocks_mutex);
+    g_shared_free_blocks.push_back(block);
+    g_shared_free_blocks.insert(g_shared_free_blocks.end(), m_free_blocks.end() - move_count, m_free_blocks.end());
+    lock.unlock();
+    m_free_blocks.resize(m_free_blocks.size() - move_count);
+    increase(m_free_blocks_count, -move_count);
+    return;
+  }
+  increase(m_resident_bytes, -BLOCK_SIZE);
+  free(block);
+}
+
+void BufferBlockPool::fetchSharedBlocks() {
+  // 取回的数量与放入时一致, 取回之后还有一半的空间, 不会马上又被放回去
+  int fetch_count = std::max(m_max_free_blocks / 2, 1);
+  ScopeMutex<Mutex> lock(g_shared_free_blocks_mutex);
+  fetch_count = std::min(fetch_count, (int)g_shared_free_blocks.size());
+  m_free_blocks.insert(m_free_blocks.end(), g_shared_free_blocks.end() - fetch_count, g_shared_free_blocks.end());
+  g_shared_free_blocks.resize(g_shared_free_blocks.size() - fetch_count);
+  lock.unlock();
+  increase(m_free_blocks_count, fetch_count);
+}
+
+char* BufferBlockPool::allocateFromRegion() {
+  if (m_region_cur == m_region_end) {
+    // 优先使用预留的大页, 没有预留时退回普通映射, 按 2MB 对齐后交给透明大页
+    void* region = mmap(NULL, g_hugepage_region_size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (region == MAP_FAILED) {
+      size_t map_size = 2 * g_hugepage_region_size;
+      char* addr = reinterpret_cast<char*>(mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+      if (addr == MAP_FAILED) {
+        ERRORLOG("failed to mmap buffer region, errno=%d, fallback to malloc", errno);
+        increase(m_resident_bytes, BLOCK_SIZE);
+        return reinterpret_cast<char*>(malloc(BLOCK_SIZE));
+      }
+      char* aligned = reinterpret_cast<char*>(((uintptr_t)addr + g_hugepage_region_size - 1) & ~(uintptr_t)(g_hugepage_region_size - 1));
+      if (aligned > addr) {
+        munmap(addr, aligned - addr);
+      }
+      char* aligned_end = aligned + g_hugepage_region_size;
+      if (addr + map_size > aligned_end) {
+        munmap(aligned_end, addr + map_size - aligned_end);
+      }
+      madvise(aligned, g_hugepage_region_size, MADV_HUGEPAGE);
+      region = aligned;
+    }
+    m_region_cur = reinterpret_cast<char*>(region);
+    m_region_end = m_region_cur + g_hugepage_region_size;
+    increase(m_resident_bytes, g_hugepage_region_size);
+  }
+
+  char* block = m_region_cur;
+  m_region_cur += BLOCK_SIZE;
+  return block;
+}
+
+void BufferBlockPool::getStats(BufferBlockPoolStats& stats) {
+  stats.alloc_count = m_alloc_count.load(std::memory_order_relaxed);
+  stats.hit_count = m_hit_count.load(std::memory_order_relaxed);
+  stats.free_blocks = m_free_blocks_count.load(std::memory_order_relaxed);
+  stats.resident_bytes = m_resident_bytes.load(std::memory_order_relaxed);
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,77 @@
+#ifndef ROCKET_RPC_NET_TCP_BUFFER_BLOCK_POOL_H
+#define ROCKET_RPC_NET_TCP_BUFFER_BLOCK_POOL_H
+
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+
+namespace rocket_rpc {
+
+struct BufferBlockPoolStats {
+  int64_t alloc_count {0};      // allocate 次数
+  int64_t hit_count {0};        // 其中直接从空闲链表拿到 block 的次数
+  int64_t free_blocks {0};      // 空闲链表中的 block 数
+  int64_t resident_bytes {0};   // 从系统申请且尚未归还的字节数(包括正在使用的和空闲链表中的)
+
+  double hitRate() const {
+    return alloc_count == 0 ? 0 : (double)hit_count / alloc_count;
+  }
+};
+
+// TcpBuffer 使用的固定大小内存块池, 每个线程一个, 分配和释放都不加锁
+// 释放的 block 放回当前线程的空闲链表(不一定是分配它的那个线程), 超过上限的部分直接还给系统
+// 开启 hugepage 时 block 从 2MB 的大页区域中切分, 区域不会还给系统
+// 这时超过上限的 block 不能 free, 改为放入进程共享的空闲链表, 各线程的空闲链表用完时先从那里取, 再切新的区域
+class BufferBlockPool {
+  public:
+    static const int BLOCK_SIZE = 4096;
+
+  public:
+    BufferBlockPool(int max_free_blocks, bool use_hugepage);
+
+    ~BufferBlockPool();
+
+    // 返回一个 BLOCK_SIZE 大小的 block
+    char* allocate();
+
+    void deallocate(char* block);
+
+    void getStats(BufferBlockPoolStats& stats);
+
+  public:
+    // 返回当前线程的 block 池, 第一次调用时创建
+    static BufferBlockPool* GetBufferBlockPool();
+
+    // 汇总所有线程的 block 池
+    // 由于 block 可能在其他线程释放, 单个池的 resident_bytes 不一定准确, 汇总值是准确的
+    static void GetGlobalStats(BufferBlockPoolStats& stats);
+
+  private:
+    // 从大页区域切一个 block, 当前区域用完时申请新的区域
+    char* allocateFromRegion();
+
+    // 从共享的空闲链表取一批 block 放到当前线程的空闲链表, 只在 hugepage 模式下使用
+    void fetchSharedBlocks();
+
+    // 只有所属线程会修改计数, 其他线程只读, 所以不需要原子的加法
+    static void increase(std::atomic<int64_t>& counter, int64_t value) {
+      counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+  private:
+    std::vector<char*> m_free_blocks;
+    int m_max_free_blocks {0};
+
+    bool m_use_hugepage {false};
+    char* m_region_cur {NULL};
+    char* m_region_end {NULL};
+
+    std::atomic<int64_t> m_alloc_count {0};
+    std::atomic<int64_t> m_hit_count {0};
+    std::atomic<int64_t> m_free_blocks_count {0};
+    std::atomic<int64_t> m_resident_bytes {0};
+};
+
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,95 @@
+#include <errno.h>
+#include <sys/mman.h>
+#include "rocket/net/tcp/fixed_block_region.h"
+#include "rocket/net/tcp/buffer_block_pool.h"
+#include "rocket/common/log.h"
+
+namespace rocket_rpc {
+
+FixedBlockRegion::FixedBlockRegion(int block_count) {
+  // 连续的 block 不跨 word 分配, 所以按 64 个一组向上取整
+  m_word_count = (block_count + 63) / 64;
+  m_block_count = m_word_count * 64;
+
+  void* base = mmap(NULL, getSize(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (base == MAP_FAILED) {
+    ERRORLOG("failed to mmap fixed block region, size[%zu], errno=%d", getSize(), errno);
+    return;
+  }
+  m_base = reinterpret_cast<char*>(base);
+
+  m_used = new std::atomic<uint64_t>[m_word_count];
+  for (int i = 0; i < m_word_count; ++i) {
+    m_used[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+FixedBlockRegion::~FixedBlockRegion() {
+  if (m_base == NULL) {
+    return;
+  }
+  // 还有 block 在 TcpBuffer 中时内存不归还
+  for (int i = 0; i < m_word_count; ++i) {
+    if (m_used[i].load(std::memory_order_acquire) != 0) {
+      return;
+    }
+  }
+  munmap(m_base, getSize());
+  delete[] m_used;
+}
+
+size_t FixedBlockRegion::getSize() const {
+  return (size_t)m_block_count * BufferBlockPool::BLOCK_SIZE;
+}
+
+int FixedBlockRegion::claim(int word, int count) {
+  uint64_t mask = count == 64 ? ~0ULL : ((1ULL << count) - 1);
+  uint64_t used = m_used[word].load(std::memory_order_relaxed);
+  while (true) {
+    // runs 中为 1 的位表示从这一位开始有 count 个连续的空闲位
+    uint64_t free_bits = ~used;
+    uint64_t runs = free_bits;
+    for (int i = 1; i < count && runs != 0; ++i) {
+      runs &= free_bits >> i;
+    }
+    if (runs == 0) {
+      return -1;
+    }
+    int bit = __builtin_ctzll(runs);
+    // 只有 loop 线程会占用, 其他线程只会释放, CAS 失败时用新值重新查找
+    if (m_used[word].compare_exchange_weak(used, used | (mask << bit), std::memory_order_acquire, std::memory_order_relaxed)) {
+      return bit;
+    }
+  }
+}
+
+char* FixedBlockRegion::allocate(int& count) {
+  if (m_base == NULL || count <= 0) {
+    count = 0;
+    return NULL;
+  }
+  if (count > 64) {
+    count = 64;
+  }
+  // 找不到足够长的连续空间时减半再找, 最少一个 block
+  for (int want = count; want >= 1; want /= 2) {
+    for (int i = 0; i < m_word_count; ++i) {
+      int word = (m_next_word + i) % m_word_count;
+      int bit = claim(word, want);
+      if (bit >= 0) {
+        m_next_word = word;
+        count = want;
+        return m_base + ((size_t)word * 64 + bit) * BufferBlockPool::BLOCK_SIZE;
+      }
+    }
+  }
+  count = 0;
+  return NULL;
+}
+
+void FixedBlockRegion::deallocate(char* block) {
+  size_t index = (block - m_base) / BufferBlockPool::BLOCK_SIZE;
+  m_used[index / 64].fetch_and(~(1ULL << (index % 64)), std::memory_order_release);
+}
+
+}
\ No newline at end of file
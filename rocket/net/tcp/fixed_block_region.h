@@ -0,0 +1,56 @@
+#ifndef ROCKET_RPC_NET_TCP_FIXED_BLOCK_REGION_H
+#define ROCKET_RPC_NET_TCP_FIXED_BLOCK_REGION_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace rocket_rpc {
+
+// 一块连续的内存, 切成 BufferBlockPool::BLOCK_SIZE 大小的 block, 由 IoUringPoller 注册为 io_uring 的固定缓冲区
+// 连接的 in_buffer 从这里分配 block 时可以使用 READ_FIXED, 内核不需要每次读都重新映射用户内存
+// 一次可以分配多个地址连续的 block, 用一次读填满, 之后每个 block 单独归还
+// 只在 loop 线程分配, 但 block 可能随 TcpBuffer 在其他线程释放, 所以空闲位图是原子的
+// block 可能在 poller 销毁之后才被释放, 所以 poller 不删除区域, 只有全部 block 都空闲时析构才归还内存
+class FixedBlockRegion {
+
+  public:
+    explicit FixedBlockRegion(int block_count);
+
+    ~FixedBlockRegion();
+
+    bool isValid() const {
+      return m_base != NULL;
+    }
+
+    char* getBase() const {
+      return m_base;
+    }
+
+    size_t getSize() const;
+
+    // 分配最多 count 个地址连续的 block, 实际分配的个数通过 count 返回, 没有空闲 block 时返回 NULL
+    char* allocate(int& count);
+
+    void deallocate(char* block);
+
+    bool contains(const char* p, int size) const {
+      return p >= m_base && p + size <= m_base + getSize();
+    }
+
+  private:
+    // 在 word 中找 count 个连续的空闲位并占用, 成功返回起始位
+    int claim(int word, int count);
+
+  private:
+    char* m_base {NULL};
+    int m_block_count {0};
+    int m_word_count {0};
+    int m_next_word {0};          // 下次开始查找的位置, 只有 loop 线程访问
+
+    std::atomic<uint64_t>* m_used {NULL};   // 每一位代表一个 block 是否在使用
+};
+
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,62 @@
+#include <atomic>
+#include "rocket/net/tcp/inflight_table.h"
+
+namespace rocket_rpc {
+
+static std::atomic<int64_t> g_inflight_size {0};
+static std::atomic<int64_t> g_inflight_discard {0};
+
+InflightTable::InflightTable() {
+}
+
+InflightTable::~InflightTable() {
+  g_inflight_size.fetch_sub(m_dones.size(), std::memory_order_relaxed);
+}
+
+void InflightTable::add(const std::string& msg_id, Done done) {
+  size_t before = m_dones.size();
+  m_dones[msg_id] = std::move(done);
+  g_inflight_size.fetch_add(m_dones.size() - before, std::memory_order_relaxed);
+}
+
+bool InflightTable::take(const std::string& msg_id, Done& done) {
+  auto it = m_dones.find(msg_id);
+  if (it == m_dones.end()) {
+    return false;
+  }
+  done = std::move(it->second);
+  m_dones.erase(it);
+  g_inflight_size.fetch_sub(1, std::memory_order_relaxed);
+  return true;
+}
+
+bool InflightTable::remove(const std::string& msg_id) {
+  if (m_dones.erase(msg_id) == 0) {
+    return false;
+  }
+  g_inflight_size.fetch_sub(1, std::memory_order_relaxed);
+  return true;
+}
+
+bool InflightTable::acceptResponse(const char* msg_id, int msg_id_len) {
+  m_lookup_key.assign(msg_id, msg_id_len);
+  if (m_dones.find(m_lookup_key) != m_dones.end()) {
+    return true;
+  }
+  g_inflight_discard.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+int InflightTable::size() {
+  return m_dones.size();
+}
+
+int64_t InflightTable::GetGlobalSize() {
+  return g_inflight_size.load(std::memory_order_relaxed);
+}
+
+int64_t InflightTable::GetGlobalDiscardCount() {
+  return g_inflight_discard.load(std::memory_order_relaxed);
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,53 @@
+#ifndef ROCKET_RPC_NET_TCP_INFLIGHT_TABLE_H
+#define ROCKET_RPC_NET_TCP_INFLIGHT_TABLE_H
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include "rocket/common/inline_function.h"
+#include "rocket/net/coder/abstract_protocol.h"
+
+namespace rocket_rpc {
+
+// 客户端连接上等待回包的调用, key 为 msg_id
+// 哈希表实现, 发出请求时加入, 收到回包, 超时或者取消时摘除, 都是 O(1)
+// 只在连接所在的 IO 线程中访问, 不加锁; 所有连接的在途调用总数以及丢弃的迟到回包数是全局计数, 任意线程可读
+class InflightTable {
+  public:
+    typedef InlineFunction<void(AbstractProtocol::s_ptr)> Done;
+
+    InflightTable();
+
+    // 没有等到回包的调用随连接一起销毁
+    ~InflightTable();
+
+    // 同一个 msg_id 已经在表中时覆盖
+    void add(const std::string& msg_id, Done done);
+
+    // 摘除 msg_id 对应的回调交给 done, 不存在时返回 false
+    bool take(const std::string& msg_id, Done& done);
+
+    // 超时或者取消时摘除, 不存在时返回 false
+    bool remove(const std::string& msg_id);
+
+    // decode 时在帧级别判断是否还有调用在等这个回包, 不构造 message, 也不拷贝包体
+    // 返回 false 时计为一次丢弃
+    bool acceptResponse(const char* msg_id, int msg_id_len);
+
+    int size();
+
+  public:
+    static int64_t GetGlobalSize();
+
+    // 调用已经超时或者被取消之后才到达, 在解析 protobuf 之前被丢弃的回包数
+    static int64_t GetGlobalDiscardCount();
+
+  private:
+    std::unordered_map<std::string, Done> m_dones;
+
+    std::string m_lookup_key;   // acceptResponse 复用的 key, 避免每一帧都申请内存
+};
+
+}
+
+#endif
\ No newline at end of file
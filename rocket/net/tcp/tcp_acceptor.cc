@@ -68,4 +68,25 @@ std::pair<int, NetAddr::s_ptr> TcpAcceptor::accept() {
   }
 }
 
+sockaddr* TcpAcceptor::prepareAccept(socklen_t** addr_len) {
+  memset(&m_accept_addr, 0, sizeof(m_accept_addr));
+  m_accept_addr_len = sizeof(m_accept_addr);
+  *addr_len = &m_accept_addr_len;
+  return reinterpret_cast<sockaddr*>(&m_accept_addr);
+}
+
+std::pair<int, NetAddr::s_ptr> TcpAcceptor::onAccepted(int client_fd) {
+  if (client_fd < 0) {
+    ERRORLOG("accept error, errno=%d error=%s", -client_fd, strerror(-client_fd));
+    return std::make_pair(-1, nullptr);
+  }
+  if (m_family != AF_INET) {
+    // ... 其它协议
+    return std::make_pair(client_fd, nullptr);
+  }
+  IPNetAddr::s_ptr peer_addr = std::make_shared<IPNetAddr>(m_accept_addr);
+  INFOLOG("A client have accepted succ, peer addr [%s]", peer_addr->toString().c_str());
+  return std::make_pair(client_fd, peer_addr);
+}
+
 }
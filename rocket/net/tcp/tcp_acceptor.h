@@ -2,6 +2,7 @@
 #define ROCKET_RPC_NET_TCP_TCP_ACCEPTOR_H
 
 #include <memory>
+#include <netinet/in.h>
 #include "rocket/net/tcp/net_addr.h"
 
 namespace rocket_rpc {
@@ -16,6 +17,12 @@ class TcpAcceptor {
 
     std::pair<int, NetAddr::s_ptr> accept();
 
+    // 完成模式(io_uring)的 accept 由 poller 提交, 这里提供对端地址的缓冲区, accept 完成之前不能再次调用
+    sockaddr* prepareAccept(socklen_t** addr_len);
+
+    // accept 完成之后用结果(新连接的 fd, 失败时为 -errno)构造对端地址
+    std::pair<int, NetAddr::s_ptr> onAccepted(int client_fd);
+
     int getListenFd();
 
   private:
@@ -24,6 +31,9 @@ class TcpAcceptor {
     int m_family {-1};
 
     int m_listenfd {-1}; // 监听套接字
+
+    sockaddr_in m_accept_addr;
+    socklen_t m_accept_addr_len {0};
 };
 
 }
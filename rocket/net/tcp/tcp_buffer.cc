@@ -1,43 +1,81 @@
 #include <string.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include <algorithm>
 #include "rocket/net/tcp/tcp_buffer.h"
+#include "rocket/net/tcp/buffer_block_pool.h"
+#include "rocket/net/tcp/fixed_block_region.h"
 #include "rocket/common/log.h"
 
 namespace rocket_rpc {
 
-TcpBuffer::TcpBuffer(int size) : m_size(size) {
-  m_buffer.resize(size);
+// readv 时栈上溢出区的大小
+static const int g_read_extra_buffer_size = 65536;
+
+// 单次 writev 最多使用的 block 数
+static const int g_max_write_iov = 64;
+
+TcpBuffer::TcpBuffer() {
 }
 
 TcpBuffer::~TcpBuffer() {
+  for (auto it = m_blocks.begin(); it != m_blocks.end(); ++it) {
+    releaseBlock(*it);
+  }
+  m_blocks.clear();
+}
 
+TcpBuffer::Block TcpBuffer::newBlock() {
+  Block block;
+  block.data = BufferBlockPool::GetBufferBlockPool()->allocate();
+  return block;
 }
 
-// 返回可读字节数
-int TcpBuffer::readAble() {
-  return m_write_index - m_read_index;
+void TcpBuffer::releaseBlock(Block& block) {
+  if (block.region) {
+    block.region->deallocate(block.data);
+  } else {
+    BufferBlockPool::GetBufferBlockPool()->deallocate(block.data);
+  }
+  block.data = NULL;
 }
 
-// 返回可写字节数
-int TcpBuffer::writeAble() {
-  return m_buffer.size() - m_write_index;
+// 返回可读字节数
+int TcpBuffer::readAble() {
+  return m_read_able;
 }
 
-int TcpBuffer::readIndex() {
-  return m_read_index;
+void TcpBuffer::writeToBuffer(const char* buf, int size) {
+  while (size > 0) {
+    if (m_blocks.empty() || m_blocks.back().write_index == BufferBlockPool::BLOCK_SIZE) {
+      m_blocks.push_back(newBlock());
+    }
+    Block& tail = m_blocks.back();
+    int count = std::min(size, BufferBlockPool::BLOCK_SIZE - tail.write_index);
+    memcpy(tail.data + tail.write_index, buf, count);
+    tail.write_index += count;
+    m_read_able += count;
+    buf += count;
+    size -= count;
+  }
 }
 
-int TcpBuffer::writeIndex() {
-  return m_write_index;
+char* TcpBuffer::getWriteSpace(int& size) {
+  if (m_blocks.empty() || m_blocks.back().write_index == BufferBlockPool::BLOCK_SIZE) {
+    m_blocks.push_back(newBlock());
+  }
+  Block& tail = m_blocks.back();
+  size = BufferBlockPool::BLOCK_SIZE - tail.write_index;
+  return tail.data + tail.write_index;
 }
 
-void TcpBuffer::writeToBuffer(const char* buf, int size) {
-  if (size > writeAble()) {
-    // 调整 buffer 的大小, 扩容
-    int new_size = (int)(1.5 * (m_write_index + size));
-    resizeBuffer(new_size);
+void TcpBuffer::moveWriteIndex(int size) {
+  if (m_blocks.empty() || size < 0 || size > BufferBlockPool::BLOCK_SIZE - m_blocks.back().write_index) {
+    ERRORLOG("moveWriteIndex error, invalid size %d", size);
+    return;
   }
-  memcpy(&m_buffer[m_write_index], buf, size);
-  m_write_index += size; // 更新可写下标
+  m_blocks.back().write_index += size;
+  m_read_able += size;
 }
 
 void TcpBuffer::readFromBuffer(std::vector<char>& re, int size) {
@@ -48,58 +86,258 @@ void TcpBuffer::readFromBuffer(std::vector<char>& re, int size) {
   int read_size = readAble() > size ? size : readAble();
 
   std::vector<char> tmp(read_size);
-  memcpy(&tmp[0], &m_buffer[m_read_index], read_size);
+  peek(&tmp[0], 0, read_size);
 
   re.swap(tmp);
-  m_read_index += read_size; // 更新可读下标
+  moveReadIndex(read_size);
+}
 
-  adjustBuffer();
+void TcpBuffer::moveReadIndex(int size) {
+  if (size > m_read_able) {
+    ERRORLOG("moveReadIndex error, invalid size %d, read able %d", size, m_read_able);
+    return;
+  }
+  m_read_able -= size;
+
+  while (size > 0 && !m_blocks.empty()) {
+    Block& head = m_blocks.front();
+    int count = std::min(size, head.write_index - head.read_index);
+    head.read_index += count;
+    size -= count;
+    // 读完的 block 立即归还
+    if (head.read_index == head.write_index) {
+      releaseBlock(head);
+      m_blocks.pop_front();
+    }
+  }
 }
 
-void TcpBuffer::resizeBuffer(int new_size) {
-  std::vector<char> tmp(new_size);
-  int count = std::min(new_size, readAble());
+void TcpBuffer::truncate(int size) {
+  if (size < 0 || size > m_read_able) {
+    ERRORLOG("truncate error, invalid size %d, read able %d", size, m_read_able);
+    return;
+  }
+  int drop = m_read_able - size;
+  m_read_able = size;
+
+  while (drop > 0 && !m_blocks.empty()) {
+    Block& tail = m_blocks.back();
+    int count = std::min(drop, tail.write_index - tail.read_index);
+    tail.write_index -= count;
+    drop -= count;
+    if (tail.read_index == tail.write_index) {
+      releaseBlock(tail);
+      m_blocks.pop_back();
+    }
+  }
+}
 
-  memcpy(&tmp[0], &m_buffer[m_read_index], count);
-  m_buffer.swap(tmp);
+int TcpBuffer::find(char c, int offset) {
+  int base = 0;
+  for (auto it = m_blocks.begin(); it != m_blocks.end(); ++it) {
+    int len = it->write_index - it->read_index;
+    if (offset < base + len) {
+      int begin = offset > base ? offset - base : 0;
+      const char* start = it->data + it->read_index;
+      const char* p = reinterpret_cast<const char*>(memchr(start + begin, c, len - begin));
+      if (p != NULL) {
+        return base + (p - start);
+      }
+    }
+    base += len;
+  }
+  return -1;
+}
 
-  m_read_index = 0;
-  m_write_index = m_read_index + count;
+bool TcpBuffer::peek(char* dst, int offset, int size) {
+  if (offset < 0 || size < 0 || offset + size > m_read_able) {
+    return false;
+  }
+  int base = 0;
+  for (auto it = m_blocks.begin(); it != m_blocks.end() && size > 0; ++it) {
+    int len = it->write_index - it->read_index;
+    if (offset < base + len) {
+      int begin = offset > base ? offset - base : 0;
+      int count = std::min(size, len - begin);
+      memcpy(dst, it->data + it->read_index + begin, count);
+      dst += count;
+      offset += count;
+      size -= count;
+    }
+    base += len;
+  }
+  return true;
 }
 
-void TcpBuffer::adjustBuffer() {
-  if (m_read_index < int(m_buffer.size() / 3)) {
-    return;
+const char* TcpBuffer::peekContiguous(int offset, int size, std::string& scratch) {
+  if (offset < 0 || size < 0 || offset + size > m_read_able) {
+    return NULL;
+  }
+  int base = 0;
+  for (auto it = m_blocks.begin(); it != m_blocks.end(); ++it) {
+    int len = it->write_index - it->read_index;
+    if (offset < base + len) {
+      if (offset + size <= base + len) {
+        return it->data + it->read_index + (offset - base);
+      }
+      break;
+    }
+    base += len;
+  }
+  scratch.resize(size);
+  peek(&scratch[0], offset, size);
+  return scratch.data();
+}
+
+int TcpBuffer::readFromFd(int fd, bool& is_read_all) {
+  char extra_buffer[g_read_extra_buffer_size];
+  iovec iov[3];
+  int iov_count = 0;
+
+  // 尾部 block 的剩余空间
+  int tail_free = 0;
+  if (!m_blocks.empty()) {
+    Block& tail = m_blocks.back();
+    tail_free = BufferBlockPool::BLOCK_SIZE - tail.write_index;
+    if (tail_free > 0) {
+      iov[iov_count].iov_base = tail.data + tail.write_index;
+      iov[iov_count].iov_len = tail_free;
+      iov_count ++ ;
+    }
   }
-  std::vector<char> buffer(m_buffer.size());
-  int count = readAble();
 
-  memcpy(&buffer[0], &m_buffer[m_read_index], count);
-  m_buffer.swap(buffer);
-  m_read_index = 0;
-  m_write_index = m_read_index + count;
+  Block block = newBlock();
+  iov[iov_count].iov_base = block.data;
+  iov[iov_count].iov_len = BufferBlockPool::BLOCK_SIZE;
+  iov_count ++ ;
+
+  iov[iov_count].iov_base = extra_buffer;
+  iov[iov_count].iov_len = sizeof(extra_buffer);
+  iov_count ++ ;
+
+  int total = tail_free + BufferBlockPool::BLOCK_SIZE + sizeof(extra_buffer);
+  int rt = readv(fd, iov, iov_count);
+  int saved_errno = errno;
+
+  is_read_all = false;
+  if (rt <= 0) {
+    releaseBlock(block);
+    errno = saved_errno;
+    return rt;
+  }
+  is_read_all = rt < total;
+
+  int left = rt;
+  if (tail_free > 0) {
+    int count = std::min(left, tail_free);
+    m_blocks.back().write_index += count;
+    m_read_able += count;
+    left -= count;
+  }
 
-  buffer.clear();
+  if (left > 0) {
+    int count = std::min(left, BufferBlockPool::BLOCK_SIZE);
+    block.write_index = count;
+    m_blocks.push_back(block);
+    m_read_able += count;
+    left -= count;
+  } else {
+    releaseBlock(block);
+  }
+
+  // 溢出到栈上的部分
+  if (left > 0) {
+    writeToBuffer(extra_buffer, left);
+  }
+
+  errno = saved_errno;
+  return rt;
 }
 
-void TcpBuffer::moveReadIndex(int size) {
-  size_t j = m_read_index + size;
-  if (j >= m_buffer.size()) {
-    ERRORLOG("moveReadIndex error, invalid size %d, old_read_index %d, buffer size %d", size, m_read_index, m_buffer.size());
-    return;
+int TcpBuffer::writeToFd(int fd) {
+  iovec iov[g_max_write_iov];
+  int iov_count = getReadIov(iov, g_max_write_iov);
+  if (iov_count == 0) {
+    return 0;
+  }
+
+  int rt = writev(fd, iov, iov_count);
+  int saved_errno = errno;
+  if (rt > 0) {
+    moveReadIndex(rt);
   }
-  m_read_index = j;
-  adjustBuffer();
+  errno = saved_errno;
+  return rt;
 }
 
-void TcpBuffer::moveWriteIndex(int size) {
-  size_t j = m_write_index + size;
-  if (j >= m_buffer.size()) {
-    ERRORLOG("moveWriteIndex error, invalid size %d, old_write_index %d, buffer size %d", size, m_read_index, m_buffer.size());
+int TcpBuffer::getReadIov(iovec* iov, int max_count) {
+  int iov_count = 0;
+  for (auto it = m_blocks.begin(); it != m_blocks.end() && iov_count < max_count; ++it) {
+    int len = it->write_index - it->read_index;
+    if (len == 0) {
+      continue;
+    }
+    iov[iov_count].iov_base = it->data + it->read_index;
+    iov[iov_count].iov_len = len;
+    iov_count ++ ;
+  }
+  return iov_count;
+}
+
+char* TcpBuffer::reserveRead(int block_count, FixedBlockRegion* region, int& size) {
+  m_reserved_blocks = 0;
+  if (!m_blocks.empty() && m_blocks.back().write_index < BufferBlockPool::BLOCK_SIZE) {
+    Block& tail = m_blocks.back();
+    size = BufferBlockPool::BLOCK_SIZE - tail.write_index;
+    return tail.data + tail.write_index;
+  }
+
+  int count = block_count;
+  char* data = region ? region->allocate(count) : NULL;
+  if (data == NULL) {
+    Block block = newBlock();
+    m_blocks.push_back(block);
+    m_reserved_blocks = 1;
+    size = BufferBlockPool::BLOCK_SIZE;
+    return block.data;
+  }
+
+  for (int i = 0; i < count; ++i) {
+    Block block;
+    block.data = data + i * BufferBlockPool::BLOCK_SIZE;
+    block.region = region;
+    m_blocks.push_back(block);
+  }
+  m_reserved_blocks = count;
+  size = count * BufferBlockPool::BLOCK_SIZE;
+  return data;
+}
+
+void TcpBuffer::commitRead(int size) {
+  if (size < 0) {
+    size = 0;
+  }
+  m_read_able += size;
+
+  if (m_reserved_blocks == 0) {
+    if (!m_blocks.empty()) {
+      m_blocks.back().write_index += size;
+    }
     return;
   }
-  m_write_index = j;
-  adjustBuffer();
+
+  // 依次填入预留的 block, 没有读到数据的 block 直接归还
+  size_t first = m_blocks.size() - m_reserved_blocks;
+  for (size_t i = first; i < m_blocks.size(); ++i) {
+    int count = std::min(size, BufferBlockPool::BLOCK_SIZE);
+    m_blocks[i].write_index = count;
+    size -= count;
+  }
+  while (m_blocks.size() > first && m_blocks.back().write_index == 0) {
+    releaseBlock(m_blocks.back());
+    m_blocks.pop_back();
+  }
+  m_reserved_blocks = 0;
 }
 
 }
\ No newline at end of file
@@ -2,49 +2,95 @@
 #define ROCKET_RPC_NET_TCP_TCP_BUFFER_H
 
 #include <vector>
+#include <deque>
+#include <string>
 #include <memory>
+#include <sys/uio.h>
 
 namespace rocket_rpc {
 
+class FixedBlockRegion;
+
+// 分段缓冲区, 由若干从 BufferBlockPool 中分配的固定大小 block 串成
+// 写入时只在尾部追加 block, 读走的 block 立即归还, 不会整体 realloc + 拷贝
+// 下面的 offset 都是相对于当前可读起点的偏移
 class TcpBuffer {
 
   public:
 
     typedef std::shared_ptr<TcpBuffer> s_ptr;
 
-    TcpBuffer(int size);
+    TcpBuffer();
 
     ~TcpBuffer();
 
     // 返回可读字节数
     int readAble();
 
-    // 返回可写字节数
-    int writeAble();
-
-    int readIndex();
+    void writeToBuffer(const char* buf, int size);
 
-    int writeIndex();
+    // 返回尾部 block 的剩余空间, 尾部 block 已满时先追加一个新 block, 大小通过 size 返回
+    // 可以直接往这块内存里写数据, 写完之后用 moveWriteIndex 提交实际写入的字节数
+    char* getWriteSpace(int& size);
 
-    void writeToBuffer(const char* buf, int size);
+    void moveWriteIndex(int size);
 
     void readFromBuffer(std::vector<char>& re, int size);
 
-    void resizeBuffer(int new_size);
+    // 丢弃前 size 个可读字节
+    void moveReadIndex(int size);
 
-    void adjustBuffer();
+    // 丢弃尾部写入的数据, 只保留前 size 个可读字节, 用于撤销写到一半的内容
+    // 只会释放整个落在 size 之后的 block, 前面的数据(比如正在发送中的部分)不受影响
+    void truncate(int size);
 
-    void moveReadIndex(int size);
+    // 从 offset 开始查找字节 c, 返回其偏移, 找不到返回 -1
+    int find(char c, int offset);
 
-    void moveWriteIndex(int size);
+    // 把 [offset, offset + size) 拷贝到 dst, 可读数据不够时返回 false
+    bool peek(char* dst, int offset, int size);
+
+    // 返回 [offset, offset + size) 的连续内存
+    // 在同一个 block 内时直接返回 block 内的指针, 跨 block 时拷贝到 scratch 中
+    // 返回的指针在 buffer 被修改之前有效
+    const char* peekContiguous(int offset, int size, std::string& scratch);
+
+    // 用 readv 从 fd 读取, 直接读入尾部 block 的剩余空间和一个新 block, 多出来的部分先读到栈上再追加
+    // 返回值与 read 相同, 读到的数据不足本次提供的空间时 is_read_all 为 true
+    int readFromFd(int fd, bool& is_read_all);
+
+    // 用 writev 把可读数据写到 fd, 写出去的部分从 buffer 中移除, 返回值与 write 相同
+    int writeToFd(int fd);
+
+    // 完成模式(io_uring)的读: 预留一段连续空间交给内核写入, 返回起始地址, 大小通过 size 返回
+    // 尾部 block 还有剩余空间时直接用它, 否则追加 block_count 个地址连续的新 block(从 region 分配, region 为空或者用完时退回 block 池, 只有一个)
+    // 读完成之前不能再修改 buffer, 完成后必须调用 commitRead 提交实际读到的字节数(失败时为 0)
+    char* reserveRead(int block_count, FixedBlockRegion* region, int& size);
+
+    void commitRead(int size);
+
+    // 把可读数据按 block 填入 iov(最多 max_count 个), 不移除数据, 返回 iov 个数
+    // 用于完成模式的写, 写完成之前这部分数据不能被读走, 完成后用 moveReadIndex 移除实际写出的字节
+    int getReadIov(iovec* iov, int max_count);
 
   private:
-    int m_read_index {0};
-    int m_write_index {0};
-    int m_size {0};
+    struct Block {
+      char* data {NULL};
+      int read_index {0};
+      int write_index {0};
+      FixedBlockRegion* region {NULL};   // 不为空时 block 属于这个固定缓冲区, 释放时还给它
+    };
 
-  public:
-    std::vector<char> m_buffer;
+    Block newBlock();
+
+    // 归还已经读完的 block
+    void releaseBlock(Block& block);
+
+  private:
+    std::deque<Block> m_blocks;
+    int m_read_able {0};
+
+    int m_reserved_blocks {0};   // reserveRead 追加的新 block 个数, 为 0 时预留的是尾部 block 的剩余空间
 };
 
 }
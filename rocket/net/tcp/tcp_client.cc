@@ -10,8 +10,10 @@
 
 namespace rocket_rpc {
 
-TcpClient::TcpClient(NetAddr::s_ptr peer_addr) : m_peer_addr(peer_addr) {
-  m_event_loop = EventLoop::GetCurrentEventLoop();
+TcpClient::TcpClient(NetAddr::s_ptr peer_addr, EventLoop* event_loop /*=NULL*/) : m_peer_addr(peer_addr), m_event_loop(event_loop) {
+  if (m_event_loop == NULL) {
+    m_event_loop = EventLoop::GetCurrentEventLoop();
+  }
   m_fd = socket(peer_addr->getFamily(), SOCK_STREAM, 0);
 
   if (m_fd < 0) {
@@ -22,12 +24,16 @@ TcpClient::TcpClient(NetAddr::s_ptr peer_addr) : m_peer_addr(peer_addr) {
   m_fd_event = FdEventGroup::GetFdEventGroup()->getFdEvent(m_fd);
   m_fd_event->setNonBlock();
   
-  m_connection = std::make_shared<TcpConnection>(m_event_loop, m_fd, 128, peer_addr, nullptr, TcpConnectionByClinet);
+  m_connection = std::make_shared<TcpConnection>(m_event_loop, m_fd, peer_addr, nullptr, TcpConnectionByClinet);
   m_connection->setConnectionType(TcpConnectionByClinet);
 }
 
 TcpClient::~TcpClient() {
   DEBUGLOG("TcpClient::~TcpClient")
+  // 关闭前先从 epoll 中摘除, 否则 fd 复用时 eventloop 会误判为已注册
+  if (m_connection) {
+    m_connection->clear();
+  }
   if (m_fd > 0) {
     close(m_fd);
   }
@@ -35,20 +41,39 @@ TcpClient::~TcpClient() {
 
 // 异步地进行 connect
 // 如果 connect 成功, done 会被执行
-void TcpClient::connect(std::function<void()> done) {
+void TcpClient::connect(InlineFunction<void()> done) {
+  // 从连接池复用的连接已经建立好了, 不需要再次 connect
+  if (isConnected()) {
+    if (done) {
+      done();
+    }
+    if (!m_event_loop->isLooping()) {
+      m_event_loop->loop();
+    }
+    return;
+  }
+
+  // 共享连接上已经有 connect 在进行了, 等它完成即可
+  m_connect_dones.push_back(std::move(done));
+  if (m_is_connecting) {
+    if (!m_event_loop->isLooping()) {
+      m_event_loop->loop();
+    }
+    return;
+  }
+  m_is_connecting = true;
+
   int rt = ::connect(m_fd, m_peer_addr->getSockAddr(), m_peer_addr->getSockLen());
   if (rt == 0) {
     DEBUGLOG("connect [%s] success", m_peer_addr->toString().c_str());
     m_connection->setState(Connected);
     initLocalAddr();  // 如果连接成功, 就设置本机地址
-    if (done) {
-      done();
-    }
+    runConnectDones();
   } else if (rt == -1) {
     if (errno == EINPROGRESS) {
       // epoll 监听可写事件, 然后判断错误码
       m_fd_event->listen(FdEvent::OUT_EVENT, 
-        [this, done]() {
+        [this]() {
           // 方法一: 可以再连接一次进行判断(连接已建立 or 连接成功)
           int rt = ::connect(m_fd, m_peer_addr->getSockAddr(), m_peer_addr->getSockLen());
           if ((rt < 0 && errno == EISCONN) || (rt == 0)) {
@@ -89,9 +114,7 @@ void TcpClient::connect(std::function<void()> done) {
           m_event_loop->deleteEpollEvent(m_fd_event);
           DEBUGLOG("now begin to done");
 
-          if (done) { // 如果连接成功, 执行连接的回调
-            done();
-          }
+          runConnectDones();
         }
       );
       m_event_loop->addEpollEvent(m_fd_event);
@@ -104,14 +127,28 @@ void TcpClient::connect(std::function<void()> done) {
       ERRORLOG("connect error, errno=%d, error=%s", errno, strerror(errno));
       m_connect_error_code = ERROR_FAILED_CONNECT;
       m_connect_error_info = "connect error, sys error = " + std::string(strerror(errno));
-      if (done) {
-        done();
-      }
+      runConnectDones();
     }
   }
 
 }
 
+void TcpClient::runConnectDones() {
+  m_is_connecting = false;
+  // 握手请求是连接上的第一帧, 排在等待 connect 的调用前面
+  if (isConnected()) {
+    m_connection->negotiateProtocol();
+  }
+  // 先换出来再执行, 回调里可能再次调用 connect
+  std::vector<InlineFunction<void()>> dones;
+  dones.swap(m_connect_dones);
+  for (size_t i = 0; i < dones.size(); ++i) {
+    if (dones[i]) {
+      dones[i]();
+    }
+  }
+}
+
 void TcpClient::stop() {
   if (m_event_loop->isLooping()) {
     m_event_loop->stop();
@@ -121,22 +158,52 @@ void TcpClient::stop() {
 
 // 异步地发送 Message
 // 如果发送 message 成功, 会调用 done 函数, 函数的入参就是 message 对象
-void TcpClient::writeMessage(AbstractProtocol::s_ptr message, std::function<void(AbstractProtocol::s_ptr)> done) {
+void TcpClient::writeMessage(AbstractProtocol::s_ptr message, InlineFunction<void(AbstractProtocol::s_ptr)> done) {
   // 1. 把 message 对象写入到 Connection 的 buffer, done 也写入
   // 2. 启动 connection 可写事件监听
-  m_connection->pushSendMessage(message, done);
+  m_connection->pushSendMessage(message, std::move(done));
   m_connection->listenWrite();
 }
 
 // 异步地读取 message
 // 如果读取 message 成功, 会调用 done 函数, 函数的入参就是 message 对象
-void TcpClient::readMessage(const std::string& msg_id, std::function<void(AbstractProtocol::s_ptr)> done) {
+void TcpClient::readMessage(const std::string& msg_id, InlineFunction<void(AbstractProtocol::s_ptr)> done) {
   // 1. 监听可读事件
   // 2. 从 buffer 里 decode 得到 message 对象, 判断是否 msg_id 相等, 相等则读出, 并执行其回调
-  m_connection->pushReadMessage(msg_id, done);
+  m_connection->pushReadMessage(msg_id, std::move(done));
   m_connection->listenRead();
 }
 
+void TcpClient::cancelReadMessage(const std::string& msg_id) {
+  m_connection->cancelReadMessage(msg_id);
+}
+
+bool TcpClient::isConnecting() {
+  return m_is_connecting;
+}
+
+bool TcpClient::isConnected() {
+  return m_fd > 0 && m_connection->getState() == Connected;
+}
+
+bool TcpClient::checkHealth() {
+  if (!isConnected()) {
+    return false;
+  }
+  // 空闲连接上不应有数据, 用 MSG_PEEK 探测对端是否已经关闭或出错
+  char buf;
+  int rt = recv(m_fd, &buf, 1, MSG_PEEK | MSG_DONTWAIT);
+  if (rt == 0) {
+    DEBUGLOG("peer [%s] closed idle connection, fd[%d]", m_peer_addr->toString().c_str(), m_fd);
+    return false;
+  }
+  if (rt < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+    ERRORLOG("idle connection to [%s] error, errno=%d, error=%s", m_peer_addr->toString().c_str(), errno, strerror(errno));
+    return false;
+  }
+  return true;
+}
+
 int TcpClient::getConnectErrorCode() {
   return m_connect_error_code;
 }
@@ -171,4 +238,8 @@ void TcpClient::addTimerEvent(TimerEvent::s_ptr timer_event) {
   m_event_loop->addTimerEvent(timer_event);
 }
 
+void TcpClient::deleteTimerEvent(TimerEvent::s_ptr timer_event) {
+  m_event_loop->deleteTimerEvent(timer_event);
+}
+
 }
\ No newline at end of file
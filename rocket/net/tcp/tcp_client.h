@@ -2,6 +2,9 @@
 #define ROCKET_RPC_NET_TCP_TCP_CLIENT_H
 
 #include <memory>
+#include <vector>
+#include <functional>
+#include "rocket/common/inline_function.h"
 #include "rocket/net/tcp/net_addr.h"
 #include "rocket/net/eventloop.h"
 #include "rocket/net/tcp/tcp_connection.h"
@@ -14,24 +17,38 @@ class TcpClient {
   public:
     typedef std::shared_ptr<TcpClient> s_ptr;
 
-    TcpClient(NetAddr::s_ptr peer_addr);
+    // event_loop 为 NULL 时使用当前线程的 eventloop
+    TcpClient(NetAddr::s_ptr peer_addr, EventLoop* event_loop = NULL);
 
     ~TcpClient();
 
     // 异步地进行 connect
     // 如果 connect 完成, done 会被执行
-    void connect(std::function<void()> done);
+    // 连接可能被多个调用共享, connect 进行中再次调用时, done 会在这次 connect 完成后一并执行
+    void connect(InlineFunction<void()> done);
 
     // 异步地发送 Message
     // 如果发送 message 成功, 会调用 done 函数, 函数的入参就是 message 对象
-    void writeMessage(AbstractProtocol::s_ptr message, std::function<void(AbstractProtocol::s_ptr)> done);
+    void writeMessage(AbstractProtocol::s_ptr message, InlineFunction<void(AbstractProtocol::s_ptr)> done);
 
     // 异步地读取 message
     // 如果读取 message 成功, 会调用 done 函数, 函数的入参就是 message 对象
-    void readMessage(const std::string& msg_id, std::function<void(AbstractProtocol::s_ptr)> done);
+    void readMessage(const std::string& msg_id, InlineFunction<void(AbstractProtocol::s_ptr)> done);
+
+    // 取消一个尚未收到回包的读回调, 迟到的回包会被丢弃
+    void cancelReadMessage(const std::string& msg_id);
 
     void stop();
 
+    // 连接是否已建立且未关闭
+    bool isConnected();
+
+    // 正在进行 connect, 还没有结果
+    bool isConnecting();
+
+    // 检查空闲连接是否仍然可用(对端未关闭, socket 无错误)
+    bool checkHealth();
+
     int getConnectErrorCode();
 
     std::string getConnectErrorInfo();
@@ -44,6 +61,12 @@ class TcpClient {
 
     void addTimerEvent(TimerEvent::s_ptr timer_event);
 
+    void deleteTimerEvent(TimerEvent::s_ptr timer_event);
+
+  private:
+    // connect 有结果之后, 执行所有等待中的回调
+    void runConnectDones();
+
   private:
     NetAddr::s_ptr m_local_addr; // 连接成功之后, 设置本机地址
     NetAddr::s_ptr m_peer_addr;
@@ -57,6 +80,9 @@ class TcpClient {
     int m_connect_error_code {0};
     std::string m_connect_error_info;
 
+    bool m_is_connecting {false};
+    std::vector<InlineFunction<void()>> m_connect_dones;
+
 };
 
 }
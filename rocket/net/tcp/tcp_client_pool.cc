@@ -0,0 +1,224 @@
+#include <algorithm>
+#include "rocket/net/tcp/tcp_client_pool.h"
+#include "rocket/common/log.h"
+#include "rocket/common/util.h"
+#include "rocket/common/config.h"
+
+namespace rocket_rpc {
+
+static thread_local TcpClientPool* t_client_pool = NULL;
+static int g_idle_check_interval = 5000;  // ms
+
+TcpClientPool* TcpClientPool::GetTcpClientPool() {
+  if (t_client_pool) {
+    return t_client_pool;
+  }
+  t_client_pool = new TcpClientPool(EventLoop::GetCurrentEventLoop());
+  return t_client_pool;
+}
+
+TcpClientPool::TcpClientPool(EventLoop* event_loop) : m_event_loop(event_loop) {
+  m_idle_check_timer_event = std::make_shared<TimerEvent>(g_idle_check_interval, true, std::bind(&TcpClientPool::onIdleCheck, this));
+  m_event_loop->addTimerEvent(m_idle_check_timer_event);
+
+  // 预先建立配置的 stub 的最少连接, 第一次调用就不需要等 connect
+  Config* config = Config::GetGlobalConfig();
+  if (config) {
+    for (auto i = config->m_rpc_stubs.begin(); i != config->m_rpc_stubs.end(); ++i) {
+      if (i->second.addr && i->second.min_conns > 0) {
+        fillMinConns(getGroup(i->second.addr));
+      }
+    }
+  }
+}
+
+TcpClientPool::~TcpClientPool() {
+  if (m_idle_check_timer_event) {
+    m_idle_check_timer_event->setCanceled(true);
+  }
+}
+
+TcpClientPool::TcpClientGroup& TcpClientPool::getGroup(NetAddr::s_ptr peer_addr) {
+  std::string key = peer_addr->toString();
+  auto it = m_groups.find(key);
+  if (it != m_groups.end()) {
+    return it->second;
+  }
+
+  TcpClientGroup& group = m_groups[key];
+  group.peer_addr = peer_addr;
+
+  // 如果对端地址在配置的 stubs 里面, 使用其连接池配置
+  Config* config = Config::GetGlobalConfig();
+  if (config) {
+    for (auto i = config->m_rpc_stubs.begin(); i != config->m_rpc_stubs.end(); ++i) {
+      if (i->second.addr && i->second.addr->toString() == key) {
+        group.min_conns = i->second.min_conns;
+        group.max_conns = i->second.max_conns;
+        group.idle_timeout = i->second.idle_timeout;
+        group.max_inflight = i->second.max_inflight;
+        break;
+      }
+    }
+  }
+  INFOLOG("create client pool for [%s], min_conns[%d], max_conns[%d], idle_timeout[%d ms], max_inflight[%d]",
+    key.c_str(), group.min_conns, group.max_conns, group.idle_timeout, group.max_inflight);
+
+  return group;
+}
+
+TcpClient::s_ptr TcpClientPool::newClient(TcpClientGroup& group, NetAddr::s_ptr peer_addr, const std::string& msg_id, bool is_temporary) {
+  TcpClientItem item;
+  item.client = std::make_shared<TcpClient>(peer_addr, m_event_loop);
+  item.msg_ids.insert(msg_id);
+  item.is_temporary = is_temporary;
+  group.clients.push_back(item);
+  return item.client;
+}
+
+TcpClient::s_ptr TcpClientPool::acquire(NetAddr::s_ptr peer_addr, const std::string& msg_id) {
+  TcpClientGroup& group = getGroup(peer_addr);
+
+  TcpClientItem* best = NULL;
+  int conns = 0;
+  for (auto it = group.clients.begin(); it != group.clients.end(); ) {
+    TcpClient::s_ptr& client = it->client;
+    bool is_usable = client->isConnected() || client->isConnecting();
+    if (!is_usable && it->msg_ids.empty()) {
+      // 已经关闭的连接直接丢弃
+      DEBUGLOG("drop closed pooled connection to [%s]", peer_addr->toString().c_str());
+      closeClient(client);
+      it = group.clients.erase(it);
+      continue;
+    }
+    if (!it->is_temporary) {
+      conns ++ ;
+    }
+    if (is_usable && !it->is_temporary && it->msg_ids.find(msg_id) == it->msg_ids.end()) {
+      if (best == NULL || it->msg_ids.size() < best->msg_ids.size()) {
+        best = &(*it);
+      }
+    }
+    ++it;
+  }
+
+  if (best != NULL && ((int)best->msg_ids.size() < group.max_inflight || conns >= group.max_conns)) {
+    best->msg_ids.insert(msg_id);
+    DEBUGLOG("%s | share pooled connection to [%s], inflight[%d]", msg_id.c_str(), peer_addr->toString().c_str(), (int)best->msg_ids.size());
+    return best->client;
+  }
+
+  if (conns < group.max_conns) {
+    DEBUGLOG("%s | create pooled connection to [%s], conns[%d]", msg_id.c_str(), peer_addr->toString().c_str(), conns + 1);
+    return newClient(group, peer_addr, msg_id, false);
+  }
+
+  // 所有连接上都已经有相同 msg_id 的请求在途(msg_id 透传时可能出现), 只能临时新建, 在途请求结束后关闭
+  INFOLOG("%s | no pooled connection to [%s] available for this msg_id, max_conns[%d], create temporary connection",
+    msg_id.c_str(), peer_addr->toString().c_str(), group.max_conns);
+  return newClient(group, peer_addr, msg_id, true);
+}
+
+void TcpClientPool::release(TcpClient::s_ptr client, const std::string& msg_id) {
+  if (!client) {
+    return;
+  }
+  TcpClientGroup& group = getGroup(client->getPeerAddr());
+
+  for (auto it = group.clients.begin(); it != group.clients.end(); ++it) {
+    if (it->client != client) {
+      continue;
+    }
+    it->msg_ids.erase(msg_id);
+    if (!it->msg_ids.empty()) {
+      return;
+    }
+    it->last_active = getNowMs();
+
+    if (it->is_temporary || (!client->isConnected() && !client->isConnecting())) {
+      DEBUGLOG("release connection to [%s], temporary[%d] or not connected, close it", client->getPeerAddr()->toString().c_str(), it->is_temporary);
+      group.clients.erase(it);
+      closeClient(client);
+    }
+    return;
+  }
+}
+
+void TcpClientPool::fillMinConns(TcpClientGroup& group) {
+  int conns = 0;
+  for (size_t i = 0; i < group.clients.size(); ++i) {
+    TcpClient::s_ptr& client = group.clients[i].client;
+    if (!group.clients[i].is_temporary && (client->isConnected() || client->isConnecting())) {
+      conns ++ ;
+    }
+  }
+
+  int min_conns = std::min(group.min_conns, group.max_conns);
+  for (; conns < min_conns; ++conns) {
+    DEBUGLOG("open pooled connection to [%s] for min_conns[%d]", group.peer_addr->toString().c_str(), group.min_conns);
+    TcpClientItem item;
+    item.client = std::make_shared<TcpClient>(group.peer_addr, m_event_loop);
+    item.last_active = getNowMs();
+    group.clients.push_back(item);
+    // 连接失败时会在下一次 acquire 或者 onIdleCheck 中被丢弃, 之后再由 onIdleCheck 重新建立
+    item.client->connect(nullptr);
+  }
+}
+
+void TcpClientPool::closeClient(TcpClient::s_ptr client) {
+  // 归还往往发生在该连接自己的读写回调里面, 不能立刻析构, 放到任务队列里延迟释放
+  m_event_loop->addTask([client]() mutable {
+    client.reset();
+  });
+}
+
+int TcpClientPool::getIdleCount(NetAddr::s_ptr peer_addr) {
+  TcpClientGroup& group = getGroup(peer_addr);
+  int count = 0;
+  for (size_t i = 0; i < group.clients.size(); ++i) {
+    if (group.clients[i].msg_ids.empty()) {
+      count ++ ;
+    }
+  }
+  return count;
+}
+
+int TcpClientPool::getActiveCount(NetAddr::s_ptr peer_addr) {
+  TcpClientGroup& group = getGroup(peer_addr);
+  return group.clients.size() - getIdleCount(peer_addr);
+}
+
+int TcpClientPool::getInflightCount(NetAddr::s_ptr peer_addr) {
+  TcpClientGroup& group = getGroup(peer_addr);
+  int count = 0;
+  for (size_t i = 0; i < group.clients.size(); ++i) {
+    count += group.clients[i].msg_ids.size();
+  }
+  return count;
+}
+
+void TcpClientPool::onIdleCheck() {
+  int64_t now = getNowMs();
+
+  for (auto it = m_groups.begin(); it != m_groups.end(); ++it) {
+    TcpClientGroup& group = it->second;
+
+    // 只检查没有在途请求的连接, 从后往前, 先淘汰后建立的连接
+    for (size_t i = group.clients.size(); i > 0; --i) {
+      TcpClientItem& item = group.clients[i - 1];
+      if (!item.msg_ids.empty()) {
+        continue;
+      }
+      bool is_expired = (now - item.last_active >= group.idle_timeout) && ((int)group.clients.size() > group.min_conns);
+      if (is_expired || !item.client->checkHealth()) {
+        DEBUGLOG("evict idle connection to [%s], expired[%d]", it->first.c_str(), is_expired);
+        closeClient(item.client);
+        group.clients.erase(group.clients.begin() + (i - 1));
+      }
+    }
+
+    fillMinConns(group);
+  }
+}
+
+}
\ No newline at end of file
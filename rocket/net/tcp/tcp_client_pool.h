@@ -0,0 +1,91 @@
+#ifndef ROCKET_RPC_NET_TCP_TCP_CLIENT_POOL_H
+#define ROCKET_RPC_NET_TCP_TCP_CLIENT_POOL_H
+
+#include <map>
+#include <vector>
+#include <set>
+#include <string>
+#include <memory>
+#include "rocket/net/tcp/net_addr.h"
+#include "rocket/net/tcp/tcp_client.h"
+#include "rocket/net/eventloop.h"
+#include "rocket/net/timer_event.h"
+
+namespace rocket_rpc {
+
+// 客户端连接池, 按对端地址缓存已建立的 TcpClient, 避免每次 rpc 调用都重新 socket + connect
+// 连接是多路复用的: 多个调用(可以来自不同的 RpcChannel)共享同一个连接, 通过 msg_id 对应回包
+// TcpClient 绑定在创建它的线程的 eventloop 上, 因此连接池也是每个线程一个, 不需要加锁
+// 只能在运行着 eventloop 的线程(例如客户端 IO 线程)中使用
+// 配置了 min_conns 的 stub 在连接池创建时预先建立连接, 之后由定时任务补齐, 每个线程的连接池各自保留 min_conns 个
+class TcpClientPool {
+  public:
+    typedef std::shared_ptr<TcpClientPool> s_ptr;
+
+    TcpClientPool(EventLoop* event_loop);
+
+    ~TcpClientPool();
+
+    // 为 msg_id 这次调用获取一个到 peer_addr 的连接
+    // 优先选在途请求最少的连接, 所有连接都达到 max_inflight 且未超过 max_conns 时才新建(尚未 connect)
+    // 同一个连接上 msg_id 不能重复, 已经有相同 msg_id 在途的连接会被跳过
+    TcpClient::s_ptr acquire(NetAddr::s_ptr peer_addr, const std::string& msg_id);
+
+    // msg_id 这次调用结束, 归还连接
+    // 连接不可用, 或者是超过 max_conns 临时创建的连接, 在没有在途请求后关闭
+    void release(TcpClient::s_ptr client, const std::string& msg_id);
+
+    // 没有在途请求的连接数
+    int getIdleCount(NetAddr::s_ptr peer_addr);
+
+    // 有在途请求的连接数
+    int getActiveCount(NetAddr::s_ptr peer_addr);
+
+    // 到 peer_addr 的所有连接上的在途请求数
+    int getInflightCount(NetAddr::s_ptr peer_addr);
+
+  public:
+    static TcpClientPool* GetTcpClientPool();
+
+  private:
+    struct TcpClientItem {
+      TcpClient::s_ptr client;
+      std::set<std::string> msg_ids;  // 正在使用该连接的调用, 其数量即在途请求数
+      int64_t last_active {0};    // 在途请求数归零时的时间戳(ms)
+      bool is_temporary {false};  // 超过 max_conns 临时创建的连接
+    };
+
+    struct TcpClientGroup {
+      NetAddr::s_ptr peer_addr;
+      int min_conns {0};
+      int max_conns {8};
+      int idle_timeout {60000};   // ms
+      int max_inflight {128};
+
+      std::vector<TcpClientItem> clients;
+    };
+
+    TcpClientGroup& getGroup(NetAddr::s_ptr peer_addr);
+
+    TcpClient::s_ptr newClient(TcpClientGroup& group, NetAddr::s_ptr peer_addr, const std::string& msg_id, bool is_temporary);
+
+    void closeClient(TcpClient::s_ptr client);
+
+    // 可用的连接不足 min_conns 时新建空闲连接并发起 connect
+    void fillMinConns(TcpClientGroup& group);
+
+    // 定时任务: 健康检查, 淘汰空闲超时的连接, 以及补齐 min_conns
+    void onIdleCheck();
+
+  private:
+    EventLoop* m_event_loop {NULL};
+
+    // key 为对端地址 ip:port
+    std::map<std::string, TcpClientGroup> m_groups;
+
+    TimerEvent::s_ptr m_idle_check_timer_event;
+};
+
+}
+
+#endif
\ No newline at end of file
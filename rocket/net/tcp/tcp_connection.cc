@@ -1,5 +1,7 @@
 #include <unistd.h>
+#include <string.h>
 #include "rocket/common/log.h"
+#include "rocket/common/config.h"
 #include "rocket/net/fd_event_group.h"
 #include "rocket/net/tcp/tcp_connection.h"
 #include "rocket/net/coder/string_coder.h"
@@ -7,22 +9,43 @@
 
 namespace rocket_rpc {
 
-TcpConnection::TcpConnection(EventLoop* event_loop, int fd, int buffer_size, NetAddr::s_ptr peer_addr, NetAddr::s_ptr local_addr, TcpConnectionType type /*=TcpConnectionByServer*/)
+// 完成模式下一次读最多预留的 block 数(64KB), 与 readv 时的栈上溢出区一样大
+static const int g_max_read_blocks = 16;
+
+// 完成模式下一次写最多使用的 block 数
+static const int g_max_write_iov = 64;
+
+TcpConnection::TcpConnection(EventLoop* event_loop, int fd, NetAddr::s_ptr peer_addr, NetAddr::s_ptr local_addr, TcpConnectionType type /*=TcpConnectionByServer*/)
   : m_event_loop(event_loop), m_local_addr(local_addr), m_peer_addr(peer_addr), m_state(NotConnected), m_fd(fd), m_connection_type(type) {
 
   // 初始化连接的 buffer
-  m_in_buffer = std::make_shared<TcpBuffer>(buffer_size);
-  m_out_buffer = std::make_shared<TcpBuffer>(buffer_size);
+  m_in_buffer = std::make_shared<TcpBuffer>();
+  m_out_buffer = std::make_shared<TcpBuffer>();
 
   // 初始化 fd event 以及绑定读入事件
   m_fd_event = FdEventGroup::GetFdEventGroup()->getFdEvent(fd);
   m_fd_event->setNonBlock();
 
-  m_coder = new TinyPBCoder();
+  m_coder = new TinyPBCoder(m_connection_type == TcpConnectionByServer);
+
+  m_completion_io = m_event_loop->isCompletionIO();
+
+  Config* config = Config::GetGlobalConfig();
+  if (config) {
+    m_reply_batch_bytes = config->m_reply_batch_bytes;
+  }
+
+  if (m_connection_type == TcpConnectionByClinet) {
+    // 调用超时或者取消之后才到达的回包在 decode 时就丢弃, 不会再解析到 response 中
+    m_coder->setFrameFilter([this](const char* msg_id, int msg_id_len) {
+      return m_read_dones.acceptResponse(msg_id, msg_id_len);
+    });
+  }
 
   if (m_connection_type == TcpConnectionByServer) {
-    // 如果是服务端的连接, 直接将 fd event 添加至 子线程 eventloop 循环进行监听
-    listenRead();
+    // accept 得到的连接已经建立, 必须在注册之前设置状态, 否则 IO 线程先收到的可读事件会被忽略(边缘触发下不会再通知)
+    // 可读事件由 TcpServer 在 shared_ptr 构造完成之后再注册, 否则 IO 线程里的 shared_from_this 可能失败
+    m_state = Connected;
   }
 }
 
@@ -35,6 +58,11 @@ TcpConnection::~TcpConnection() {
 }
 
 void TcpConnection::onRead() {
+  if (m_completion_io) {
+    onReadCompleted();
+    return;
+  }
+
   // 1. 从 socket 缓冲区, 调用系统的 read 函数读取字节到 in_buffer
   if (m_state != Connected) {
     ERRORLOG("onRead error, client has already disconnected, addr[%s], clientfd[%d]", m_peer_addr->toString().c_str(), m_fd);
@@ -44,28 +72,21 @@ void TcpConnection::onRead() {
   bool is_read_all = false;
   bool is_close = false;
   while (!is_read_all) { // 尽可能全部读完
-    if (m_in_buffer->writeAble() == 0) {
-      m_in_buffer->resizeBuffer(2 * m_in_buffer->m_buffer.size());
-    }
-    int read_count = m_in_buffer->writeAble(); // 表示当前可写的最大字节数
-    int write_index = m_in_buffer->writeIndex();
-
-    int rt = read(m_fd, &(m_in_buffer->m_buffer[write_index]), read_count);
+    // readv 直接读进 buffer 的 block 中, 不需要先扩容
+    int rt = m_in_buffer->readFromFd(m_fd, is_read_all);
     if (rt > 0) {
       DEBUGLOG("success read %d bytes from addr[%s], client fd[%d]", rt, m_peer_addr->toString().c_str(), m_fd);
-      m_in_buffer->moveWriteIndex(rt);
-      if (rt == read_count) { // 可能没读完
-        continue;
-      } else if (rt < read_count) { // 已经读完了([实际读回]的比[最大可写]的要少)
-        is_read_all = true;
-        break;
-      }
+      // is_read_all 为 true 表示已经读完了([实际读回]的比[最大可写]的要少)
     } else if (rt == 0) { // 对端连接已关闭
       is_close = true;
       break;
     } else if (rt == -1 && errno == EAGAIN) { // 读不到数据了
       is_read_all = true;
       break;
+    } else if (rt == -1 && errno != EINTR) {
+      ERRORLOG("read data error, errno=%d, error=%s, peer addr[%s]", errno, strerror(errno), m_peer_addr->toString().c_str());
+      is_close = true;
+      break;
     }
   }
 
@@ -106,26 +127,74 @@ void TcpConnection::execute() {
     std::vector<AbstractProtocol::s_ptr> result;
     m_coder->decode(result, m_in_buffer);
 
-    for (size_t i = 0; i < result.size(); i ++ ) { // 执行客户端连接所有的读回调, 执行后清空
-      std::string msg_id = result[i]->m_msg_id;
-      auto it = m_read_dones.find(msg_id);
-      if (it != m_read_dones.end()) {
-        it->second(result[i]);
-        m_read_dones.erase(it);
+    // 同一个连接上可以有多个请求在途, 回包按 msg_id 对应到各自的读回调, 顺序可以与发送顺序不同
+    for (size_t i = 0; i < result.size(); i ++ ) {
+      // 先摘除再执行, 回调里可能会在这个连接上发起新的调用
+      InlineFunction<void(AbstractProtocol::s_ptr)> done;
+      if (!m_read_dones.take(result[i]->m_msg_id, done)) {
+        DEBUGLOG("%s | no pending read for response, maybe canceled, discard it, peer addr[%s]", result[i]->m_msg_id.c_str(), m_peer_addr->toString().c_str());
+        continue;
       }
-      // TODO 清空
+      done(result[i]);
     }
   }
 
 }
 
 void TcpConnection::reply(std::vector<AbstractProtocol::s_ptr>& reply_messages) {
+  int before = m_out_buffer->readAble();
   m_coder->encode(reply_messages, m_out_buffer);
-  listenWrite();
+  m_out_bytes_pushed += m_out_buffer->readAble() - before;
+  m_event_loop->addWriteStats(reply_messages.size(), 0);
+
+  if (before > 0 && !m_flush_pending) {
+    // 之前的回包还没发完, 已经在等可写事件, 追加在后面按顺序发送即可
+    return;
+  }
+
+  if (m_out_buffer->readAble() >= m_reply_batch_bytes) {
+    // 攒够上限(或者不合并)就直接发送, 不再等本轮 loop 结束
+    m_flush_pending = false;
+    sendOutBuffer();
+    return;
+  }
+
+  // 同一轮 loop 里 execute 解出的多个请求的回包合并, 在进入 epoll_wait 之前用一次 writev 发出去
+  if (!m_flush_pending) {
+    m_flush_pending = true;
+    TcpConnection::s_ptr self = shared_from_this();
+    m_event_loop->addFlushTask([self]() {
+      if (self->m_flush_pending) {
+        self->m_flush_pending = false;
+        self->sendOutBuffer();
+      }
+    });
+  }
+}
+
+void TcpConnection::sendOutBuffer() {
+  if (m_completion_io) {
+    // 有写在途时什么也不做, 它完成之后会接着提交新追加的数据
+    submitWrite();
+    return;
+  }
+
+  // 先直接写 socket, 内核发送缓冲区满了写不完时才监听可写事件
+  // 小回包不用等下一轮 epoll_wait, 也不需要注册再取消 EPOLLOUT
+  onWrite();
+  if (m_out_buffer->readAble() > 0 && m_state == Connected && !m_edge_triggered_listening) {
+    DEBUGLOG("reply not sent completely, listen write event, left %d bytes, client fd[%d]", m_out_buffer->readAble(), m_fd);
+    listenWrite();
+  }
 }
 
 
 void TcpConnection::onWrite() {
+  if (m_completion_io) {
+    onWriteCompleted();
+    return;
+  }
+
   // 将当前 out_buffer 里面的数据全部发送给 Client
 
   if (m_state != Connected) {
@@ -133,19 +202,7 @@ void TcpConnection::onWrite() {
     return;
   }
 
-  if (m_connection_type == TcpConnectionByClinet) { // 客户端写逻辑(主动)
-    // 1. 将 message encode 得到字节流
-    // 2. 将数据写入到 buffer 里面, 然后全部发送
-
-    std::vector<AbstractProtocol::s_ptr> messages;
-    
-    for (size_t i = 0; i < m_write_dones.size(); i ++ ) {
-      messages.push_back(m_write_dones[i].first);
-    }
-
-    m_coder->encode(messages, m_out_buffer);
-  }
-
+  // 客户端的 message 在 pushSendMessage 时已经 encode 进 out_buffer, 这里只负责发送
   bool is_write_all = false;
   while(true) { // 尽可能全部写完
     if (m_out_buffer->readAble() == 0) {
@@ -154,32 +211,130 @@ void TcpConnection::onWrite() {
       break;
     }
     int write_size = m_out_buffer->readAble(); // 表示当前可读的最大字节数
-    int read_index = m_out_buffer->readIndex();
-    int rt = write(m_fd, &(m_out_buffer->m_buffer[read_index]), write_size);
+    // writev 一次发送多个 block, 已经发送出去的数据会从 out_buffer 中移除
+    int rt = m_out_buffer->writeToFd(m_fd);
+    m_event_loop->addWriteStats(0, 1);
+    if (rt > 0) {
+      m_out_bytes_sent += rt;
+    }
 
-    if (rt >= write_size) { // [实际写入]的比[最大可读]的还要大, 说明写完了 ??????
+    if (rt >= write_size) { // [实际写入]的比[最大可读]的还要大, 说明写完了
       DEBUGLOG("no data need to send to client [%s]", m_peer_addr->toString().c_str());
       is_write_all = true;
       break;
+    } else if (rt > 0) { // 只写出去一部分, 继续写剩下的
+      continue;
     } else if (rt == -1 && errno == EAGAIN) { // 写入 socket 发送缓冲区失败
       // 发送缓冲区已满, 不能再发送了
       // 这种情况下我们等下次 fd 可写的时候再次发送数据即可
-      ERRORLOG("write data error, errno==EAGAIN and rt == -1");
+      // 回包会先直接写 socket, 大回包时经常走到这里, 不是错误
+      DEBUGLOG("socket send buffer full, wait for writable, left %d bytes, client fd[%d]", m_out_buffer->readAble(), m_fd);
+      break;
+    } else if (rt == -1 && errno != EINTR) {
+      ERRORLOG("write data error, errno=%d, error=%s, peer addr[%s]", errno, strerror(errno), m_peer_addr->toString().c_str());
       break;
     }
   }
-  if (is_write_all) {
+  // 边缘触发下可写事件一直保持注册, 不需要取消
+  if (is_write_all && !m_edge_triggered_listening) {
     m_fd_event->cancel(FdEvent::OUT_EVENT);
     m_event_loop->addEpollEvent(m_fd_event); // 清空可写事件
     // note: 不是 deleteEpollEvent, 否则读写事件都被删除
   }
 
-  if (m_connection_type == TcpConnectionByClinet) { // 执行客户端连接所有的写回调, 执行后清空
-    for (size_t i = 0; i < m_write_dones.size(); i ++ ) {
-      m_write_dones[i].second(m_write_dones[i].first);
+  runWriteDones();
+}
+
+void TcpConnection::runWriteDones() {
+  // 执行已经完整发送出去的 message 的写回调, 没发完的留到下次可写时
+  while (!m_write_dones.empty() && m_write_dones.front().end_offset <= m_out_bytes_sent) {
+    WriteDone write_done = std::move(m_write_dones.front());
+    m_write_dones.pop();
+    if (write_done.done) {
+      write_done.done(write_done.message);
+    }
+  }
+}
+
+void TcpConnection::submitRead() {
+  if (m_read_inflight || m_state == Closed || m_state == NotConnected) {
+    return;
+  }
+  int size = 0;
+  char* buf = m_in_buffer->reserveRead(m_read_blocks, m_event_loop->getFixedBlockRegion(), size);
+  m_read_size = size;
+  m_read_inflight = true;
+  m_event_loop->submitRead(m_fd_event, buf, size, shared_from_this());
+}
+
+void TcpConnection::onReadCompleted() {
+  m_read_inflight = false;
+  int rt = m_fd_event->getResult(FdEvent::IN_EVENT);
+  m_in_buffer->commitRead(rt);
+  if (m_state == Closed) {
+    return;
+  }
+
+  if (rt > 0) {
+    DEBUGLOG("success read %d bytes from addr[%s], client fd[%d]", rt, m_peer_addr->toString().c_str(), m_fd);
+    // 读满了说明 socket 中可能还有数据, 下次预留更大的连续空间
+    m_read_blocks = (rt == m_read_size) ? g_max_read_blocks : 1;
+    if (m_state == Connected) {
+      execute();
     }
-    m_write_dones.clear();
+    // execute 中可能关闭了连接, submitRead 会检查
+    submitRead();
+    return;
+  }
+
+  if (rt == -EAGAIN || rt == -EINTR) {
+    submitRead();
+    return;
   }
+
+  if (rt == 0) {
+    INFOLOG("peer closed, peer addr [%s], clientfd [%d]", m_peer_addr->toString().c_str(), m_fd);
+  } else {
+    ERRORLOG("read data error, errno=%d, error=%s, peer addr[%s]", -rt, strerror(-rt), m_peer_addr->toString().c_str());
+  }
+  clear();
+}
+
+void TcpConnection::submitWrite() {
+  if (m_write_inflight || m_state != Connected || m_out_buffer->readAble() == 0) {
+    return;
+  }
+  if (m_write_iov.empty()) {
+    m_write_iov.resize(g_max_write_iov);
+  }
+  int iov_count = m_out_buffer->getReadIov(&m_write_iov[0], m_write_iov.size());
+  m_write_inflight = true;
+  m_event_loop->submitWrite(m_fd_event, &m_write_iov[0], iov_count, shared_from_this());
+  // 完成模式下记录的是提交的写操作数
+  m_event_loop->addWriteStats(0, 1);
+}
+
+void TcpConnection::onWriteCompleted() {
+  m_write_inflight = false;
+  int rt = m_fd_event->getResult(FdEvent::OUT_EVENT);
+  if (rt > 0) {
+    // 写完成之前这部分数据一直留在 out_buffer 中, 现在才移除
+    m_out_buffer->moveReadIndex(rt);
+    m_out_bytes_sent += rt;
+  }
+  if (m_state != Connected) {
+    return;
+  }
+  if (rt < 0 && rt != -EAGAIN && rt != -EINTR) {
+    // 不再继续写, 连接由读的一方在收到对端关闭时清理
+    ERRORLOG("write data error, errno=%d, error=%s, peer addr[%s]", -rt, strerror(-rt), m_peer_addr->toString().c_str());
+    return;
+  }
+
+  runWriteDones();
+
+  // 没写完的部分以及写的过程中追加的数据
+  submitWrite();
 }
 
 void TcpConnection::setState(const TcpState state) {
@@ -200,6 +355,9 @@ void TcpConnection::clear() {
   m_fd_event->cancel(FdEvent::OUT_EVENT);
 
   m_event_loop->deleteEpollEvent(m_fd_event);
+  // FdEvent 会随 fd 复用, 不能把边缘触发带给下一个使用者
+  m_fd_event->setEdgeTriggered(false);
+  m_edge_triggered_listening = false;
 
   m_state = Closed;
 }
@@ -227,29 +385,121 @@ void TcpConnection::setConnectionType(TcpConnectionType type) {
 }
 
 void TcpConnection::listenWrite() {
+  if (m_completion_io) {
+    // 服务端的连接由主线程创建, 提交必须在连接所属的 loop 线程中
+    if (!m_event_loop->isInLoopThread()) {
+      TcpConnection::s_ptr self = shared_from_this();
+      m_event_loop->addTask([self]() {
+        self->listenWrite();
+      }, true);
+      return;
+    }
+    listenCompletion();
+    submitWrite();
+    return;
+  }
+
+  if (m_event_loop->isEdgeTriggered()) {
+    // socket 本来就可写时不会再有可写通知, 所以直接发送, 发不完的部分等发送缓冲区腾出空间时的可写边沿
+    listenEdgeTriggered();
+    onWrite();
+    return;
+  }
   
   m_fd_event->listen(FdEvent::OUT_EVENT, std::bind(&TcpConnection::onWrite, this));
   m_event_loop->addEpollEvent(m_fd_event);
 }
 
 void TcpConnection::listenRead() {
+  if (m_completion_io) {
+    if (!m_event_loop->isInLoopThread()) {
+      TcpConnection::s_ptr self = shared_from_this();
+      m_event_loop->addTask([self]() {
+        self->listenRead();
+      }, true);
+      return;
+    }
+    listenCompletion();
+    submitRead();
+    return;
+  }
+
+  if (m_event_loop->isEdgeTriggered()) {
+    listenEdgeTriggered();
+    return;
+  }
 
   m_fd_event->listen(FdEvent::IN_EVENT, std::bind(&TcpConnection::onRead, this));
   m_event_loop->addEpollEvent(m_fd_event);
 }
 
-void TcpConnection::pushSendMessage(AbstractProtocol::s_ptr message, std::function<void(AbstractProtocol::s_ptr)> done) {
-  m_write_dones.push_back(std::make_pair(message, done));
+void TcpConnection::listenCompletion() {
+  // 服务端回包时直接提交写, 不经过 listenWrite, 所以读写的完成回调一起设置
+  m_fd_event->listen(FdEvent::IN_EVENT, std::bind(&TcpConnection::onRead, this));
+  m_fd_event->listen(FdEvent::OUT_EVENT, std::bind(&TcpConnection::onWrite, this));
 }
 
-void TcpConnection::pushReadMessage(const std::string& msg_id, std::function<void(AbstractProtocol::s_ptr)> done) {
-  m_read_dones.insert(std::make_pair(msg_id, done));
+void TcpConnection::listenEdgeTriggered() {
+  // EPOLLIN | EPOLLOUT | EPOLLET 只注册一次, 之后的请求和回包都不再调用 epoll_ctl
+  // onRead 会一直读到 socket 缓冲区读空, onWrite 写完后也不取消可写事件
+  if (m_edge_triggered_listening) {
+    return;
+  }
+  m_edge_triggered_listening = true;
+  m_fd_event->listen(FdEvent::IN_EVENT, std::bind(&TcpConnection::onRead, this));
+  m_fd_event->listen(FdEvent::OUT_EVENT, std::bind(&TcpConnection::onWrite, this));
+  m_fd_event->setEdgeTriggered(true);
+  m_event_loop->addEpollEvent(m_fd_event);
+}
+
+void TcpConnection::pushSendMessage(AbstractProtocol::s_ptr message, InlineFunction<void(AbstractProtocol::s_ptr)> done) {
+  // 到达时立即 encode 追加到 out_buffer 尾部, 多个请求按到达顺序写出, 每个 message 只 encode 一次
+  int before = m_out_buffer->readAble();
+  std::vector<AbstractProtocol::s_ptr> messages;
+  messages.push_back(message);
+  m_coder->encode(messages, m_out_buffer);
+  m_out_bytes_pushed += m_out_buffer->readAble() - before;
+  m_event_loop->addWriteStats(1, 0);
+
+  WriteDone write_done;
+  write_done.end_offset = m_out_bytes_pushed;
+  write_done.message = message;
+  write_done.done = std::move(done);
+  m_write_dones.push(std::move(write_done));
+}
+
+void TcpConnection::pushReadMessage(const std::string& msg_id, InlineFunction<void(AbstractProtocol::s_ptr)> done) {
+  m_read_dones.add(msg_id, std::move(done));
+}
+
+void TcpConnection::cancelReadMessage(const std::string& msg_id) {
+  m_read_dones.remove(msg_id);
+}
+
+int TcpConnection::getInflightCount() {
+  return m_read_dones.size();
+}
+
+void TcpConnection::negotiateProtocol() {
+  TinyPBCoder* coder = dynamic_cast<TinyPBCoder*>(m_coder);
+  Config* config = Config::GetGlobalConfig();
+  if (coder == NULL || (config && config->m_client_tinypb_version < 2)) {
+    return;
+  }
+  // 握手的回包由 coder 处理, 不需要读回调; 回包到达之前的请求仍然用 v1 发送
+  pushSendMessage(coder->makeHandshake(), InlineFunction<void(AbstractProtocol::s_ptr)>());
+  listenWrite();
+  listenRead();
 }
 
 NetAddr::s_ptr TcpConnection::getLocalAddr() {
   return m_local_addr;
 }
 
+EventLoop* TcpConnection::getEventLoop() {
+  return m_event_loop;
+}
+
 NetAddr::s_ptr TcpConnection::getPeerAddr() {
   return m_peer_addr;
 }
@@ -4,8 +4,12 @@
 #include <memory>
 #include <map>
 #include <queue>
+#include <vector>
+#include <sys/uio.h>
 #include "rocket/net/tcp/net_addr.h"
+#include "rocket/common/inline_function.h"
 #include "rocket/net/tcp/tcp_buffer.h"
+#include "rocket/net/tcp/inflight_table.h"
 #include "rocket/net/io_thread.h"
 #include "rocket/net/coder/abstract_coder.h"
 #include "rocket/net/rpc/rpc_dispatcher.h"
@@ -24,13 +28,13 @@ enum TcpConnectionType {
   TcpConnectionByClinet = 2, // 作为客户端使用, 代表跟对端服务端的连接
 };
 
-class TcpConnection {
+class TcpConnection : public std::enable_shared_from_this<TcpConnection> {
   public:
     typedef std::shared_ptr<TcpConnection> s_ptr;
 
   public:
 
-    TcpConnection(EventLoop* event_loop, int fd, int buffer_size, NetAddr::s_ptr peer_addr, NetAddr::s_ptr local_addr, TcpConnectionType type = TcpConnectionByServer);
+    TcpConnection(EventLoop* event_loop, int fd, NetAddr::s_ptr peer_addr, NetAddr::s_ptr local_addr, TcpConnectionType type = TcpConnectionByServer);
 
     ~TcpConnection();
 
@@ -59,16 +63,50 @@ class TcpConnection {
     // 启动监听可读事件
     void listenRead();
 
-    void pushSendMessage(AbstractProtocol::s_ptr message, std::function<void(AbstractProtocol::s_ptr)> done);
+    void pushSendMessage(AbstractProtocol::s_ptr message, InlineFunction<void(AbstractProtocol::s_ptr)> done);
 
-    void pushReadMessage(const std::string& msg_id, std::function<void(AbstractProtocol::s_ptr)> done);
+    void pushReadMessage(const std::string& msg_id, InlineFunction<void(AbstractProtocol::s_ptr)> done);
+
+    // 取消一个尚未收到回包的读回调(例如调用超时), 迟到的回包会被直接丢弃
+    void cancelReadMessage(const std::string& msg_id);
+
+    // 还在等回包的调用数
+    int getInflightCount();
+
+    // 客户端连接建立之后发送 TinyPB 握手请求, 对端支持时之后的请求使用 v2 帧
+    void negotiateProtocol();
 
     NetAddr::s_ptr getLocalAddr();
 
     NetAddr::s_ptr getPeerAddr();
 
+    EventLoop* getEventLoop();
+
     void reply(std::vector<AbstractProtocol::s_ptr>& reply_messages);
 
+  private:
+    // 边缘触发模式下一次性注册读写事件
+    void listenEdgeTriggered();
+
+    // 把 out_buffer 写到 socket, 写不完时监听可写事件
+    void sendOutBuffer();
+
+    // 执行已经完整发送出去的 message 的写回调
+    void runWriteDones();
+
+    // 完成模式(io_uring)下设置读写完成后执行的回调
+    void listenCompletion();
+
+    // 完成模式(io_uring)下提交读写, 同一时间每个方向最多一个在途的操作
+    void submitRead();
+
+    void submitWrite();
+
+    // 完成模式下读写完成后的处理, 由 onRead/onWrite 调用
+    void onReadCompleted();
+
+    void onWriteCompleted();
+
   private:
     EventLoop* m_event_loop {NULL};   // 代表持有该连接的 IO 线程
 
@@ -80,6 +118,19 @@ class TcpConnection {
 
     FdEvent* m_fd_event {NULL};
 
+    bool m_edge_triggered_listening {false};  // 边缘触发模式下读写事件是否已经注册
+
+    int m_reply_batch_bytes {0};    // 一轮 loop 内合并发送的回包字节数上限, 0 表示不合并
+    bool m_flush_pending {false};   // 是否已经有回包在等本轮 loop 结束时发送
+
+    // 完成模式(io_uring)下读写由内核完成后再通知, 在途的操作持有连接的 shared_ptr, in_buffer 和 out_buffer 在完成之前一直有效
+    bool m_completion_io {false};
+    bool m_read_inflight {false};
+    bool m_write_inflight {false};
+    int m_read_size {0};              // 在途的读预留的字节数
+    int m_read_blocks {1};            // 下次读预留的 block 数, 上次读满了才加大, 空闲连接只占一个 block
+    std::vector<iovec> m_write_iov;   // 在途的写使用的 iovec, 完成之前不能修改
+
     AbstractCoder* m_coder {NULL};
 
     TcpState m_state;
@@ -88,11 +139,20 @@ class TcpConnection {
 
     TcpConnectionType m_connection_type {TcpConnectionByServer};
 
-    // std::pair<AbstractProtocol::s_ptr, std::function<void(AbstractProtocol::s_ptr)>>
-    std::vector<std::pair<AbstractProtocol::s_ptr, std::function<void(AbstractProtocol::s_ptr)>>> m_write_dones;
+    struct WriteDone {
+      int64_t end_offset {0};   // message 编码后最后一个字节在发送字节流中的位置
+      AbstractProtocol::s_ptr message;
+      InlineFunction<void(AbstractProtocol::s_ptr)> done;
+    };
+
+    // 按写入顺序排列, 字节流发送到 end_offset 之后执行对应的写回调
+    std::queue<WriteDone> m_write_dones;
+
+    int64_t m_out_bytes_pushed {0};  // 累计写入 out_buffer 的字节数
+    int64_t m_out_bytes_sent {0};    // 累计发送到 socket 的字节数
 
-    // key 为 msg_id
-    std::map<std::string, std::function<void(AbstractProtocol::s_ptr)>> m_read_dones;
+    // 客户端连接上等待回包的读回调
+    InflightTable m_read_dones;
 
 };
 
@@ -1,6 +1,7 @@
 #include "rocket/net/tcp/tcp_server.h"
 #include "rocket/net/eventloop.h"
 #include "rocket/net/tcp/tcp_connection.h"
+#include "rocket/net/tcp/buffer_block_pool.h"
 #include "rocket/common/log.h"
 #include "rocket/common/config.h"
 
@@ -34,11 +35,19 @@ void TcpServer::init() {
 
   m_main_event_loop = EventLoop::GetCurrentEventLoop();
   m_io_thread_group = new IOThreadGroup(Config::GetGlobalConfig()->m_io_threads);
+  // busy poll 只用在服务端的 IO 线程上, 主线程只负责 accept
+  for (int i = 0; i < m_io_thread_group->getSize(); ++i) {
+    m_io_thread_group->getIOThread(i)->getEventLoop()->setBusyPollUs(Config::GetGlobalConfig()->m_busy_poll_us);
+  }
 
   m_listen_fd_event = new FdEvent(m_acceptor->getListenFd());
   m_listen_fd_event->listen(FdEvent::IN_EVENT, std::bind(&TcpServer::onAccept, this));
 
-  m_main_event_loop->addEpollEvent(m_listen_fd_event);
+  if (m_main_event_loop->isCompletionIO()) {
+    submitAccept();
+  } else {
+    m_main_event_loop->addEpollEvent(m_listen_fd_event);
+  }
 
   m_clear_client_timer_event = std::make_shared<TimerEvent>(5000, true, std::bind(&TcpServer::ClearClientTimerFunc, this));
   m_main_event_loop->addTimerEvent(m_clear_client_timer_event);
@@ -47,22 +56,40 @@ void TcpServer::init() {
 
 void TcpServer::onAccept() {
   // 监听到客户端连接之后, 进行accept, 返回[客户端fd]以及[客户端网络地址]
-  auto re = m_acceptor->accept();
+  std::pair<int, NetAddr::s_ptr> re;
+  if (m_main_event_loop->isCompletionIO()) {
+    // accept 已经由内核完成, 取出结果后立即提交下一个
+    re = m_acceptor->onAccepted(m_listen_fd_event->getResult(FdEvent::IN_EVENT));
+    submitAccept();
+    if (re.first < 0) {
+      return;
+    }
+  } else {
+    re = m_acceptor->accept();
+  }
   int client_fd = re.first;
   NetAddr::s_ptr peer_addr = re.second;
   m_client_counts ++ ;
 
   // 把 clientfd 添加到任意 IO 线程里面
   IOThread* io_thread = m_io_thread_group->getIOThread();
-  TcpConnection::s_ptr connection = std::make_shared<TcpConnection>(io_thread->getEventLoop(), client_fd, 128, peer_addr, m_local_addr);
-  connection->setState(Connected);
+  TcpConnection::s_ptr connection = std::make_shared<TcpConnection>(io_thread->getEventLoop(), client_fd, peer_addr, m_local_addr);
 
   // 客户端连接持久化, 防止析构
   m_client.insert(connection);
 
+  // 连接已经被 shared_ptr 持有, 再交给 IO 线程监听可读事件
+  connection->listenRead();
+
   INFOLOG("TcpServer succ get client, fd=%d", client_fd);
 }
 
+void TcpServer::submitAccept() {
+  socklen_t* addr_len = NULL;
+  sockaddr* addr = m_acceptor->prepareAccept(&addr_len);
+  m_main_event_loop->submitAccept(m_listen_fd_event, addr, addr_len, m_acceptor);
+}
+
 void TcpServer::start() {
   m_io_thread_group->start();
   m_main_event_loop->loop();
@@ -81,6 +108,36 @@ void TcpServer::ClearClientTimerFunc() {
       it ++ ;
     }
   }
+
+  BufferBlockPoolStats stats;
+  BufferBlockPool::GetGlobalStats(stats);
+  DEBUGLOG("buffer block pool alloc[%lld] hit rate[%.2f] free blocks[%lld] resident[%lld B]",
+    (long long)stats.alloc_count, stats.hitRate(), (long long)stats.free_blocks, (long long)stats.resident_bytes);
+
+  // 回包合并的效果: 平均每次写 socket 发出去的消息数
+  int64_t frames = 0;
+  int64_t syscalls = 0;
+  for (int i = 0; i < m_io_thread_group->getSize(); ++i) {
+    EventLoop* event_loop = m_io_thread_group->getIOThread(i)->getEventLoop();
+    frames += event_loop->getWriteFrameCount();
+    syscalls += event_loop->getWriteSyscallCount();
+  }
+  DEBUGLOG("write frames[%lld] syscalls[%lld] frames per syscall[%.2f]",
+    (long long)frames, (long long)syscalls, syscalls == 0 ? 0 : (double)frames / syscalls);
+
+  if (Config::GetGlobalConfig()->m_busy_poll_us > 0) {
+    BusyPollStats total;
+    for (int i = 0; i < m_io_thread_group->getSize(); ++i) {
+      BusyPollStats busy_poll_stats;
+      m_io_thread_group->getIOThread(i)->getEventLoop()->getBusyPollStats(busy_poll_stats);
+      total.spin_us += busy_poll_stats.spin_us;
+      total.work_us += busy_poll_stats.work_us;
+      total.spin_hits += busy_poll_stats.spin_hits;
+      total.spin_misses += busy_poll_stats.spin_misses;
+    }
+    DEBUGLOG("busy poll spin[%lld us] work[%lld us] spin hits[%lld] misses[%lld]",
+      (long long)total.spin_us, (long long)total.work_us, (long long)total.spin_hits, (long long)total.spin_misses);
+  }
 }
 
 }
\ No newline at end of file
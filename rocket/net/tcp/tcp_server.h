@@ -24,6 +24,9 @@ class TcpServer {
     // 当有新客户端连接之后, 需要执行
     void onAccept();
 
+    // 完成模式(io_uring)下提交下一个 accept
+    void submitAccept();
+
     // 清除 closed 的连接
     void ClearClientTimerFunc();
 
@@ -31,10 +31,9 @@ void Timer::onTimer() {
   }
 
   // 执行定时任务
-  int64_t now = getNowMs();
+  int64_t now = getLoopNowUs();
 
   std::vector<TimerEvent::s_ptr> tmps;
-  std::vector<std::pair<int64_t, std::function<void()>>> tasks;
 
   ScopeMutex<Mutex> lock(m_mutex);
   auto it = m_pending_events.begin();
@@ -45,7 +44,6 @@ void Timer::onTimer() {
     }
     if (!(*it).second->isCanceled()) {
       tmps.push_back((*it).second);
-      tasks.push_back(std::make_pair((*it).second->getArriveTime(), (*it).second->getCallBack()));
     }
   }
 
@@ -64,38 +62,37 @@ void Timer::onTimer() {
   // 确保定时器的有效, 即[维护距离它最近执行的任务的差值interval作为超时时间]
   resetArriveTime();
 
-  // 执行任务
-  for (auto i : tasks) {
-    if (i.second) {
-      i.second();
+  // 执行任务, tmps 持有 TimerEvent, 回调在执行期间不会被释放
+  for (auto i = tmps.begin(); i != tmps.end(); ++i) {
+    InlineFunction<void()>& task = (*i)->getCallBack();
+    if (task) {
+      task();
     }
   }
 }
 
 void Timer::resetArriveTime() {
   ScopeMutex<Mutex> lock(m_mutex);
-  auto tmp = m_pending_events;
-  lock.unlock();
-
-  if (tmp.size() == 0) {
+  if (m_pending_events.empty()) {
     return;
   }
+  // 只需要最近的到期时间, 不用拷贝整个队列
+  int64_t arrive_time = m_pending_events.begin()->first;
+  lock.unlock();
 
-  int64_t now = getNowMs();
-
-  auto it = tmp.begin();
-  int64_t interval = 0;
-  // 距离当前时间最近的任务还未超时
-  if (it->second->getArriveTime() > now) {
-    interval = it->second->getArriveTime() - now;
-  } else { // 已超时, 给一个默认最小间隔时间(100ms), 赶紧执行
-    interval = 100;
-  }
+  // 这里用实时的时钟, 缓存的时间可能已经落后, 算出来的间隔会偏大
+  int64_t now = getNowUs();
 
   timespec ts;
   memset(&ts, 0, sizeof(ts));
-  ts.tv_sec = interval / 1000;
-  ts.tv_nsec = (interval % 1000) * 1000000;
+  // 距离当前时间最近的任务还未超时
+  if (arrive_time > now) {
+    int64_t interval = arrive_time - now;
+    ts.tv_sec = interval / 1000000;
+    ts.tv_nsec = (interval % 1000000) * 1000;
+  } else { // 已超时, 设置最小的间隔(it_value 全 0 会停掉定时器), 立即触发
+    ts.tv_nsec = 1;
+  }
 
   itimerspec value;
   memset(&value, 0, sizeof(value));
@@ -153,4 +150,9 @@ void Timer::deleteTimerEvent(TimerEvent::s_ptr event) {
   DEBUGLOG("success delete TimerEvent at arrive time %lld", event->getArriveTime());
 }
 
+int Timer::size() {
+  ScopeMutex<Mutex> lock(m_mutex);
+  return m_pending_events.size();
+}
+
 }
\ No newline at end of file
@@ -8,19 +8,24 @@
 
 namespace rocket_rpc {
 
+// 基于 multimap 的定时器, 按到期时间排序
+// 可以被 TimingWheelTimer 等其他实现替换, 由 EventLoop 根据配置选择
 class Timer : public FdEvent {
 
   public:
   
     Timer();
 
-    ~Timer();
+    virtual ~Timer();
 
-    void addTimerEvent(TimerEvent::s_ptr event);
+    virtual void addTimerEvent(TimerEvent::s_ptr event);
 
-    void deleteTimerEvent(TimerEvent::s_ptr event);
+    virtual void deleteTimerEvent(TimerEvent::s_ptr event);
 
-    void onTimer(); // 当发生了 IO 事件后, eventloop 会执行这个回调函数
+    virtual void onTimer(); // 当发生了 IO 事件后, eventloop 会执行这个回调函数
+
+    // 当前挂着的定时任务数
+    virtual int size();
 
   private:
     void resetArriveTime();
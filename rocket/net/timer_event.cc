@@ -4,13 +4,14 @@
 
 namespace rocket_rpc {
 
-TimerEvent::TimerEvent(int interval, bool is_repeated, std::function<void()> cb)
-   : m_interval(interval), m_is_repeated(is_repeated), m_task(cb) {
+TimerEvent::TimerEvent(int interval, bool is_repeated, InlineFunction<void()> cb)
+   : m_interval(interval), m_is_repeated(is_repeated), m_task(std::move(cb)) {
   resetArriveTime();
 }
 
 void TimerEvent::resetArriveTime() {
-  m_arrive_time = getNowMs() + m_interval;
+  // 在 loop 线程中以本轮缓存的时间为起点
+  m_arrive_time = getLoopNowUs() + m_interval * 1000;
   // DEBUGLOG("success create timer event, will execute at [%lld]", m_arrive_time);
 }
 
@@ -3,6 +3,8 @@
 
 #include <functional>
 #include <memory>
+#include <list>
+#include "rocket/common/inline_function.h"
 
 namespace rocket_rpc {
 
@@ -11,7 +13,7 @@ class TimerEvent {
   public:
     typedef std::shared_ptr<TimerEvent> s_ptr;
 
-    TimerEvent(int interval, bool is_repeated, std::function<void()> cb);
+    TimerEvent(int interval, bool is_repeated, InlineFunction<void()> cb);
 
     int64_t getArriveTime() const {
       return m_arrive_time;
@@ -29,19 +31,28 @@ class TimerEvent {
       return m_is_repeated;
     }
 
-    std::function<void()> getCallBack() {
+    // 回调不能拷贝, 到期时由定时器持有 TimerEvent 直接调用
+    InlineFunction<void()>& getCallBack() {
       return m_task;
     }
 
     void resetArriveTime();
 
   private:
-    int64_t m_arrive_time;  // ms
+    friend class TimingWheelTimer;
+
+    // 在时间轮中的位置, 删除时直接从所在的槽中摘除, 不在时间轮中时 m_wheel_slot 为 NULL
+    std::list<s_ptr>* m_wheel_slot {NULL};
+    std::list<s_ptr>::iterator m_wheel_it;
+    int m_wheel_level {0};
+
+  private:
+    int64_t m_arrive_time;  // us, 单调时钟
     int64_t m_interval;     // ms
     bool m_is_repeated {false};
     bool m_is_canceled {false};
 
-    std::function<void()> m_task;
+    InlineFunction<void()> m_task;
 };
 
 }
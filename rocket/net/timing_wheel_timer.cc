@@ -0,0 +1,269 @@
+#include <sys/timerfd.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include "rocket/net/timing_wheel_timer.h"
+#include "rocket/common/log.h"
+#include "rocket/common/util.h"
+
+namespace rocket_rpc {
+
+static const int g_wheel0_bits = 8;
+static const int g_wheeln_bits = 6;
+
+// 第 level 层每个槽的跨度是 1 << g_level_shift[level] 个 tick
+static const int g_level_shift[] = {0, 8, 14, 20};
+static const int g_level_mask[] = {(1 << g_wheel0_bits) - 1, (1 << g_wheeln_bits) - 1, (1 << g_wheeln_bits) - 1, (1 << g_wheeln_bits) - 1};
+
+// 时间轮能覆盖的最大延迟
+static const int64_t g_max_delay = (1LL << (g_wheel0_bits + 3 * g_wheeln_bits)) - 1;
+
+TimingWheelTimer::TimingWheelTimer() : Timer() {
+  m_wheels[0].resize(1 << g_wheel0_bits);
+  for (int i = 1; i < LEVELS; ++i) {
+    m_wheels[i].resize(1 << g_wheeln_bits);
+  }
+  m_current_tick = getNowUs() / 1000;
+}
+
+TimingWheelTimer::~TimingWheelTimer() {
+  // 槽中的任务持有的位置信息指向本对象, 析构前先清理掉
+  for (int i = 0; i < LEVELS; ++i) {
+    for (size_t j = 0; j < m_wheels[i].size(); ++j) {
+      for (auto it = m_wheels[i][j].begin(); it != m_wheels[i][j].end(); ++it) {
+        (*it)->m_wheel_slot = NULL;
+      }
+    }
+  }
+}
+
+void TimingWheelTimer::insert(TimerEvent::s_ptr event) {
+  int64_t expire = event->getArriveTime() / 1000;
+  // 已经到期的任务放到当前槽, 尽快执行
+  if (expire < m_current_tick) {
+    expire = m_current_tick;
+  }
+  int64_t delay = expire - m_current_tick;
+  if (delay > g_max_delay) {
+    expire = m_current_tick + g_max_delay;
+    delay = g_max_delay;
+  }
+
+  int level = 0;
+  if (delay < (1LL << g_level_shift[1])) {
+    level = 0;
+  } else if (delay < (1LL << g_level_shift[2])) {
+    level = 1;
+  } else if (delay < (1LL << g_level_shift[3])) {
+    level = 2;
+  } else {
+    level = 3;
+  }
+
+  Slot& slot = m_wheels[level][(expire >> g_level_shift[level]) & g_level_mask[level]];
+  slot.push_back(event);
+  event->m_wheel_slot = &slot;
+  event->m_wheel_it = --slot.end();
+  event->m_wheel_level = level;
+  m_counts[level] ++ ;
+  m_size ++ ;
+
+  // 上层的任务最晚在第 0 层转完一圈时醒来做一次降级, 与 nextTime 一致
+  int64_t next = event->getArriveTime();
+  if (level > 0) {
+    next = std::min(next, (((m_current_tick >> g_wheel0_bits) + 1) << g_wheel0_bits) * 1000);
+  }
+  if (m_next_time == -1 || next < m_next_time) {
+    m_next_time = next;
+  }
+}
+
+void TimingWheelTimer::remove(TimerEvent::s_ptr event) {
+  if (event->m_wheel_slot == NULL) {
+    return;
+  }
+  Slot* slot = event->m_wheel_slot;
+  event->m_wheel_slot = NULL;
+  m_counts[event->m_wheel_level] -- ;
+  m_size -- ;
+  // 最后摘除, slot 中持有的可能是 event 的最后一个引用
+  slot->erase(event->m_wheel_it);
+}
+
+void TimingWheelTimer::cascade(int level, int index) {
+  Slot tmp;
+  tmp.swap(m_wheels[level][index]);
+  m_counts[level] -= tmp.size();
+  m_size -= tmp.size();
+  for (auto it = tmp.begin(); it != tmp.end(); ++it) {
+    insert(*it);
+  }
+}
+
+void TimingWheelTimer::advance(int64_t now, std::vector<TimerEvent::s_ptr>& expired) {
+  int64_t now_tick = now / 1000;
+  while (m_current_tick < now_tick) {
+    if (m_size == 0) {
+      // 时间轮为空, 直接跳过中间的 tick
+      m_current_tick = now_tick;
+      break;
+    }
+
+    // 之前的槽中的任务都已经到期
+    Slot& slot = m_wheels[0][m_current_tick & g_level_mask[0]];
+    for (auto it = slot.begin(); it != slot.end(); ++it) {
+      (*it)->m_wheel_slot = NULL;
+      expired.push_back(*it);
+    }
+    m_counts[0] -= slot.size();
+    m_size -= slot.size();
+    slot.clear();
+
+    m_current_tick ++ ;
+
+    int index = m_current_tick & g_level_mask[0];
+    // 低层转完一圈, 把上层对应槽中的任务降级下来, 上层也转完一圈时继续向上
+    for (int level = 1; index == 0 && level < LEVELS; ++level) {
+      index = (m_current_tick >> g_level_shift[level]) & g_level_mask[level];
+      cascade(level, index);
+    }
+  }
+
+  // 当前槽只摘除已经到期的任务, 其余的留到下一次
+  Slot& slot = m_wheels[0][m_current_tick & g_level_mask[0]];
+  for (auto it = slot.begin(); it != slot.end(); ) {
+    if ((*it)->getArriveTime() > now) {
+      ++it;
+      continue;
+    }
+    (*it)->m_wheel_slot = NULL;
+    expired.push_back(*it);
+    m_counts[0] -- ;
+    m_size -- ;
+    it = slot.erase(it);
+  }
+}
+
+int64_t TimingWheelTimer::nextTime() {
+  if (m_size == 0) {
+    return -1;
+  }
+  // 上层有任务时, 最晚在第 0 层转完一圈时要醒来做一次降级
+  int64_t limit = 1 << g_wheel0_bits;
+  if (m_counts[0] != m_size) {
+    limit = (1 << g_wheel0_bits) - (m_current_tick & g_level_mask[0]);
+  }
+  if (m_counts[0] > 0) {
+    for (int64_t i = 0; i < limit; ++i) {
+      Slot& slot = m_wheels[0][(m_current_tick + i) & g_level_mask[0]];
+      if (slot.empty()) {
+        continue;
+      }
+      // 槽内的任务没有排序, 取最早的到期时间
+      int64_t next = slot.front()->getArriveTime();
+      for (auto it = slot.begin(); it != slot.end(); ++it) {
+        if ((*it)->getArriveTime() < next) {
+          next = (*it)->getArriveTime();
+        }
+      }
+      return next;
+    }
+  }
+  return (m_current_tick + limit) * 1000;
+}
+
+void TimingWheelTimer::resetTimerFd(int64_t next) {
+  int64_t interval = next - getNowUs();
+
+  timespec ts;
+  memset(&ts, 0, sizeof(ts));
+  if (interval > 0) {
+    ts.tv_sec = interval / 1000000;
+    ts.tv_nsec = (interval % 1000000) * 1000;
+  } else {
+    // 已经到期, 设置最小的间隔(it_value 全 0 会停掉定时器), 立即触发
+    ts.tv_nsec = 1;
+  }
+
+  itimerspec value;
+  memset(&value, 0, sizeof(value));
+  value.it_value = ts;
+
+  int rt = timerfd_settime(m_fd, 0, &value, NULL);
+  if (rt != 0) {
+    ERRORLOG("timerfd_settime error, errno=%d, error=%s", errno, strerror(errno));
+  }
+}
+
+void TimingWheelTimer::addTimerEvent(TimerEvent::s_ptr event) {
+  ScopeMutex<Mutex> lock(m_mutex);
+  int64_t before = m_next_time;
+  // 重复添加时先摘除原来的位置
+  remove(event);
+  insert(event);
+  // 只有最近一次的唤醒时间提前了才需要重设 timerfd
+  // 在锁内设置, 否则并发添加时较晚的时间可能覆盖掉较早的
+  if (m_next_time != before) {
+    resetTimerFd(m_next_time);
+  }
+  lock.unlock();
+}
+
+void TimingWheelTimer::deleteTimerEvent(TimerEvent::s_ptr event) {
+  event->setCanceled(true);
+
+  ScopeMutex<Mutex> lock(m_mutex);
+  remove(event);
+  lock.unlock();
+}
+
+int TimingWheelTimer::size() {
+  ScopeMutex<Mutex> lock(m_mutex);
+  return m_size;
+}
+
+void TimingWheelTimer::onTimer() {
+  // 处理缓冲区数据, 防止下一次继续触发可读事件
+  char buf[8];
+  while (1) {
+    if ((read(m_fd, buf, 8) == -1) && errno == EAGAIN) {
+      break;
+    }
+  }
+
+  std::vector<TimerEvent::s_ptr> expired;
+
+  std::vector<TimerEvent::s_ptr> tasks;
+
+  ScopeMutex<Mutex> lock(m_mutex);
+  advance(getLoopNowUs(), expired);
+  for (auto i = expired.begin(); i != expired.end(); ++i) {
+    if ((*i)->isCanceled()) {
+      continue;
+    }
+    tasks.push_back(*i);
+    // 需要把重复的 Event 再次添加进去
+    if ((*i)->isRepeated()) {
+      (*i)->resetArriveTime();
+      insert(*i);
+    }
+  }
+  // 重新扫描时间轮, 删除的任务以及 insert 时提前的时间都在这里修正
+  m_next_time = -1;
+  int64_t next = nextTime();
+  if (next != -1) {
+    m_next_time = next;
+    resetTimerFd(next);
+  }
+  lock.unlock();
+
+  // 执行任务, tasks 持有 TimerEvent, 回调在执行期间不会被释放
+  for (auto i = tasks.begin(); i != tasks.end(); ++i) {
+    InlineFunction<void()>& task = (*i)->getCallBack();
+    if (task) {
+      task();
+    }
+  }
+}
+
+}
\ No newline at end of file
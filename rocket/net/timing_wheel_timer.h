@@ -0,0 +1,71 @@
+#ifndef ROCKET_RPC_NET_TIMING_WHEEL_TIMER_H
+#define ROCKET_RPC_NET_TIMING_WHEEL_TIMER_H
+
+#include <list>
+#include <vector>
+#include "rocket/common/mutex.h"
+#include "rocket/net/timer.h"
+#include "rocket/net/timer_event.h"
+
+namespace rocket_rpc {
+
+// 分层时间轮定时器, 每个槽 1ms
+// 第 0 层 256 个槽, 每槽 1ms; 之后每层 64 个槽, 每槽是下一层一整圈的时间
+// 4 层一共覆盖约 18.6 小时, 更远的任务先挂在最高层, 降级的时候再重新计算位置
+// 添加和删除都是 O(1), 到期时只处理当前槽, 不需要像 multimap 那样排序和拷贝
+// 最近的唤醒时间缓存在 m_next_time 中, 添加时只和它比较, 只有 onTimer 才重新扫描时间轮
+// 当前槽内按 us 比较到期时间, timerfd 也按最早任务的 us 设置, 所以精度不受槽宽限制
+class TimingWheelTimer : public Timer {
+
+  public:
+    TimingWheelTimer();
+
+    ~TimingWheelTimer();
+
+    void addTimerEvent(TimerEvent::s_ptr event);
+
+    void deleteTimerEvent(TimerEvent::s_ptr event);
+
+    void onTimer();
+
+    int size();
+
+  private:
+    typedef std::list<TimerEvent::s_ptr> Slot;
+
+    // 以下函数都需要在持有 m_mutex 的情况下调用
+    void insert(TimerEvent::s_ptr event);
+
+    void remove(TimerEvent::s_ptr event);
+
+    // 把第 level 层的 index 槽中的任务重新放到下层
+    void cascade(int level, int index);
+
+    // 推进到 now(us), 到期的任务从时间轮中摘除后放入 expired
+    void advance(int64_t now, std::vector<TimerEvent::s_ptr>& expired);
+
+    // 扫描时间轮得到下一次需要醒来的时间(us), 时间轮为空时返回 -1, 只在 onTimer 中调用
+    int64_t nextTime();
+
+    // 把 timerfd 设置为在 next(us) 到期
+    void resetTimerFd(int64_t next);
+
+  private:
+    static const int LEVELS = 4;
+
+    std::vector<Slot> m_wheels[LEVELS];
+    int m_counts[LEVELS] {0};
+
+    int64_t m_current_tick {0};   // 当前处理到的 tick(ms, 单调时钟), 之前的槽都已经处理完
+    int m_size {0};
+
+    // timerfd 当前设置的唤醒时间(us), -1 表示没有设置
+    // insert 只会把它提前, 删除任务时不更新, 多出来的一次唤醒由 onTimer 重新计算
+    int64_t m_next_time {-1};
+
+    Mutex m_mutex;
+};
+
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,190 @@
+#include <stdlib.h>
+#include "rocket/net/worker_pool.h"
+#include "rocket/common/log.h"
+
+namespace rocket_rpc {
+
+// 投递线程的编号, 第一次投递时分配, 决定投递到哪个 worker 的队列
+// 投递线程一般就是 IO 线程, 编号连续, IO 线程数不超过 worker 数时每个队列只有一个投递线程
+static std::atomic<int> g_producer_count {0};
+static thread_local int t_producer_index = -1;
+
+WorkerPool::WorkerPool(const std::string& name, int size, int queue_size)
+  : m_name(name), m_size(size), m_queue_size(queue_size) {
+  if (m_size <= 0) {
+    m_size = 1;
+  }
+  if (m_queue_size <= 0) {
+    m_queue_size = 1;
+  }
+  pthread_cond_init(&m_condition, NULL);
+  m_workers.resize(m_size);
+  for (int i = 0; i < m_size; ++i) {
+    m_workers[i] = new Worker();
+    m_workers[i]->pool = this;
+    m_workers[i]->index = i;
+    m_workers[i]->tasks = new WorkStealDeque<Task*>(m_queue_size);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  stop();
+  for (size_t i = 0; i < m_workers.size(); ++i) {
+    // 没有启动过或者停止之后才投递的任务直接丢弃
+    Task* task = NULL;
+    while (m_workers[i]->tasks->steal(task)) {
+      delete task;
+    }
+    delete m_workers[i]->tasks;
+    delete m_workers[i];
+  }
+  m_workers.clear();
+  pthread_cond_destroy(&m_condition);
+}
+
+void WorkerPool::start() {
+  if (m_started) {
+    return;
+  }
+  m_started = true;
+  for (size_t i = 0; i < m_workers.size(); ++i) {
+    pthread_create(&m_workers[i]->thread, NULL, &WorkerPool::Main, m_workers[i]);
+  }
+  INFOLOG("worker pool [%s] start, workers[%d], queue size[%d]", m_name.c_str(), m_size, (int)m_workers[0]->tasks->capacity());
+}
+
+void WorkerPool::stop() {
+  if (!m_started) {
+    return;
+  }
+  m_started = false;
+
+  ScopeMutex<Mutex> lock(m_mutex);
+  m_stop = true;
+  pthread_cond_broadcast(&m_condition);
+  lock.unlock();
+
+  for (size_t i = 0; i < m_workers.size(); ++i) {
+    pthread_join(m_workers[i]->thread, NULL);
+  }
+  INFOLOG("worker pool [%s] stop, rejected[%lld], steals[%lld]", m_name.c_str(),
+    (long long)m_rejected.load(), (long long)m_steals.load());
+}
+
+bool WorkerPool::submit(Task task) {
+  if (m_stop.load(std::memory_order_relaxed)) {
+    m_rejected.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  if (t_producer_index == -1) {
+    t_producer_index = g_producer_count.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // 队列中只放指针, 槽可以被原子地读写
+  Task* item = new Task(std::move(task));
+  int begin = t_producer_index % m_size;
+  bool succ = false;
+  // 配对的队列满了再依次尝试其他队列
+  for (int i = 0; i < m_size && !succ; ++i) {
+    Worker* worker = m_workers[(begin + i) % m_size];
+    ScopeMutex<Mutex> lock(worker->push_mutex);
+    succ = worker->tasks->push(item);
+  }
+  if (!succ) {
+    delete item;
+    m_rejected.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  // 先 push 再检查是否有 worker 在睡眠, 与 worker 先登记 m_idle 再检查队列配对, 两边至少有一边能看到对方
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (m_idle.load(std::memory_order_relaxed) > 0) {
+    ScopeMutex<Mutex> lock(m_mutex);
+    pthread_cond_signal(&m_condition);
+  }
+  return true;
+}
+
+WorkerPool::Task* WorkerPool::take(Worker* worker, unsigned int& seed) {
+  // 自己的队列由 IO 线程投递, worker 也是从 top 一端取, 按投递顺序执行
+  Task* task = NULL;
+  if (worker->tasks->steal(task)) {
+    return task;
+  }
+  if (m_size == 1) {
+    return NULL;
+  }
+
+  // 从随机的位置开始窃取, 避免空闲的 worker 都挤在同一个队列上
+  int begin = rand_r(&seed) % m_size;
+  for (int i = 0; i < m_size; ++i) {
+    Worker* victim = m_workers[(begin + i) % m_size];
+    if (victim == worker || victim->tasks->empty()) {
+      continue;
+    }
+    if (victim->tasks->steal(task)) {
+      m_steals.fetch_add(1, std::memory_order_relaxed);
+      return task;
+    }
+  }
+  return NULL;
+}
+
+bool WorkerPool::hasTask() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  for (int i = 0; i < m_size; ++i) {
+    if (!m_workers[i]->tasks->empty()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int WorkerPool::getSize() {
+  return m_size;
+}
+
+int64_t WorkerPool::getRejectedCount() {
+  return m_rejected.load(std::memory_order_relaxed);
+}
+
+int64_t WorkerPool::getStealCount() {
+  return m_steals.load(std::memory_order_relaxed);
+}
+
+void* WorkerPool::Main(void* arg) {
+  Worker* worker = static_cast<Worker*>(arg);
+  WorkerPool* pool = worker->pool;
+  unsigned int seed = worker->index + 1;
+  DEBUGLOG("worker %d of pool [%s] start", worker->index, pool->m_name.c_str());
+
+  while (true) {
+    Task* task = pool->take(worker, seed);
+    if (task) {
+      if (*task) {
+        (*task)();
+      }
+      delete task;
+      continue;
+    }
+
+    // 窃取可能因为竞争失败, 睡眠前在锁内再确认一次所有队列都是空的
+    ScopeMutex<Mutex> lock(pool->m_mutex);
+    pool->m_idle.fetch_add(1, std::memory_order_seq_cst);
+    bool has_task = pool->hasTask();
+    if (!has_task && pool->m_stop.load()) {
+      // 停止时队列已经取空, 退出
+      pool->m_idle.fetch_sub(1, std::memory_order_relaxed);
+      break;
+    }
+    if (!has_task) {
+      pthread_cond_wait(&pool->m_condition, pool->m_mutex.getMutex());
+    }
+    pool->m_idle.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  DEBUGLOG("worker %d of pool [%s] exit", worker->index, pool->m_name.c_str());
+  return NULL;
+}
+
+}
\ No newline at end of file
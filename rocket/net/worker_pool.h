@@ -0,0 +1,80 @@
+#ifndef ROCKET_RPC_NET_WORKER_POOL_H
+#define ROCKET_RPC_NET_WORKER_POOL_H
+
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "rocket/common/mutex.h"
+#include "rocket/common/inline_function.h"
+#include "rocket/common/work_steal_deque.h"
+
+namespace rocket_rpc {
+
+// 业务线程池, 用来执行 rpc 方法, 不占用 IO 线程
+// 每个 worker 有一个有界的 Chase-Lev 队列, 投递线程(IO 线程)按自己的编号固定投递到配对 worker 的队列中
+// worker 先取自己的队列, 空了以后随机挑选其他 worker 窃取, 不同 IO 线程之间, worker 之间都没有共享的锁
+// 所有队列都满时投递失败, 由调用方直接拒绝请求, 不会无限堆积
+class WorkerPool {
+
+  public:
+    typedef InlineFunction<void()> Task;
+
+    // queue_size 为每个 worker 队列的长度上限(向上取整到 2 的幂)
+    WorkerPool(const std::string& name, int size, int queue_size);
+
+    ~WorkerPool();
+
+    void start();
+
+    // 停止接收新任务, 等待已经投递的任务执行完之后 worker 退出
+    void stop();
+
+    // 投递任务, 可以在任意线程调用, 所有队列都满时返回 false
+    bool submit(Task task);
+
+    int getSize();
+
+    int64_t getRejectedCount();
+
+    // worker 从其他 worker 的队列中窃取到的任务数
+    int64_t getStealCount();
+
+  public:
+    static void* Main(void* arg);
+
+  private:
+    struct Worker {
+      WorkerPool* pool {NULL};
+      int index {0};
+      pthread_t thread {0};
+      WorkStealDeque<Task*>* tasks {NULL};
+      Mutex push_mutex;   // 只在投递线程之间互斥, 投递线程比 worker 多时才会有多个线程往同一个队列投递
+    };
+
+    // 取一个任务, 先取自己的队列, 再从随机的位置开始依次窃取
+    Task* take(Worker* worker, unsigned int& seed);
+
+    bool hasTask();
+
+  private:
+    std::string m_name;
+    int m_size {0};
+    int m_queue_size {0};
+    bool m_started {false};
+
+    std::vector<Worker*> m_workers;
+
+    // 所有 worker 都找不到任务时在这里睡眠
+    Mutex m_mutex;
+    pthread_cond_t m_condition;
+    std::atomic<int> m_idle {0};
+    std::atomic<bool> m_stop {false};
+
+    std::atomic<int64_t> m_rejected {0};
+    std::atomic<int64_t> m_steals {0};
+};
+
+}
+
+#endif
\ No newline at end of file
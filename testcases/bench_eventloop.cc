@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <vector>
+#include "rocket/common/log.h"
+#include "rocket/common/config.h"
+#include "rocket/net/eventloop.h"
+#include "rocket/net/fd_event.h"
+#include "rocket/net/io_thread.h"
+
+// EventLoop 的吞吐测试
+// 1. tasks/sec: 多个线程同时向一个 IO 线程投递任务
+// 2. events/sec: 一个 IO 线程上若干对 socketpair 互相乒乓, 统计每秒处理的读事件数, 分别使用 epoll 和 io_uring
+
+static int64_t nowUs() {
+  timeval val;
+  gettimeofday(&val, NULL);
+  return val.tv_sec * 1000000 + val.tv_usec;
+}
+
+static std::atomic<int64_t> g_task_done {0};
+
+struct ProducerArg {
+  rocket_rpc::EventLoop* event_loop;
+  int count;
+};
+
+static void* producer(void* arg) {
+  ProducerArg* producer_arg = static_cast<ProducerArg*>(arg);
+  for (int i = 0; i < producer_arg->count; ++i) {
+    // 和跨线程回包一样, 每个任务都要求唤醒
+    producer_arg->event_loop->addTask([]() {
+      g_task_done.fetch_add(1, std::memory_order_relaxed);
+    }, true);
+  }
+  return NULL;
+}
+
+static void benchTasks(int producers, int count) {
+  rocket_rpc::IOThread io_thread;
+  io_thread.start();
+  g_task_done = 0;
+
+  std::vector<pthread_t> threads(producers);
+  std::vector<ProducerArg> args(producers);
+  int64_t begin = nowUs();
+  for (int i = 0; i < producers; ++i) {
+    args[i].event_loop = io_thread.getEventLoop();
+    args[i].count = count;
+    pthread_create(&threads[i], NULL, &producer, &args[i]);
+  }
+  for (int i = 0; i < producers; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+  int64_t total = (int64_t)producers * count;
+  while (g_task_done.load() < total) {
+    usleep(100);
+  }
+  int64_t cost = nowUs() - begin;
+
+  rocket_rpc::EventLoop* event_loop = io_thread.getEventLoop();
+  printf("tasks:  producers[%d] total[%lld] cost[%lld us] %.0f tasks/sec, wakeup issued[%lld] suppressed[%lld]\n", producers,
+    (long long)total, (long long)cost, total * 1000000.0 / cost,
+    (long long)event_loop->getWakeupIssuedCount(), (long long)event_loop->getWakeupSuppressedCount());
+}
+
+static std::atomic<int64_t> g_event_done {0};
+
+static void benchEvents(const char* poller_type, int pairs, int64_t duration_us) {
+  rocket_rpc::Config::GetGlobalConfig()->m_poller_type = poller_type;
+  rocket_rpc::IOThread io_thread;
+  rocket_rpc::EventLoop* event_loop = io_thread.getEventLoop();
+  g_event_done = 0;
+
+  // 每对 socketpair 的两端互相回写 1 字节, 始终保持一个字节在途
+  std::vector<rocket_rpc::FdEvent*> fd_events;
+  for (int i = 0; i < pairs; ++i) {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    for (int j = 0; j < 2; ++j) {
+      int fd = fds[j];
+      rocket_rpc::FdEvent* fd_event = new rocket_rpc::FdEvent(fd);
+      fd_event->setNonBlock();
+      fd_event->listen(rocket_rpc::FdEvent::IN_EVENT, [fd]() {
+        char c;
+        if (read(fd, &c, 1) == 1) {
+          g_event_done.fetch_add(1, std::memory_order_relaxed);
+          write(fd, &c, 1);
+        }
+      });
+      event_loop->addEpollEvent(fd_event);
+      fd_events.push_back(fd_event);
+    }
+    write(fds[0], "x", 1);
+  }
+
+  io_thread.start();
+  usleep(100000);
+  int64_t begin_count = g_event_done.load();
+  int64_t begin = nowUs();
+  usleep(duration_us);
+  int64_t count = g_event_done.load() - begin_count;
+  int64_t cost = nowUs() - begin;
+
+  printf("events: poller[%s] pairs[%d] total[%lld] cost[%lld us] %.0f events/sec\n", poller_type, pairs, (long long)count,
+    (long long)cost, count * 1000000.0 / cost);
+}
+
+int main(int argc, char* argv[]) {
+  rocket_rpc::Config::SetGlobalConfig(NULL);
+  rocket_rpc::Config::GetGlobalConfig()->m_log_level = "ERROR";
+  rocket_rpc::Logger::InitGlobalLogger(0);
+
+  int count = 1000000;
+  if (argc > 1) {
+    count = atoi(argv[1]);
+  }
+
+  benchTasks(1, count);
+  benchTasks(4, count / 4);
+  benchEvents("epoll", 1, 1000000);
+  benchEvents("epoll", 64, 1000000);
+  benchEvents("io_uring", 1, 1000000);
+  benchEvents("io_uring", 64, 1000000);
+
+  return 0;
+}
\ No newline at end of file
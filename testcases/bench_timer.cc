@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include "rocket/common/log.h"
+#include "rocket/common/config.h"
+#include "rocket/net/timer.h"
+#include "rocket/net/timer_event.h"
+#include "rocket/net/timing_wheel_timer.h"
+
+// 对比 multimap 定时器和分层时间轮定时器
+// 模拟 rpc 调用的超时定时任务: 大量在途调用各自挂一个超时任务, 绝大部分在超时前就完成并删除
+
+static int64_t nowUs() {
+  timeval val;
+  gettimeofday(&val, NULL);
+  return val.tv_sec * 1000000 + val.tv_usec;
+}
+
+static int g_fired = 0;
+
+static std::vector<rocket_rpc::TimerEvent::s_ptr> makeEvents(int count, int max_timeout) {
+  std::vector<rocket_rpc::TimerEvent::s_ptr> events;
+  events.reserve(count);
+  for (int i = 0; i < count; ++i) {
+    int timeout = max_timeout > 0 ? 1000 + rand() % max_timeout : 0;
+    events.push_back(std::make_shared<rocket_rpc::TimerEvent>(timeout, false, []() {
+      g_fired ++ ;
+    }));
+  }
+  return events;
+}
+
+static void bench(const char* name, rocket_rpc::Timer* timer, int count) {
+  srand(1);
+
+  // 1. 添加 count 个超时任务, 再以随机顺序全部删除
+  std::vector<rocket_rpc::TimerEvent::s_ptr> events = makeEvents(count, 10000);
+  int64_t begin = nowUs();
+  for (size_t i = 0; i < events.size(); ++i) {
+    timer->addTimerEvent(events[i]);
+  }
+  int64_t add_cost = nowUs() - begin;
+
+  std::random_shuffle(events.begin(), events.end());
+  begin = nowUs();
+  for (size_t i = 0; i < events.size(); ++i) {
+    timer->deleteTimerEvent(events[i]);
+  }
+  int64_t delete_cost = nowUs() - begin;
+
+  // 2. 保持 count 个在途任务, 每次完成一个调用就删除一个任务并添加一个新任务
+  events = makeEvents(count, 10000);
+  for (size_t i = 0; i < events.size(); ++i) {
+    timer->addTimerEvent(events[i]);
+  }
+  std::vector<rocket_rpc::TimerEvent::s_ptr> news = makeEvents(count, 10000);
+  begin = nowUs();
+  for (size_t i = 0; i < events.size(); ++i) {
+    timer->deleteTimerEvent(events[i]);
+    timer->addTimerEvent(news[i]);
+  }
+  int64_t churn_cost = nowUs() - begin;
+  for (size_t i = 0; i < news.size(); ++i) {
+    timer->deleteTimerEvent(news[i]);
+  }
+
+  // 3. 在有 count 个未到期任务的情况下, 触发 count 个已经到期的任务
+  events = makeEvents(count, 10000);
+  for (size_t i = 0; i < events.size(); ++i) {
+    timer->addTimerEvent(events[i]);
+  }
+  std::vector<rocket_rpc::TimerEvent::s_ptr> dues = makeEvents(count, 0);
+  for (size_t i = 0; i < dues.size(); ++i) {
+    timer->addTimerEvent(dues[i]);
+  }
+  usleep(2000);
+  g_fired = 0;
+  begin = nowUs();
+  timer->onTimer();
+  int64_t fire_cost = nowUs() - begin;
+  int fired = g_fired;
+  for (size_t i = 0; i < events.size(); ++i) {
+    timer->deleteTimerEvent(events[i]);
+  }
+
+  printf("%-10s count[%d] add[%.1f ns/op] delete[%.1f ns/op] delete+add[%.1f ns/op] fire[%.1f ns/op, %d fired] left[%d]\n",
+    name, count, add_cost * 1000.0 / count, delete_cost * 1000.0 / count, churn_cost * 1000.0 / count,
+    fire_cost * 1000.0 / count, fired, timer->size());
+}
+
+int main(int argc, char* argv[]) {
+  rocket_rpc::Config::SetGlobalConfig(NULL);
+  rocket_rpc::Config::GetGlobalConfig()->m_log_level = "ERROR";
+  rocket_rpc::Logger::InitGlobalLogger(0);
+
+  int count = 100000;
+  if (argc > 1) {
+    count = atoi(argv[1]);
+  }
+
+  rocket_rpc::Timer* timer = new rocket_rpc::Timer();
+  bench("multimap", timer, count);
+  delete timer;
+
+  timer = new rocket_rpc::TimingWheelTimer();
+  bench("wheel", timer, count);
+  delete timer;
+
+  return 0;
+}
\ No newline at end of file
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <pthread.h>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include "rocket/common/log.h"
+#include "rocket/common/config.h"
+#include "rocket/common/util.h"
+#include "rocket/common/mutex.h"
+#include "rocket/net/worker_pool.h"
+
+// 对比工作窃取的 WorkerPool 和单个加锁全局队列的线程池
+// 模拟倾斜的请求: 95% 的方法耗时 2us, 5% 的方法耗时 200us; 一半的请求来自同一个投递线程(热点 IO 线程)
+// 统计吞吐以及从投递到执行完的延迟
+
+// 单个全局队列, 所有投递线程和 worker 共用一把锁, 作为对照
+class GlobalQueuePool {
+  public:
+    typedef rocket_rpc::InlineFunction<void()> Task;
+
+    GlobalQueuePool(int size, int queue_size) : m_size(size), m_queue_size(queue_size) {
+      pthread_cond_init(&m_condition, NULL);
+    }
+
+    ~GlobalQueuePool() {
+      pthread_cond_destroy(&m_condition);
+    }
+
+    void start() {
+      m_threads.resize(m_size);
+      for (int i = 0; i < m_size; ++i) {
+        pthread_create(&m_threads[i], NULL, &GlobalQueuePool::Main, this);
+      }
+    }
+
+    void stop() {
+      rocket_rpc::ScopeMutex<rocket_rpc::Mutex> lock(m_mutex);
+      m_stop = true;
+      pthread_cond_broadcast(&m_condition);
+      lock.unlock();
+      for (int i = 0; i < m_size; ++i) {
+        pthread_join(m_threads[i], NULL);
+      }
+    }
+
+    bool submit(Task task) {
+      rocket_rpc::ScopeMutex<rocket_rpc::Mutex> lock(m_mutex);
+      if ((int)m_tasks.size() >= m_queue_size) {
+        return false;
+      }
+      m_tasks.push_back(std::move(task));
+      lock.unlock();
+      pthread_cond_signal(&m_condition);
+      return true;
+    }
+
+    int64_t getStealCount() {
+      return 0;
+    }
+
+    static void* Main(void* arg) {
+      GlobalQueuePool* pool = static_cast<GlobalQueuePool*>(arg);
+      while (true) {
+        rocket_rpc::ScopeMutex<rocket_rpc::Mutex> lock(pool->m_mutex);
+        while (pool->m_tasks.empty() && !pool->m_stop) {
+          pthread_cond_wait(&pool->m_condition, pool->m_mutex.getMutex());
+        }
+        if (pool->m_tasks.empty()) {
+          break;
+        }
+        Task task = std::move(pool->m_tasks.front());
+        pool->m_tasks.pop_front();
+        lock.unlock();
+        task();
+      }
+      return NULL;
+    }
+
+  private:
+    int m_size {0};
+    int m_queue_size {0};
+    bool m_stop {false};
+    std::vector<pthread_t> m_threads;
+    rocket_rpc::Mutex m_mutex;
+    pthread_cond_t m_condition;
+    std::deque<Task> m_tasks;
+};
+
+static void spin(int64_t us) {
+  int64_t begin = rocket_rpc::getNowUs();
+  while (rocket_rpc::getNowUs() - begin < us) {
+  }
+}
+
+static std::vector<int64_t> g_latency;
+static std::atomic<int64_t> g_done {0};
+static std::atomic<int64_t> g_retries {0};
+
+template <class Pool>
+struct ProducerArg {
+  Pool* pool;
+  int begin;
+  int end;
+};
+
+template <class Pool>
+static void* producer(void* arg) {
+  ProducerArg<Pool>* producer_arg = static_cast<ProducerArg<Pool>*>(arg);
+  for (int i = producer_arg->begin; i < producer_arg->end; ++i) {
+    int64_t submit_time = rocket_rpc::getNowUs();
+    int64_t cost = (i % 20 == 0) ? 200 : 2;
+    // 队列满时重试, 不丢请求
+    while (!producer_arg->pool->submit([i, submit_time, cost]() {
+      spin(cost);
+      g_latency[i] = rocket_rpc::getNowUs() - submit_time;
+      g_done.fetch_add(1, std::memory_order_relaxed);
+    })) {
+      g_retries.fetch_add(1, std::memory_order_relaxed);
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+template <class Pool>
+static void bench(const char* name, Pool* pool, int producers, int total) {
+  g_latency.assign(total, 0);
+  g_done = 0;
+  g_retries = 0;
+  pool->start();
+
+  // 第 0 个投递线程投递一半的请求, 其余的平分剩下的
+  std::vector<ProducerArg<Pool> > args(producers);
+  int hot = producers > 1 ? total / 2 : total;
+  int begin = 0;
+  for (int i = 0; i < producers; ++i) {
+    int count = (i == 0) ? hot : (total - hot) / (producers - 1);
+    if (i == producers - 1) {
+      count = total - begin;
+    }
+    args[i].pool = pool;
+    args[i].begin = begin;
+    args[i].end = begin + count;
+    begin += count;
+  }
+
+  int64_t start = rocket_rpc::getNowUs();
+  std::vector<pthread_t> threads(producers);
+  for (int i = 0; i < producers; ++i) {
+    pthread_create(&threads[i], NULL, &producer<Pool>, &args[i]);
+  }
+  for (int i = 0; i < producers; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+  while (g_done.load() < total) {
+    sched_yield();
+  }
+  int64_t cost = rocket_rpc::getNowUs() - start;
+  pool->stop();
+
+  std::vector<int64_t> latency = g_latency;
+  std::sort(latency.begin(), latency.end());
+  int64_t sum = 0;
+  for (size_t i = 0; i < latency.size(); ++i) {
+    sum += latency[i];
+  }
+  printf("%-12s total[%d] cost[%lld us] %.0f tasks/sec, latency avg[%lld us] p99[%lld us] max[%lld us], full retries[%lld] steals[%lld]\n",
+    name, total, (long long)cost, total * 1000000.0 / cost, (long long)(sum / total), (long long)latency[total * 99 / 100],
+    (long long)latency[total - 1], (long long)g_retries.load(), (long long)pool->getStealCount());
+}
+
+int main(int argc, char* argv[]) {
+  rocket_rpc::Config::SetGlobalConfig(NULL);
+  rocket_rpc::Config::GetGlobalConfig()->m_log_level = "ERROR";
+  rocket_rpc::Logger::InitGlobalLogger(0);
+
+  int workers = 4;
+  int producers = 4;
+  int total = 200000;
+  if (argc > 1) {
+    workers = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    producers = atoi(argv[2]);
+  }
+  if (argc > 3) {
+    total = atoi(argv[3]);
+  }
+  printf("workers[%d] producers[%d] tasks[%d], 5%% tasks cost 200us, others cost 2us, half of tasks from one producer\n",
+    workers, producers, total);
+
+  // 两种线程池能容纳的任务总数相同
+  GlobalQueuePool global_pool(workers, workers * 256);
+  bench("global_queue", &global_pool, producers, total);
+
+  rocket_rpc::WorkerPool steal_pool("bench", workers, 256);
+  bench("work_steal", &steal_pool, producers, total);
+
+  return 0;
+}
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include <netinet/in.h>
 #include <memory>
 #include <unistd.h>
+#include <semaphore.h>
 #include "rocket/common/log.h"
 #include "rocket/common/config.h"
 #include "rocket/net/tcp/tcp_client.h"
@@ -61,6 +62,9 @@ void test_tcp_client() {
   });
 }
 
+// 异步调用的回调在客户端 IO 线程中执行, 主线程需要等待回调结束后再退出
+sem_t g_done_sem;
+
 void test_rpc_channel() {
   // 创建 channel 
   // rocket_rpc::IPNetAddr::s_ptr addr = std::make_shared<rocket_rpc::IPNetAddr>("127.0.0.1", 12345);
@@ -97,6 +101,7 @@ void test_rpc_channel() {
     INFOLOG("now exit eventloop");
     // channel->getTcpClient()->stop();
     channel.reset();
+    sem_post(&g_done_sem);
   });
 
   // 调用 RPC 请求
@@ -106,6 +111,28 @@ void test_rpc_channel() {
   CALLRPC("127.0.0.1:12345", Order_Stub, makeOrder, controller, request, response, closure);
 }
 
+void test_rpc_channel_sync() {
+  NEWRPCCHANNEL("127.0.0.1:12345", channel);
+  NEWMESSAGE(makeOrderRequest, request);
+  NEWMESSAGE(makeOrderResponse, response);
+  request->set_price(200);
+  request->set_goods("banana");
+
+  NEWRPCCONTROLLER(controller);
+  controller->SetTimeout(10000);
+
+  // done 为 NULL 时是同步调用, 阻塞到调用完成(成功, 失败或超时)
+  Order_Stub(channel.get()).makeOrder(controller.get(), request.get(), response.get(), NULL);
+
+  if (controller->GetErrorCode() == 0) {
+    INFOLOG("sync call rpc success, request[%s], resposne[%s]", request->ShortDebugString().c_str(), response->ShortDebugString().c_str());
+  } else {
+    ERRORLOG("sync call rpc failed, request[%s], error code[%d], error info[%s]", 
+      request->ShortDebugString().c_str(), 
+      controller->GetErrorCode(), controller->GetErrorInfo().c_str());
+  }
+}
+
 int main() {
   rocket_rpc::Config::SetGlobalConfig(NULL);
 
@@ -114,7 +141,12 @@ int main() {
 
   // test_tcp_client();
 
+  sem_init(&g_done_sem, 0, 0);
   test_rpc_channel();
+  sem_wait(&g_done_sem);
+  sem_destroy(&g_done_sem);
+
+  test_rpc_channel_sync();
 
   INFOLOG("test_rpc_channel end");
 
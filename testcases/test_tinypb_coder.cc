@@ -0,0 +1,297 @@
+#include <assert.h>
+#include <stdio.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "rocket/common/log.h"
+#include "rocket/common/config.h"
+#include "rocket/common/msg_id_util.h"
+#include "rocket/net/tcp/tcp_buffer.h"
+#include "rocket/net/coder/tinypb_coder.h"
+#include "rocket/net/coder/tinypb_protocol.h"
+#include "order.pb.h"
+
+// TinyPBCoder 的编解码测试, 不需要网络, 直接在 TcpBuffer 上 encode / decode
+// v1 / v2 往返, 帧跨越 block 以及逐字节到达, v1 和 v2 混合的流水线请求, 握手回包, 以及 v2 帧的大小
+
+using rocket_rpc::TcpBuffer;
+using rocket_rpc::TinyPBCoder;
+using rocket_rpc::TinyPBProtocol;
+using rocket_rpc::AbstractProtocol;
+
+static const char* g_method_name = "Order.makeOrder";
+
+static std::shared_ptr<TinyPBProtocol> makeRequest(const std::string& msg_id, const std::string& goods, int32_t timeout) {
+  makeOrderRequest request;
+  request.set_price(100);
+  request.set_goods(goods);
+
+  std::shared_ptr<TinyPBProtocol> message = std::make_shared<TinyPBProtocol>();
+  message->m_msg_id = msg_id;
+  message->m_method_name = g_method_name;
+  message->m_timeout = timeout;
+  assert(request.SerializeToString(&message->m_pb_data));
+  return message;
+}
+
+// 与 RpcDispatcher 一样, 回包沿用请求的 msg_id, method 名和版本
+static std::shared_ptr<TinyPBProtocol> makeResponse(std::shared_ptr<TinyPBProtocol> request, const std::string& order_id) {
+  makeOrderResponse response;
+  response.set_order_id(order_id);
+
+  std::shared_ptr<TinyPBProtocol> message = std::make_shared<TinyPBProtocol>();
+  message->m_msg_id = request->m_msg_id;
+  message->m_method_name = request->m_method_name;
+  message->m_version = request->m_version;
+  assert(response.SerializeToString(&message->m_pb_data));
+  return message;
+}
+
+// 编码一个 message, 返回这一帧的字节数
+static int encodeOne(TinyPBCoder& coder, std::shared_ptr<TinyPBProtocol> message, TcpBuffer::s_ptr buffer) {
+  std::vector<AbstractProtocol::s_ptr> messages;
+  messages.push_back(message);
+  int before = buffer->readAble();
+  coder.encode(messages, buffer);
+  return buffer->readAble() - before;
+}
+
+static std::string readAll(TcpBuffer::s_ptr buffer) {
+  std::string data(buffer->readAble(), 0);
+  if (!data.empty()) {
+    assert(buffer->peek(&data[0], 0, data.length()));
+    buffer->moveReadIndex(data.length());
+  }
+  return data;
+}
+
+static std::shared_ptr<TinyPBProtocol> decodeOne(TinyPBCoder& coder, TcpBuffer::s_ptr buffer) {
+  std::vector<AbstractProtocol::s_ptr> messages;
+  coder.decode(messages, buffer);
+  assert(messages.size() == 1);
+  assert(buffer->readAble() == 0);
+  return std::dynamic_pointer_cast<TinyPBProtocol>(messages[0]);
+}
+
+static void checkRequest(std::shared_ptr<TinyPBProtocol> message, const std::string& msg_id, const std::string& goods) {
+  assert(message->parse_success);
+  assert(message->m_msg_id == msg_id);
+  assert(message->m_err_code == 0);
+  makeOrderRequest request;
+  assert(request.ParseFromString(message->m_pb_data));
+  assert(request.price() == 100);
+  assert(request.goods() == goods);
+}
+
+// 客户端发送握手, 服务端回复方法表, 握手回包由客户端 coder 自己消费, 不交给上层
+static void handshake(TinyPBCoder& client_coder) {
+  TcpBuffer::s_ptr buffer = std::make_shared<TcpBuffer>();
+  TinyPBCoder server_coder(true);
+
+  std::shared_ptr<TinyPBProtocol> request = client_coder.makeHandshake();
+  encodeOne(client_coder, request, buffer);
+  std::shared_ptr<TinyPBProtocol> server_request = decodeOne(server_coder, buffer);
+  assert(server_request->m_version == 1);
+  assert(server_request->m_method_name == TinyPBProtocol::PB_HANDSHAKE_METHOD);
+
+  std::shared_ptr<TinyPBProtocol> response = std::make_shared<TinyPBProtocol>();
+  response->m_msg_id = server_request->m_msg_id;
+  response->m_method_name = server_request->m_method_name;
+  TinyPBCoder::encodeMethodTable(std::vector<std::string>(1, g_method_name), response->m_pb_data);
+  encodeOne(server_coder, response, buffer);
+
+  std::vector<AbstractProtocol::s_ptr> messages;
+  client_coder.decode(messages, buffer);
+  assert(messages.empty());
+  assert(buffer->readAble() == 0);
+}
+
+void test_round_trip() {
+  TinyPBCoder client_coder;
+  TinyPBCoder server_coder(true);
+  TcpBuffer::s_ptr buffer = std::make_shared<TcpBuffer>();
+
+  // 握手之前是与最初格式相同的 v1 帧, 不带 timeout
+  std::string msg_id = rocket_rpc::MsgIDUtil::GenMsgID();
+  std::shared_ptr<TinyPBProtocol> request = makeRequest(msg_id, "apple", 1000);
+  int v1_request_len = encodeOne(client_coder, request, buffer);
+  std::string frame = readAll(buffer);
+  assert(frame[0] == TinyPBProtocol::PB_START);
+  assert(frame[frame.length() - 1] == TinyPBProtocol::PB_END);
+  buffer->writeToBuffer(frame.data(), frame.length());
+
+  std::shared_ptr<TinyPBProtocol> server_request = decodeOne(server_coder, buffer);
+  checkRequest(server_request, msg_id, "apple");
+  assert(server_request->m_version == 1);
+  assert(server_request->m_method_name == g_method_name);
+  assert(server_request->m_timeout == 0);
+
+  int v1_response_len = encodeOne(server_coder, makeResponse(server_request, "20230514"), buffer);
+  std::shared_ptr<TinyPBProtocol> response = decodeOne(client_coder, buffer);
+  assert(response->m_version == 1);
+  assert(response->m_msg_id == msg_id);
+  makeOrderResponse pb_response;
+  assert(pb_response.ParseFromString(response->m_pb_data));
+  assert(pb_response.order_id() == "20230514");
+
+  // 握手之后同一个请求用 v2 发送, method 名换成 id
+  handshake(client_coder);
+  msg_id = rocket_rpc::MsgIDUtil::GenMsgID();
+  request = makeRequest(msg_id, "apple", 1000);
+  int v2_request_len = encodeOne(client_coder, request, buffer);
+  assert(request->m_version == 2);
+
+  server_request = decodeOne(server_coder, buffer);
+  checkRequest(server_request, msg_id, "apple");
+  assert(server_request->m_version == 2);
+  assert(server_request->m_method_id == 0);
+  assert(server_request->m_method_name.empty());
+  assert(server_request->m_timeout == 1000);
+
+  int v2_response_len = encodeOne(server_coder, makeResponse(server_request, "20230514"), buffer);
+  response = decodeOne(client_coder, buffer);
+  assert(response->m_version == 2);
+  assert(response->m_msg_id == msg_id);
+  assert(pb_response.ParseFromString(response->m_pb_data));
+  assert(pb_response.order_id() == "20230514");
+
+  printf("request %d -> %d bytes, response %d -> %d bytes\n", v1_request_len, v2_request_len, v1_response_len, v2_response_len);
+  assert(v1_request_len == 70 && v2_request_len == 24);
+  assert(v1_response_len == 71 && v2_response_len == 22);
+}
+
+// v1 请求, v2 请求, 以及 msg_id 不能转成 request_id 时退回的带 timeout 的 v1 请求, 在同一个 buffer 中一次解出来
+void test_pipeline() {
+  TinyPBCoder old_client_coder;
+  TinyPBCoder client_coder;
+  TinyPBCoder server_coder(true);
+  handshake(client_coder);
+
+  TcpBuffer::s_ptr buffer = std::make_shared<TcpBuffer>();
+  std::vector<std::string> msg_ids;
+  msg_ids.push_back(rocket_rpc::MsgIDUtil::GenMsgID());
+  msg_ids.push_back(rocket_rpc::MsgIDUtil::GenMsgID());
+  msg_ids.push_back("not-a-number");
+  msg_ids.push_back(rocket_rpc::MsgIDUtil::GenMsgID());
+
+  encodeOne(old_client_coder, makeRequest(msg_ids[0], "pear", 500), buffer);
+  encodeOne(client_coder, makeRequest(msg_ids[1], "peach", 500), buffer);
+  encodeOne(client_coder, makeRequest(msg_ids[2], "plum", 500), buffer);
+  encodeOne(client_coder, makeRequest(msg_ids[3], "grape", 0), buffer);
+
+  std::vector<AbstractProtocol::s_ptr> messages;
+  server_coder.decode(messages, buffer);
+  assert(messages.size() == 4);
+  assert(buffer->readAble() == 0);
+
+  const char* goods[] = {"pear", "peach", "plum", "grape"};
+  int versions[] = {1, 2, 1, 2};
+  int timeouts[] = {0, 500, 500, 0};
+  for (size_t i = 0; i < messages.size(); ++i) {
+    std::shared_ptr<TinyPBProtocol> message = std::dynamic_pointer_cast<TinyPBProtocol>(messages[i]);
+    checkRequest(message, msg_ids[i], goods[i]);
+    assert(message->m_version == versions[i]);
+    assert(message->m_timeout == timeouts[i]);
+  }
+  printf("pipeline of %d mixed v1/v2 frames ok\n", (int)messages.size());
+}
+
+// 整条字节流逐字节写入 buffer, 每写一个字节 decode 一次
+// 帧(包括 v2 的 varint 长度字段)没收全时不能解出 message, 也不能消费数据; 大包跨越多个 block
+void test_split_frames() {
+  TinyPBCoder client_coder;
+  TinyPBCoder server_coder(true);
+  handshake(client_coder);
+
+  TcpBuffer::s_ptr buffer = std::make_shared<TcpBuffer>();
+  std::vector<std::string> msg_ids;
+  std::vector<std::string> goods;
+  std::vector<int> frame_ends;
+  for (int i = 0; i < 6; ++i) {
+    msg_ids.push_back(rocket_rpc::MsgIDUtil::GenMsgID());
+    // 200 字节时 v2 的 body_len 是两个字节的 varint, 10000 字节的包跨越三个 block
+    goods.push_back(std::string(i % 3 == 0 ? 10 : (i % 3 == 1 ? 200 : 10000), 'a' + i));
+    if (i % 2 == 0) {
+      msg_ids[i] = msg_ids[i].substr(1);   // 19 位的 msg_id 只能用 v1 发送
+    }
+    int len = encodeOne(client_coder, makeRequest(msg_ids[i], goods[i], 100), buffer);
+    frame_ends.push_back((frame_ends.empty() ? 0 : frame_ends.back()) + len);
+  }
+  std::string stream = readAll(buffer);
+  assert((int)stream.length() == frame_ends.back());
+
+  std::vector<AbstractProtocol::s_ptr> messages;
+  size_t next_frame = 0;
+  for (size_t i = 0; i < stream.length(); ++i) {
+    buffer->writeToBuffer(&stream[i], 1);
+    server_coder.decode(messages, buffer);
+    if ((int)i + 1 == frame_ends[next_frame]) {
+      assert(messages.size() == next_frame + 1);
+      assert(buffer->readAble() == 0);
+      next_frame ++ ;
+    } else {
+      assert(messages.size() == next_frame);
+    }
+  }
+
+  for (size_t i = 0; i < messages.size(); ++i) {
+    std::shared_ptr<TinyPBProtocol> message = std::dynamic_pointer_cast<TinyPBProtocol>(messages[i]);
+    checkRequest(message, msg_ids[i], goods[i]);
+    assert(message->m_version == (i % 2 == 0 ? 1 : 2));
+  }
+  printf("%d frames fed byte by byte ok, %d bytes\n", (int)messages.size(), (int)stream.length());
+}
+
+// 直接序列化 m_pb_message 的大包, 写入时从 block 中间开始, 解码时跨 block 拼接
+void test_large_message() {
+  TinyPBCoder client_coder;
+  TinyPBCoder server_coder(true);
+  handshake(client_coder);
+
+  TcpBuffer::s_ptr buffer = std::make_shared<TcpBuffer>();
+  std::string goods(70000, 'x');
+  for (size_t i = 0; i < goods.length(); i += 97) {
+    goods[i] = 'A' + i % 26;
+  }
+  makeOrderRequest pb_request;
+  pb_request.set_price(100);
+  pb_request.set_goods(goods);
+
+  for (int version = 1; version <= 2; ++version) {
+    std::string msg_id = rocket_rpc::MsgIDUtil::GenMsgID();
+    std::shared_ptr<TinyPBProtocol> request = std::make_shared<TinyPBProtocol>();
+    request->m_msg_id = version == 1 ? msg_id.substr(1) : msg_id;
+    request->m_method_name = g_method_name;
+    request->m_pb_message = &pb_request;
+
+    std::string padding(1000, 'p');
+    buffer->writeToBuffer(padding.data(), padding.length());
+    buffer->moveReadIndex(padding.length());
+    encodeOne(client_coder, request, buffer);
+    assert(request->m_version == version);
+    assert(request->m_pb_message == NULL);
+
+    std::shared_ptr<TinyPBProtocol> message = decodeOne(server_coder, buffer);
+    checkRequest(message, request->m_msg_id, goods);
+  }
+  printf("large message ok, %d bytes of goods\n", (int)goods.length());
+}
+
+int main() {
+
+  rocket_rpc::Config::SetGlobalConfig(NULL);
+  rocket_rpc::Config::GetGlobalConfig()->m_log_level = "ERROR";
+  rocket_rpc::Logger::InitGlobalLogger(0);
+
+  test_round_trip();
+
+  test_pipeline();
+
+  test_split_frames();
+
+  test_large_message();
+
+  printf("test tinypb coder ok\n");
+
+  return 0;
+}
\ No newline at end of file